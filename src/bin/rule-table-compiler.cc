@@ -0,0 +1,23 @@
+#include <travatar/config-rule-table-compiler.h>
+#include <travatar/lookup-table-marisa.h>
+#include <travatar/global-debug.h>
+#include <boost/scoped_ptr.hpp>
+#include <fstream>
+
+using namespace travatar;
+using namespace std;
+
+int main(int argc, char** argv) {
+    // load the arguments
+    ConfigRuleTableCompiler conf;
+    vector<string> args = conf.LoadConfig(argc,argv);
+    GlobalVars::debug = conf.GetInt("debug");
+    // read the text table and write it in binary format
+    string in_file = args[0];
+    boost::scoped_ptr<LookupTableMarisa> tm(LookupTableMarisa::ReadFromFile(in_file));
+    ofstream out(args[1].c_str(), ios::out | ios::binary);
+    if(!out)
+        THROW_ERROR("Could not open binary output file: " << args[1]);
+    tm->WriteBinary(out);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include <travatar/config-rule-table-filter.h>
+#include <travatar/lookup-table-marisa.h>
+#include <travatar/load-method.h>
+#include <travatar/input-file-stream.h>
+#include <travatar/tree-io.h>
+#include <travatar/global-debug.h>
+#include <boost/scoped_ptr.hpp>
+#include <fstream>
+
+using namespace travatar;
+using namespace std;
+
+int main(int argc, char** argv) {
+    // load the arguments
+    ConfigRuleTableFilter conf;
+    vector<string> args = conf.LoadConfig(argc,argv);
+    GlobalVars::debug = conf.GetInt("debug");
+    // read the words of the input
+    boost::scoped_ptr<TreeIO> tree_io;
+    if(conf.GetString("in_format") == "penn")
+        tree_io.reset(new PennTreeIO);
+    else if(conf.GetString("in_format") == "egret")
+        tree_io.reset(new EgretTreeIO);
+    else if(conf.GetString("in_format") == "moses")
+        tree_io.reset(new MosesXMLTreeIO);
+    else if(conf.GetString("in_format") == "word")
+        tree_io.reset(new WordTreeIO);
+    else
+        THROW_ERROR("Bad in_format option " << conf.GetString("in_format"));
+    // InputFileStream throws if the file cannot be opened
+    boost::scoped_ptr<InputFileStream> in;
+    try {
+        in.reset(new InputFileStream(args[1].c_str()));
+    } catch(std::runtime_error &) {
+        THROW_ERROR("Could not open input file: " << args[1]);
+    }
+    set<WordId> vocab;
+    tree_io->ReadVocabulary(*in, vocab);
+    // filter the binary table and write the rules that are left
+    boost::scoped_ptr<LookupTableMarisa> tm(LookupTableMarisa::ReadFromBinaryFile(args[0], ParseLoadMethod(conf.GetString("tm_load"))));
+    boost::scoped_ptr<LookupTableMarisa> filtered(tm->Filter(vocab));
+    ofstream out(args[2].c_str(), ios::out | ios::binary);
+    if(!out)
+        THROW_ERROR("Could not open binary output file: " << args[2]);
+    filtered->WriteBinary(out);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef CONFIG_RULE_TABLE_COMPILER_H__
+#define CONFIG_RULE_TABLE_COMPILER_H__
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <sstream>
+#include <travatar/config-base.h>
+
+namespace travatar {
+
+class ConfigRuleTableCompiler : public ConfigBase {
+
+public:
+
+    ConfigRuleTableCompiler() : ConfigBase() {
+        minArgs_ = 2;
+        maxArgs_ = 2;
+
+        SetUsage(
+"~~~ rule-table-compiler ~~~\n"
+"  by Graham Neubig\n"
+"\n"
+"Compiles a rule table into a binary file that can be used with -tm_storage marisa-bin.\n"
+"  Usage: rule-table-compiler RULE_TABLE BINARY_OUT\n"
+);
+
+        AddConfigEntry("debug", "0", "How much debug output to produce");
+
+    }
+	
+};
+
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef CONFIG_RULE_TABLE_FILTER_H__
+#define CONFIG_RULE_TABLE_FILTER_H__
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <sstream>
+#include <travatar/config-base.h>
+
+namespace travatar {
+
+class ConfigRuleTableFilter : public ConfigBase {
+
+public:
+
+    ConfigRuleTableFilter() : ConfigBase() {
+        minArgs_ = 3;
+        maxArgs_ = 3;
+
+        SetUsage(
+"~~~ rule-table-filter ~~~\n"
+"  by Graham Neubig\n"
+"\n"
+"Filters a binary rule table to the rules whose source words all appear in an\n"
+"input file, and writes them to a new binary file.\n"
+"  Usage: rule-table-filter BINARY_IN INPUT BINARY_OUT\n"
+);
+
+        AddConfigEntry("debug", "0", "How much debug output to produce");
+        AddConfigEntry("in_format", "penn", "The format of the input (penn/egret/moses/word)");
+        AddConfigEntry("tm_load", "mmap", "How to load the binary rule table (mmap/populate/read)");
+
+    }
+	
+};
+
+}
+
+#endif
@@ -31,6 +31,7 @@ public:
         AddConfigEntry("binarize", "right", "How to binarize the trees (none/left/right)");
         AddConfigEntry("buffer", "true", "Whether to buffer the output. Turn off if you want file output in real time.");
         AddConfigEntry("chart_limit", "100", "The number of elements in any particular chart cell");
+        AddConfigEntry("chart_threads", "1", "The number of threads used to build the chart of a single sentence (search=cp only)");
         AddConfigEntry("config_file", "", "The location of the configuration file");
         AddConfigEntry("consider_trg", "false", "Whether lookup t2s consider about target side or not.");
         AddConfigEntry("debug", "1", "What level of debugging output to print");
@@ -40,17 +41,24 @@ public:
         AddConfigEntry("hiero_span_limit","20", "The span limit of non terminal symbol in hiero translation");
         AddConfigEntry("in_format", "penn", "The format of the input (penn/egret/moses/word)");
         AddConfigEntry("lm_file", "", "Language model file location");
+        AddConfigEntry("lm_load", "populate", "How to load binary LMs (mmap/populate/read). mmap and populate share the file between processes through the page cache");
         AddConfigEntry("lm_multi_type", "joint", "How to combine multiple LMs (joint/consec)");
         AddConfigEntry("nbest", "1", "The length of the n-best list");
         AddConfigEntry("nbest_out", "", "n-best output file location");
         AddConfigEntry("nbest_tree", "false", "Print n-best entries with trees used in translations");
         AddConfigEntry("nbest_uniq", "false", "Print only n-best entries with unique target sides");
         AddConfigEntry("pop_limit", "2000", "The number of pops necessary");
+        AddConfigEntry("rest_cost", "false", "Order cube pruning hypotheses using an estimate of the LM score of the words in each rule (search=cp or tm_storage=cfg)");
         AddConfigEntry("root_symbol", "S", "Root symbol in the rule-table (fsm)");
-        AddConfigEntry("search", "inc", "The type of search (Cube Pruning (cp)/Incremental (inc))");
+        AddConfigEntry("server", "", "Run as a server, answering requests on stdin/stdout (stdio) or a Unix domain socket (unix:PATH)");
+        AddConfigEntry("search", "inc", "The type of search (Cube Pruning (cp)/Cube Growing (cg)/Incremental (inc))");
+        AddConfigEntry("stats_out", "", "Write timing and counts for each stage of decoding, summed over all sentences, to this file as JSON");
+        AddConfigEntry("stats_sent_out", "", "Write timing and counts for each stage of decoding of each sentence to this file, one line of JSON per sentence");
         AddConfigEntry("threads", "1", "The number of threads to use in translation");
         AddConfigEntry("tm_file", "", "Translation model file location");
-        AddConfigEntry("tm_storage", "marisa", "Method of storing the rule table (marisa/hash/hiero/fsm)");
+        AddConfigEntry("tm_filter", "", "A file containing the input to be translated, in the format of in_format. Only rules whose source words all appear in it are loaded (tm_storage=marisa/marisa-bin/fsm/cfg)");
+        AddConfigEntry("tm_load", "mmap", "How to load a compiled rule table with tm_storage=marisa-bin (mmap/populate/read)");
+        AddConfigEntry("tm_storage", "marisa", "Method of storing the rule table (marisa/marisa-bin/hash/hash-int/hiero/fsm)");
         AddConfigEntry("trace_out", "", "trace output file location");
         AddConfigEntry("trg_factors", "1", "The number of types of output to produce");
         AddConfigEntry("unk_symbol", "X", "Unknown word symbol in the rule-table (fsm)");
@@ -0,0 +1,132 @@
+#ifndef DECODER_STATS_H__
+#define DECODER_STATS_H__
+
+// Timing and counters for the stages of translating each sentence.
+//
+// Each sentence collects its own statistics in a SentenceStats, which is
+// attached to the thread that translates it. Components deep inside the
+// decoder add to its counters through CountStat(), which does nothing unless
+// statistics are being collected. The finished statistics are added to a
+// DecoderStats, which keeps histograms over all sentences and writes them
+// out as JSON
+
+#include <travatar/timer.h>
+#include <boost/thread/mutex.hpp>
+#include <iostream>
+#include <vector>
+
+namespace travatar {
+
+class OutputCollector;
+
+// The stages of translating a single sentence
+typedef enum {
+    STAGE_BINARIZE = 0,
+    STAGE_RULE_LOOKUP,
+    STAGE_RULE_SCORE,
+    STAGE_LM,
+    STAGE_NBEST,
+    STAGE_OUTPUT,
+    STAGE_TUNE,
+    NUM_STAGES
+} DecoderStage;
+
+// The things that are counted while translating a sentence
+typedef enum {
+    COUNT_WORDS = 0,
+    COUNT_RULE_NODES,
+    COUNT_RULE_EDGES,
+    COUNT_LM_NODES,
+    COUNT_LM_EDGES,
+    COUNT_CUBE_POPS,
+    COUNT_LM_QUERIES,
+    COUNT_LOOKUP_HITS,
+    COUNT_LOOKUP_MISSES,
+    NUM_COUNTERS
+} DecoderCounter;
+
+class SentenceStats {
+public:
+    SentenceStats(int sent = -1);
+    ~SentenceStats() { Detach(); }
+
+    // Make these the statistics that CountStat() adds to on this thread
+    void Attach();
+    void Detach();
+    static SentenceStats * GetCurrent() { return current_; }
+
+    // Start timing a stage, finishing the one before it
+    void StartStage(DecoderStage stage);
+    // Finish timing the current stage
+    void EndStage();
+
+    void Count(DecoderCounter counter, long long num = 1) { counts_[counter] += num; }
+
+    int GetSent() const { return sent_; }
+    double GetTime(int stage) const { return times_[stage]; }
+    double GetTotalTime() const;
+    long long GetCount(int counter) const { return counts_[counter]; }
+
+    // Write the statistics as a single line of JSON
+    void WriteJSON(std::ostream & out) const;
+
+protected:
+    int sent_;
+    double times_[NUM_STAGES];
+    long long counts_[NUM_COUNTERS];
+    Timer timer_;
+    int stage_;
+    double stage_start_;
+    bool attached_;
+    // The statistics for the sentence being translated on this thread
+    static thread_local SentenceStats * current_;
+};
+
+// Add to a counter of the sentence being translated on this thread, if any
+inline void CountStat(DecoderCounter counter, long long num = 1) {
+    SentenceStats * stats = SentenceStats::GetCurrent();
+    if(stats != NULL) stats->Count(counter, num);
+}
+
+// Statistics over all sentences. Safe to use from several threads at once
+class DecoderStats {
+public:
+    DecoderStats() : num_sents_(0), stage_hists_(NUM_STAGES), counter_hists_(NUM_COUNTERS), sent_collector_(NULL) { }
+
+    // Add the statistics for one sentence
+    void Add(const SentenceStats & stats);
+
+    // If set, the statistics of every sentence are also written to this
+    // collector as one line of JSON, using the sentence id
+    void SetSentenceCollector(OutputCollector * collector) { sent_collector_ = collector; }
+
+    // Write the totals and histograms as JSON. Times are in milliseconds,
+    // and the histograms have power-of-two buckets, so bucket i counts
+    // values in [2^(i-1), 2^i) and bucket 0 counts values below 1
+    void WriteJSON(std::ostream & out) const;
+
+    int GetNumSents() const { return num_sents_; }
+
+    static const char * GetStageName(int stage);
+    static const char * GetCounterName(int counter);
+
+protected:
+    struct Histogram {
+        Histogram() : sum(0), max(0) { }
+        void Add(double val);
+        void WriteJSON(std::ostream & out) const;
+        double sum, max;
+        std::vector<long long> buckets;
+    };
+
+    int num_sents_;
+    Histogram total_hist_;
+    std::vector<Histogram> stage_hists_;
+    std::vector<Histogram> counter_hists_;
+    OutputCollector * sent_collector_;
+    mutable boost::mutex mutex_;
+};
+
+}
+
+#endif
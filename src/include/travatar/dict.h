@@ -19,10 +19,15 @@ struct Dict {
         add_ = false;
     }
 
+    // Call FreezeVocab once the models are loaded to make lookups of all
+    // existing words lock-free. New words can still be added afterwards
+    static void FreezeVocab();
+
     static const std::string INVALID_SPAN_SYMBOL;
 
     // Get the word ID
     static WordId WID(const std::string & str);
+    static WordId WID(const char * str, size_t len);
 
     // Get the quoted word ID
     static WordId WIDAnnotated(const std::string & str);
@@ -6,6 +6,9 @@
 #include <travatar/cfg-data.h>
 #include <travatar/nbest-list.h>
 #include <travatar/real.h>
+#include <boost/pool/object_pool.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_set.hpp>
 #include <vector>
 #include <climits>
 #include <cfloat>
@@ -37,8 +40,10 @@ protected:
     std::string src_str_;
     CfgDataVector trg_data_;
     SparseVector features_;
+    // The rule that the target data came from, if any
+    const TranslationRule * rule_;
 public:
-    HyperEdge(HyperNode* head = NULL) : id_(-1), head_(head), score_(0.0) { };
+    HyperEdge(HyperNode* head = NULL) : id_(-1), head_(head), score_(0.0), rule_(NULL) { };
     virtual ~HyperEdge() { };
 
     // Refresh the pointers to head and tail nodes so they point to
@@ -66,9 +71,13 @@ public:
     std::vector<HyperNode*> & GetTails() { return tails_; }
     int NumTails() const { return tails_.size(); }
     void SetTails(const std::vector<HyperNode*> & tails) { tails_ = tails; }
-    // const TranslationRule * GetRule() const { return rule_; }
+    // Get the rule that the target data came from. This must only be used
+    // while the rule is alive, and is reset if the target data is changed
+    const TranslationRule * GetRule() const { return rule_; }
     // Set the translation rule, including the features in the edges covered by the rule
     void SetRule(const TranslationRule * rule, const SparseVector & orig_features = SparseVector());
+    // Forget the rule, for when it will be deleted before the edge
+    void ClearRule() { rule_ = NULL; }
     const std::string & GetSrcStr() const { return src_str_; }
     const CfgDataVector & GetTrgData() const { return trg_data_; }
     const SparseVector & GetFeatures() const { return features_; }
@@ -76,10 +85,11 @@ public:
     CfgDataVector & GetTrgData() { return trg_data_; }
     SparseVector & GetFeatures() { return features_; }
     void SetSrcStr(const std::string & str) { src_str_ = str; }
-    void SetTrgData(const CfgDataVector & trg) { trg_data_ = trg; }
+    void SetTrgData(const CfgDataVector & trg) { trg_data_ = trg; rule_ = NULL; }
     void SetFeatures(const SparseVector & feat) { features_ = feat; }
     // void AddFeature(int idx, Real feat) { features_[idx] += feat; }
     void AddTrgWord(int idx, int factor = 0) {
+        rule_ = NULL;
         if((int)trg_data_.size() <= factor)
             trg_data_.resize(factor+1);
         trg_data_[factor].words.push_back(idx);
@@ -308,51 +318,6 @@ inline std::ostream &operator<<( std::ostream &out, const HyperPath &L ) {
     return out;
 }
 
-class NbestStackItem {
-public:
-    NbestStackItem(Real s, int er, const std::vector<int> & cr) :
-        score(s), edge_rank(er), child_ranks(cr) { }
-
-    Real score;
-    int edge_rank;
-    std::vector<int> child_ranks;
-
-};
-
-class StackScoreMore {
-public:
-    bool operator()(const boost::shared_ptr<NbestStackItem> x, const boost::shared_ptr<NbestStackItem> y) {
-        if(x->score != y->score) { return x->score > y->score; }
-        if(x->edge_rank != y->edge_rank) { return x->edge_rank < y->edge_rank; }
-        for(int i = 0; i < (int)x->child_ranks.size(); i++) {
-            if(x->child_ranks[i] != y->child_ranks[i]) { return x->child_ranks[i] < y->child_ranks[i]; }
-        }
-        return false;
-    }
-};
-
-typedef std::pair<Real, int> NbestEdge;
-class NbestState {
-public:
-    NbestState() { }
-
-    typedef std::set<boost::shared_ptr<NbestStackItem>, StackScoreMore> NbestStateStack;
-
-    void PushStack(const boost::shared_ptr<NbestStackItem> & item) { stack.insert(item); }
-    boost::shared_ptr<NbestStackItem> PopStack() {
-        NbestStateStack::iterator beg = stack.begin();
-        boost::shared_ptr<NbestStackItem> ret = *beg;
-        stack.erase(beg);
-        return ret;
-    }
-
-    std::vector<NbestEdge> edges;
-    NbestStateStack stack;
-    std::vector<boost::shared_ptr<HyperPath> > paths;
-    std::set<CfgDataVector> uniq_sents;
-
-};
-
 // The hypergraph
 class HyperGraph {
 public: 
@@ -365,6 +330,11 @@ protected:
     std::vector<HyperEdge*> edges_;
     Sentence words_;
     EdgeType edge_type_;
+    // Pools that nodes and edges of this graph can be allocated from. These
+    // are allocated in large contiguous blocks and released all at once when
+    // the graph is destroyed, instead of one at a time
+    boost::object_pool<HyperNode> node_pool_;
+    boost::object_pool<HyperEdge> edge_pool_;
 public:
 
     HyperGraph() : edge_type_(HYPER_EDGE) { };
@@ -377,6 +347,7 @@ public:
 
     // Score each edge in the graph
     void ScoreEdges(const Weights & weights);
+    void ScoreEdges(const DenseWeights & weights);
 
     // Get the n-best paths through the graph
     NbestList GetNbest(int n, bool uniq = false);
@@ -406,6 +377,22 @@ public:
     void AddEdge(HyperEdge * edge);
     void AddWord(WordId id);
 
+    // Allocate a node or edge from the graph's pools. The graph owns the
+    // returned value and frees it on destruction, whether or not it is added
+    // with AddNode/AddEdge, so it must never be deleted or added to another graph
+    HyperNode * NewNode(WordId sym = -1, WordId trg_sym = -1, SpanId span = SpanId(-1,-1));
+    HyperNode * NewNode(const HyperNode & node);
+    HyperEdge * NewEdge(HyperNode * head = NULL);
+    HyperEdge * NewEdge(const HyperEdge & edge);
+    // Free a node or edge of this graph that is not in its node or edge list,
+    // whether it was allocated from the pools or on the heap
+    void FreeNode(HyperNode * node);
+    void FreeEdge(HyperEdge * edge);
+    // Free several nodes or edges at once, which is much faster than freeing
+    // many pooled values one at a time
+    void FreeNodes(std::vector<HyperNode*> nodes);
+    void FreeEdges(std::vector<HyperEdge*> edges);
+
     void ResetViterbiScores();
 
     // Perform the inside-outside algorithm
@@ -438,11 +425,79 @@ private:
     // // Calculate viterbi scores of edges, for use in n-best generation
     // std::pair<Real, int> CalcEdge(int node, int rank, std::vector<std::vector<std::pair<Real, int> > > & all_edges);
     // std::vector<int> GetUpdatedNodes(const boost::shared_ptr<HyperPathBackPtr> & ptr, const HyperEdge* edge) const;
-    
-    boost::shared_ptr<NbestState> NbestCalcState(int node, std::vector<boost::shared_ptr<NbestState> > & states);
-    boost::shared_ptr<HyperPath> NbestGetNthPath(int node, int rank, bool uniq, std::vector<boost::shared_ptr<NbestState> > & states);
-    boost::shared_ptr<HyperPath> NbestCreatePath(int node, NbestStackItem & item, bool uniq, std::vector<boost::shared_ptr<NbestState> > & states);
-    boost::shared_ptr<NbestStackItem> NbestStackIncrementChild(int node, NbestStackItem & item, int child_num, bool uniq, std::vector<boost::shared_ptr<NbestState> > & states);
+
+};
+
+// Enumerates the paths through a hypergraph in order of score, one at a time,
+// using the lazy k-best algorithm (Algorithm 3) of
+//  Liang Huang; David Chiang
+//  Better k-best Parsing
+//  IWPT 2005
+// The derivations at each node are only found when they are needed, and are
+// stored as an edge and the ranks of the derivations of its tails, so full
+// paths are only built for the derivations that are returned. If "uniq" is
+// set, derivations are skipped if they have the same target words as a
+// better derivation of the same node, which is checked using hashes
+class NbestIterator {
+public:
+    NbestIterator(HyperGraph & graph, bool uniq = false);
+
+    // Get the next best path, with its translation, or an empty pointer if
+    // there are no more
+    boost::shared_ptr<HyperPath> Next();
+
+protected:
+    // A derivation of a node, which might not have been found yet
+    struct Candidate {
+        Candidate(Real s, int er, HyperEdge * e, int r) : score(s), edge_rank(er), edge(e), ranks(r) { }
+        Real score;
+        // The rank of the edge in the node, and the edge itself
+        int edge_rank;
+        HyperEdge * edge;
+        // The position of the ranks of the tails' derivations in ranks_
+        int ranks;
+    };
+    // Orders candidates so the best is on top of the heap
+    class CandidateLess {
+    public:
+        CandidateLess(const NbestIterator & iter) : iter_(iter) { }
+        bool operator()(int x, int y) const;
+    private:
+        const NbestIterator & iter_;
+    };
+    struct NodeState {
+        NodeState() : initialized(false) { }
+        bool initialized;
+        // A heap of the candidates that have not been found yet
+        std::vector<int> heap;
+        // The candidates of the derivations found so far, best first
+        std::vector<int> derivs;
+        // The hashes of the target words of each factor of each derivation,
+        // and the matching powers of the hash base, if checking uniqueness
+        std::vector<std::pair<size_t,size_t> > yields;
+        boost::unordered_set<size_t> yield_hashes;
+    };
+
+    // Get the candidate of the "rank"th best derivation of a node, or -1 if
+    // there are not that many
+    int GetDerivation(int node, int rank);
+    // Add the best candidate for each of a node's edges
+    void InitializeNode(int node);
+    // Add a candidate with tail derivations "ranks" to the heap of "node",
+    // if all of the derivations exist
+    void PushCandidate(int node, int edge_rank, HyperEdge * edge, const int * ranks);
+    // Calculate the hashes of the target words of a candidate, and return
+    // false if a better derivation of the node had the same words
+    bool CheckUnique(int node, int cand);
+    void AddEdges(int cand, HyperPath & path) const;
+
+    HyperGraph & graph_;
+    bool uniq_;
+    int next_;
+    std::vector<NodeState> states_;
+    // The pools of all candidates, and of the ranks of their tails
+    std::vector<Candidate> candidates_;
+    std::vector<int> ranks_;
 
 };
 
@@ -32,18 +32,26 @@ namespace travatar
 {
 
 /** Used in place of std::istream, can read zipped files if it ends in .gz
+ *  Zipped files are decompressed on a background thread ahead of the reader,
+ *  and block gzip (BGZF) files, as written by bgzip, are decompressed on
+ *  several threads.
 */
 class InputFileStream : public std::istream
 {
 protected:
   std::streambuf *m_streambuf;
-  std::ifstream *ifs_;
+  static int inflate_threads_;
 public:
 
   InputFileStream(std::string filePath);
   ~InputFileStream();
 
   void Close();
+
+  // The number of threads used to decompress BGZF files (default: the
+  // number of cores, up to 4)
+  static int GetInflateThreads() { return inflate_threads_; }
+  static void SetInflateThreads(int threads) { inflate_threads_ = threads; }
 };
 
 }
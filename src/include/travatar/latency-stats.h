@@ -0,0 +1,38 @@
+#ifndef LATENCY_STATS_H__
+#define LATENCY_STATS_H__
+
+// Keeps track of the latency of recent requests, and summarizes them as
+// percentiles. Safe to use from several threads at once
+
+#include <boost/thread/mutex.hpp>
+#include <string>
+#include <vector>
+
+namespace travatar {
+
+class LatencyStats {
+public:
+    // Keep at most "window" of the most recent samples
+    LatencyStats(int window = 10000) : window_(window), count_(0), total_(0) { }
+
+    // Add the latency of one request in seconds
+    void Add(double seconds);
+
+    // Get the value at percentile "p" (0-100) of the recent samples
+    double GetPercentile(double p) const;
+
+    // Summarize the stats in a single line of "name=value" pairs, with
+    // latencies in milliseconds
+    std::string GetSummary() const;
+
+protected:
+    std::vector<double> samples_;
+    int window_;
+    long count_;
+    double total_;
+    mutable boost::mutex mutex_;
+};
+
+}
+
+#endif
@@ -12,12 +12,25 @@ namespace travatar {
 
 class HyperNode;
 class HyperGraph;
+class ThreadPool;
+class CubePruningTask;
 
 typedef std::vector<HyperNode*> ChartEntry;
+struct CubeGrowingEntry;
 
 // A bottom up language model composer that uses cube pruning to keep the
-// search space small
+// search space small. It can also use cube growing, which only builds the
+// hypotheses of each node when they are needed by its parents:
+//  Liang Huang; David Chiang
+//  Forest Rescoring: Faster Decoding with Integrated Language Models
+//  ACL 2007
+//
+// With cube pruning, the cells of a single sentence can also be built on
+// several threads. Cells whose tails are all finished are built at the same
+// time, and the nodes are added to the graph in the same order as they would
+// be by a single thread, so the result is the same.
 class LMComposerBU : public LMComposer {
+    friend class CubePruningTask;
 
 protected:
 
@@ -27,20 +40,27 @@ protected:
     int chart_limit_;
     // The functions used to calculate LM scores for each model
     std::vector<LMFunc*> funcs_;
+    // Whether to use cube growing instead of cube pruning
+    bool cube_growing_;
+    // Whether to order the cube pruning queue using an estimate of the LM
+    // score of the terminals in each rule
+    bool rest_cost_;
+    // The threads used to build the cells of a sentence, if more than one
+    boost::shared_ptr<ThreadPool> chart_pool_;
 
 public:
     LMComposerBU(const std::vector<std::string> & str) :
-            LMComposer(str), stack_pop_limit_(0), chart_limit_(0) {
+            LMComposer(str), stack_pop_limit_(0), chart_limit_(0), cube_growing_(false), rest_cost_(false) {
         for(int i = 0; i < (int)lm_data_.size(); i++)
             funcs_.push_back(LMFunc::CreateFromType(lm_data_[i]->GetType()));
             
     }
     LMComposerBU(void * lm, lm::ngram::ModelType type, VocabMap * vocab_map) :
-            LMComposer(lm, type, vocab_map), stack_pop_limit_(0), chart_limit_(0) { 
+            LMComposer(lm, type, vocab_map), stack_pop_limit_(0), chart_limit_(0), cube_growing_(false), rest_cost_(false) { 
         for(int i = 0; i < (int)lm_data_.size(); i++)
             funcs_.push_back(LMFunc::CreateFromType(lm_data_[i]->GetType()));
     }
-    virtual ~LMComposerBU() { }
+    virtual ~LMComposerBU();
 
     // Intersect this graph with a language model, using cube pruning to control
     // the overall state space.
@@ -50,6 +70,12 @@ public:
     void SetStackPopLimit(int stack_pop_limit) { stack_pop_limit_ = stack_pop_limit; }
     int GetChartLimit() const { return chart_limit_; }
     void SetChartLimit(Real chart_limit) { chart_limit_ = chart_limit; }
+    bool GetCubeGrowing() const { return cube_growing_; }
+    void SetCubeGrowing(bool cube_growing) { cube_growing_ = cube_growing; }
+    bool GetRestCost() const { return rest_cost_; }
+    void SetRestCost(bool rest_cost) { rest_cost_ = rest_cost; }
+    // Build the cells of each sentence on this many threads (cube pruning only)
+    void SetChartThreads(int threads);
 
 protected:
 
@@ -61,6 +87,62 @@ protected:
                         int id,
                         HyperGraph & graph) const;
 
+    // Build the nodes of one cell, whose tails must already be finished.
+    // The nodes and edges are allocated from "graph" or, if it is NULL, with
+    // new, but they are not added to the graph
+    void CubePruneCell(const HyperNode & parse_node,
+                       const std::vector<boost::shared_ptr<ChartEntry> > & chart,
+                       const std::vector<std::vector<lm::ngram::ChartState> > & states,
+                       HyperGraph * graph,
+                       ChartEntry & my_chart,
+                       std::vector<std::vector<lm::ngram::ChartState> > & my_states) const;
+
+    // Build the chart for the whole parse on the chart threads
+    const ChartEntry & BuildChartParallel(
+                        const HyperGraph & parse,
+                        std::vector<boost::shared_ptr<ChartEntry> > & chart,
+                        std::vector<std::vector<lm::ngram::ChartState> > & states,
+                        HyperGraph & graph) const;
+
+    // Add the nodes of a finished cell and their edges to the graph
+    static void AddChartEntry(const ChartEntry & entry,
+                              std::vector<std::vector<lm::ngram::ChartState> > & entry_states,
+                              std::vector<std::vector<lm::ngram::ChartState> > & states,
+                              HyperGraph & graph);
+    // Add the cells built by BuildChartParallel() to the graph
+    static void AddChartParallel(const HyperGraph & parse,
+                                 const std::vector<boost::shared_ptr<ChartEntry> > & chart,
+                                 std::vector<std::vector<lm::ngram::ChartState> > & cell_states,
+                                 int id, std::vector<bool> & added,
+                                 std::vector<std::vector<lm::ngram::ChartState> > & states,
+                                 HyperGraph & graph);
+    // The height of each node above the leaves of the parse
+    static int CalcHeights(const HyperGraph & parse, int id, std::vector<int> & heights);
+    // Delete a node that was allocated with new, along with its edges
+    static void DeleteNode(HyperNode * node);
+
+    // Get the "k"th best node built from node "id" of the input parse using
+    // cube growing, or NULL if there are not that many. The chart of the
+    // node is only expanded as far as is necessary to find it
+    HyperNode * GetCubeGrowingNode(
+                        const HyperGraph & parse,
+                        std::vector<boost::shared_ptr<CubeGrowingEntry> > & chart,
+                        std::vector<std::vector<lm::ngram::ChartState> > & states,
+                        int id, int k,
+                        HyperGraph & graph) const;
+
+    // Estimate the weighted LM score of an edge from the terminals in its
+    // rule, which are scored with lower-order (or, for rest-cost models,
+    // rest) probabilities where their context is not known
+    Real EstimateEdge(const HyperEdge & edge, LMRuleData & buffer) const;
+
+    // Score a copy of an edge whose tails have been set with the LMs, and
+    // add the LM features. Returns the weighted LM score
+    Real ScoreEdge(const HyperEdge & id_edge,
+                   HyperEdge & next_edge,
+                   const std::vector<std::vector<lm::ngram::ChartState> > & states,
+                   std::vector<lm::ngram::ChartState> & my_state) const;
+
 };
 
 }
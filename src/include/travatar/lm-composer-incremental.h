@@ -62,6 +62,19 @@ public:
         lm_unks_[id] = unk;
     }
 
+    // Set the LMs other than the one used for search. These are scored
+    // exactly when each node is completed, using the states of the best
+    // hypotheses of its children
+    void SetOtherLMs(const std::vector<travatar::LMData*> & other_lms) { other_lms_ = other_lms; }
+
+    // Set the weighted score of the other LMs for an edge that was used
+    // as an estimate during search
+    void SetOtherEstimate(int id, Real est) {
+        if((int)other_ests_.size() <= id)
+            other_ests_.resize(id+1, 0);
+        other_ests_[id] = est;
+    }
+
     // Convert all of the edges together into a node
     NBestComplete Complete(std::vector<PartialEdge> &partial);
 
@@ -72,6 +85,10 @@ public:
     travatar::WordId lm_unk_id_;
     Real lm_unk_weight_;
     std::vector<int> lm_unks_;
+    std::vector<travatar::LMData*> other_lms_;
+    std::vector<Real> other_ests_;
+    // The states of the other LMs for each node
+    std::vector<std::vector<lm::ngram::ChartState> > other_states_;
     travatar::WordId root_sym_;
     int factor_;
     util::Pool pool_;
@@ -89,6 +106,13 @@ class HyperGraph;
 //  Kenneth Heafield; Philipp Koehn; Alon Lavie
 //  Grouping Language Model Boundary Words to Speed K–Best Extraction from Hypergraphs
 //  NAACL 2013
+//
+// When there are several LMs, the search groups states using the first, and
+// the others are used in the same pass. During search, their scores for the
+// inside of each rule are used as an estimate, and the exact scores are
+// calculated when each node is completed. Hypotheses are recombined by the
+// state of the first LM, and the nodes keep the states of the other LMs from
+// their best hypothesis
 class LMComposerIncremental : public LMComposer {
 
 protected:
@@ -1,18 +1,40 @@
 #ifndef LM_FUNC_H__
 #define LM_FUNC_H__
 
-#include <boost/unordered_map.hpp>
 #include <lm/left.hh>
 #include <lm/model.hh>
+#include <util/mmap.hh>
 #include <travatar/sentence.h>
 #include <travatar/real.h>
+#include <atomic>
+#include <vector>
 
 namespace travatar {
 
 class HyperNode;
-
-// A map from Travatar vocab to KenLM vocab
-typedef boost::unordered_map<WordId, lm::WordIndex> VocabMap;
+class HyperEdge;
+class TranslationRule;
+class LMFunc;
+
+// A map from Travatar vocab to KenLM vocab, stored as an array indexed by
+// WordId so that a lookup is a single load. Every word in the LM is added to
+// the Dict when the LM is loaded, so IDs that are added later are never in
+// the LM, and IDs past the end of the array map to 0 (the unknown word)
+// without the array needing to grow
+class VocabMap {
+public:
+    void Set(WordId wid, lm::WordIndex index) {
+        if(wid >= (int)map_.size())
+            map_.resize(wid+1, 0);
+        map_[wid] = index;
+    }
+    lm::WordIndex Get(WordId wid) const {
+        return (wid >= 0 && wid < (int)map_.size()) ? map_[wid] : 0;
+    }
+    int Size() const { return map_.size(); }
+protected:
+    std::vector<lm::WordIndex> map_;
+};
 
 class MapEnumerateVocab : public lm::EnumerateVocab {
 public:
@@ -24,7 +46,7 @@ public:
 
     virtual void Add(lm::WordIndex index, const StringPiece &str);
 
-    boost::unordered_map<WordId, lm::WordIndex> * GetAndFreeVocabMap() {
+    VocabMap * GetAndFreeVocabMap() {
         VocabMap * ret = vocab_map_;
         vocab_map_ = NULL;
         return ret;
@@ -34,13 +56,35 @@ protected:
     VocabMap * vocab_map_;
 };
 
+// The target side of a rule prepared for scoring with one LM. Each run of
+// terminals between non-terminals is scored on its own once, and is then
+// treated like a non-terminal, so at search time only the n-grams that cross
+// the boundaries of the runs need to be scored
+struct LMRuleData {
+    LMRuleData() : lm_id(-1), unk(0), next(NULL) { }
+    // The LMData::GetId() of the LM
+    int lm_id;
+    // The target words mapped to the LM vocabulary
+    Sentence words;
+    // The non-terminals (negative) and runs of terminals (the index of the run)
+    Sentence pieces;
+    // The boundary words and internal score of each run of terminals
+    std::vector<lm::ngram::ChartState> run_states;
+    std::vector<Real> run_scores;
+    // The number of unknown words
+    int unk;
+    // The data for the next LM
+    LMRuleData * next;
+};
+
 // The data for each LM
 // This is read from a specification string of the following format
-//   /path/to/file.blm|factor=0,lm_feat=lm,lm_unk_feat=lmunk
+//   /path/to/file.blm|factor=0,lm_feat=lm,lm_unk_feat=lmunk,load=mmap
 // where the first string is the file and the following parameters are optional
 //   factor: which factor to use
 //   lm_feat: the name of the feature for the lm probability
 //   lm_unk: the name of the feature for LM unknown words
+//   load: how to load a binary LM (mmap/populate/read, see load-method.h)
 class LMData {
 public:
     LMData(const std::string & str);
@@ -48,7 +92,30 @@ public:
 
     virtual ~LMData();
 
-    lm::WordIndex GetMapping(WordId wid) const;
+    lm::WordIndex GetMapping(WordId wid) const { return vocab_map_->Get(wid); }
+
+    // Map target words to the vocabulary of this LM, leaving non-terminals
+    // as negative numbers
+    void MapWords(const Sentence & words, Sentence & lm_words) const;
+    // Map the target words of a rule, caching the result on the rule
+    const Sentence & MapWords(const TranslationRule & rule) const { return GetRuleData(rule).words; }
+    // Map the target words of an edge. If the edge came from a rule, the
+    // cached words for the rule are returned, otherwise they are put in "buffer"
+    const Sentence & MapWords(const HyperEdge & edge, Sentence & buffer) const;
+
+    // Get the target side of a rule prepared for scoring with this LM. This
+    // is computed the first time, and then cached on the rule
+    const LMRuleData & GetRuleData(const TranslationRule & rule) const;
+    // Get the target side of an edge prepared for scoring. If the edge came
+    // from a rule, the cached data for the rule is returned, otherwise it
+    // is put in "buffer"
+    const LMRuleData & GetRuleData(const HyperEdge & edge, LMRuleData & buffer) const;
+
+    // Get the functions for the type of this LM
+    LMFunc & GetFunc() const { return *func_; }
+
+    // A unique identifier for this LM, used for caching
+    int GetId() const { return id_; }
 
     void * GetLM() { return lm_; }
     const void * GetLM() const { return lm_; }
@@ -64,6 +131,10 @@ public:
     lm::ngram::ModelType GetType() const { return type_; }
     void SetFactor(int factor) { factor_ = factor; }
 
+    // The load method used for LMs that do not specify one
+    static util::LoadMethod GetDefaultLoadMethod() { return default_load_; }
+    static void SetDefaultLoadMethod(util::LoadMethod load) { default_load_ = load; }
+
 protected:
     // The name of the feature expressed by this model
     WordId lm_feat_, lm_unk_feat_;
@@ -77,17 +148,29 @@ protected:
     Real lm_weight_, lm_unk_weight_;
     // The factor to use
     int factor_; 
+    // The unique identifier
+    int id_;
+    // The functions for the type of this LM
+    LMFunc * func_;
+    static std::atomic<int> next_id_;
+    static util::LoadMethod default_load_;
 };
 
 // A virtual class to represent templated functions needed for handling
-// various types of KenLM LMs
+// various types of KenLM LMs. The words passed in "syms" must already be
+// mapped to the LM vocabulary with LMData::MapWords()
 class LMFunc {
 public:
     static LMFunc * CreateFromType(lm::ngram::ModelType type);
     virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<HyperNode*> & tails, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, lm::ngram::ChartState & out_state) = 0;
     virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, lm::ngram::ChartState & out_state) = 0;
     virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<lm::ngram::ChartState> & states, lm::ngram::ChartState & out_state) = 0;
+    // Score a rule prepared with PrepareRule(), for bottom-up search and CFG+LM search respectively
+    virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const LMRuleData & rule, const std::vector<HyperNode*> & tails, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, lm::ngram::ChartState & out_state) = 0;
+    virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const LMRuleData & rule, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, lm::ngram::ChartState & out_state) = 0;
     virtual Real CalcFinalScore(const void * lm, const lm::ngram::ChartState & prev_state) = 0;
+    // Split the mapped words of a rule into runs of terminals and score them
+    virtual void PrepareRule(const LMData* data, LMRuleData & rule) = 0;
     virtual ~LMFunc() { }
 };
 
@@ -96,7 +179,10 @@ class LMFuncTemplate : public LMFunc {
     virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<HyperNode*> & tails, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, lm::ngram::ChartState & out_state);
     virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, lm::ngram::ChartState & out_state);
     virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<lm::ngram::ChartState> & states, lm::ngram::ChartState & out_state);
+    virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const LMRuleData & rule, const std::vector<HyperNode*> & tails, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, lm::ngram::ChartState & out_state);
+    virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const LMRuleData & rule, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, lm::ngram::ChartState & out_state);
     virtual Real CalcFinalScore(const void * lm, const lm::ngram::ChartState & prev_state);
+    virtual void PrepareRule(const LMData* data, LMRuleData & rule);
     virtual ~LMFuncTemplate() { }
 };
 
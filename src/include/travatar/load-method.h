@@ -0,0 +1,29 @@
+#ifndef TRAVATAR_LOAD_METHOD_H__
+#define TRAVATAR_LOAD_METHOD_H__
+
+// The ways of loading binary models (KenLM binaries and compiled rule tables)
+//  mmap:     map the file and let pages be read in on demand
+//  populate: map the file and read all of it in when it is loaded
+//  read:     read the file into memory that is private to the process
+// With mmap and populate, processes that load the same file share one copy
+// of it in the page cache.
+
+#include <travatar/global-debug.h>
+#include <util/mmap.hh>
+#include <string>
+
+namespace travatar {
+
+inline util::LoadMethod ParseLoadMethod(const std::string & name) {
+    if(name == "mmap")
+        return util::LAZY;
+    else if(name == "populate")
+        return util::POPULATE_OR_READ;
+    else if(name == "read")
+        return util::READ;
+    THROW_ERROR("Bad load method \"" << name << "\", must be mmap, populate, or read");
+}
+
+}
+
+#endif
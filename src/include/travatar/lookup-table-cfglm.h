@@ -101,17 +101,24 @@ public:
     CFGCollection() { }
     ~CFGCollection() { }
 
-    void AddRules(const CFGPath & path, const RuleVec & rules);
+    // Add a group of rules that share the same path, sorted by their
+    // scores under "weights"
+    void AddRules(const CFGPath & path, const RuleVec & rules, const Weights & weights);
 
     const RuleVec & GetRules() const { return rules_; }
     const SpanVec & GetSpans() const { return spans_; }
     const LabelVec & GetLabels() const { return labels_; }
+    const std::vector<Real> & GetScores() const { return scores_; }
+    // Get the index one past the last rule in the same group as "rid"
+    int GetGroupEnd(int rid) const { return group_ends_[rid]; }
 
 protected:
 
     RuleVec rules_;
     SpanVec spans_;
     LabelVec labels_;
+    std::vector<Real> scores_;
+    std::vector<int> group_ends_;
 
 };
 
@@ -134,12 +141,15 @@ public:
     virtual HyperGraph * TransformGraph(const HyperGraph & graph) const;
     bool PredictiveSearch(marisa::Agent & agent) const;
 
-    static LookupTableCFGLM * ReadFromFiles(const std::vector<std::string> & filename);
+    static LookupTableCFGLM * ReadFromFiles(const std::vector<std::string> & filename, const std::set<WordId> * vocab = NULL);
 
     // Accessors
     void LoadLM(const std::string & filename);
     void SetPopLimit(int pop_limit) { pop_limit_ = pop_limit; }
     void SetChartLimit(int chart_limit) { chart_limit_ = chart_limit; }
+    // Order the cube pruning queue using an estimate of the LM score of the
+    // terminals in each rule
+    void SetRestCost(bool rest_cost) { rest_cost_ = rest_cost; }
     void SetTrgFactors(int trg_factors) { trg_factors_ = trg_factors; }
     void SetWeights(const Weights & weights) { weights_ = &weights; }
     void SetRootSymbol(WordId symbol) { root_symbol_ = HieroHeadLabels(std::vector<WordId>(trg_factors_+1,symbol)); }
@@ -156,6 +166,7 @@ private:
     UnaryIds unary_ids_;
     int pop_limit_;
     int chart_limit_;
+    bool rest_cost_;
     
     int trg_factors_;
     HieroHeadLabels root_symbol_;
@@ -165,6 +176,9 @@ private:
 
     void Consume(CFGPath & a, const Sentence & sent, int N, int i, int j, int k, std::vector<CFGChartItem> & chart, std::vector<CFGCollection> & collections) const;
     void AddToChart(CFGPath & a, const Sentence & sent, int N, int i, int j, bool u, std::vector<CFGChartItem> & chart, std::vector<CFGCollection> & collections) const;
+    // The weighted LM score of the terminals in a rule if using rest costs,
+    // or zero otherwise
+    Real EstimateRule(const TranslationRuleHiero & rule) const;
     void CubePrune(int N, int i, int j, std::vector<CFGCollection> & collection, std::vector<CFGChartItem> & chart, HyperGraph & ret) const;
 
 };
@@ -58,6 +58,7 @@ protected:
     HieroHeadLabels unk_symbol_;
     HieroHeadLabels empty_symbol_;
     bool save_src_str_;
+    bool chart_match_;
 public:
     LookupTableFSM();
     ~LookupTableFSM();
@@ -68,6 +69,9 @@ public:
 
     // Transform a graph of words into a hiero graph
     virtual HyperGraph * TransformGraph(const HyperGraph & graph) const;
+    // Transform a graph, saving the source strings of the rules only if
+    // "save_src_str" is true, whatever SetSaveSrcStr() was set to
+    HyperGraph * TransformGraph(const HyperGraph & graph, bool save_src_str) const;
 
     const HieroHeadLabels & GetRootSymbol() const { return root_symbol_; } 
     const HieroHeadLabels & GetUnkSymbol() const { return unk_symbol_; } 
@@ -78,14 +82,18 @@ public:
     void SetUnkSymbol(WordId symbol) { unk_symbol_ = HieroHeadLabels(std::vector<WordId>(trg_factors_+1,symbol)); }
     void SetSpanLimits(const std::vector<int>& limits);
     void SetTrgFactors(const int trg_factors) { trg_factors_ = trg_factors; } 
-    void SetSaveSrcStr(const bool save_src_str);
+    void SetSaveSrcStr(const bool save_src_str) { save_src_str_ = save_src_str; }
+    // Match rules with a chart of partial matches (the default), or with the
+    // older recursive search of the trie, which is kept for comparison
+    bool GetChartMatch() const { return chart_match_; }
+    void SetChartMatch(bool chart_match) { chart_match_ = chart_match; }
     static TranslationRuleHiero* GetUnknownRule(const WordId unknown_word, const HieroHeadLabels& head_labels);
     static TranslationRuleHiero* GetUnknownRule(const WordId src, WordId unknown_word, const HieroHeadLabels& head_labels);
 
-    static LookupTableFSM * ReadFromFiles(const std::vector<std::string> & filenames);
+    static LookupTableFSM * ReadFromFiles(const std::vector<std::string> & filenames, const std::set<WordId> * vocab = NULL);
 
 private:
-    HyperEdge * LookupUnknownRule(int index, const Sentence & sent, const HieroHeadLabels & syms, HieroNodeMap & node_map) const;
+    HyperEdge * LookupUnknownRule(int index, const Sentence & sent, const HieroHeadLabels & syms, HieroNodeMap & node_map, bool save_src_str) const;
 };
 }
 
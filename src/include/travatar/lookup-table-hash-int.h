@@ -0,0 +1,95 @@
+#ifndef LOOKUP_TABLE_HASH_INT_H__
+#define LOOKUP_TABLE_HASH_INT_H__
+
+#include <travatar/lookup-table.h>
+#include <boost/unordered_map.hpp>
+#include <vector>
+#include <stdint.h>
+
+namespace travatar {
+
+class HyperNode;
+
+// A state holding the node in the trie that has been reached so far
+class LookupStateHashInt : public LookupState {
+public:
+    LookupStateHashInt(int trie_node = 0) : trie_node_(trie_node) { }
+    virtual ~LookupStateHashInt() { }
+
+    int GetTrieNode() const { return trie_node_; }
+    void SetTrieNode(int trie_node) { trie_node_ = trie_node; }
+
+protected:
+    int trie_node_;
+};
+
+// A table that stores source patterns in a trie over integer tokens.
+// Each match advances from the parent state's trie node with a single hash
+// lookup, without building the source string.
+class LookupTableHashInt : public LookupTable {
+public:
+    // The types of tokens that can appear in a source pattern
+    typedef enum {
+        TOKEN_TERM = 0,    // "word"
+        TOKEN_NONTERM = 1, // x0:NP
+        TOKEN_START = 2,   // NP (
+        TOKEN_END = 3      // )
+    } TokenType;
+
+    LookupTableHashInt() : next_(), rules_(1), src_strs_(1) { }
+    virtual ~LookupTableHashInt();
+
+    virtual LookupState * GetInitialState() const {
+        return new LookupStateHashInt(0);
+    }
+
+    static LookupTableHashInt * ReadFromFile(std::string & filename);
+    static LookupTableHashInt * ReadFromRuleTable(std::istream & in);
+
+    // Find rules associated with a particular source pattern
+    virtual const std::vector<TranslationRule*> * FindRules(const LookupState & state) const {
+        const std::vector<TranslationRule*> & ret =
+            rules_[static_cast<const LookupStateHashInt &>(state).GetTrieNode()];
+        return ret.size() ? &ret : NULL;
+    }
+
+    // Convert a source pattern into its tokens
+    static std::vector<uint64_t> TokenizeSrc(const std::string & src);
+
+    static uint64_t MakeToken(TokenType type, WordId sym, int nt_id = 0) {
+        return ((uint64_t)type << 56) | ((uint64_t)nt_id << 32) | (uint32_t)sym;
+    }
+
+protected:
+
+    // Match a single node
+    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const;
+
+    // Match the start of an edge
+    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const;
+    
+    // Match the end of an edge
+    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const;
+
+    LookupState * MatchState(uint64_t token, const LookupState & state, LookupStatePool & pool) const;
+
+    // The states do not hold a string, so get it from the trie node
+    virtual const std::string & GetSrcString(const LookupState & state) const {
+        return src_strs_[static_cast<const LookupStateHashInt &>(state).GetTrieNode()];
+    }
+
+    void AddRule(const std::string & str, TranslationRule * rule);
+
+protected:
+    // Transitions from (node, token) to the next node
+    typedef boost::unordered_map<std::pair<int, uint64_t>, int> TrieMap;
+    TrieMap next_;
+    // The rules and the source string for each node of the trie
+    std::vector<std::vector<TranslationRule*> > rules_;
+    std::vector<std::string> src_strs_;
+
+};
+
+}
+
+#endif
@@ -39,15 +39,15 @@ public:
 protected:
 
     // Match a single node
-    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const;
 
     // Match the start of an edge
-    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const;
     
     // Match the end of an edge
-    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const;
 
-    LookupState * MatchState(const std::string & next, const LookupState & state) const;
+    LookupState * MatchState(const std::string & next, const LookupState & state, LookupStatePool & pool) const;
 
     void AddRule(const std::string & str, TranslationRule * rule);
 
@@ -3,7 +3,11 @@
 
 #include <travatar/lookup-table.h>
 #include <marisa/marisa.h>
+#include <util/mmap.hh>
+#include <boost/thread/shared_mutex.hpp>
 #include <vector>
+#include <set>
+#include <stdint.h>
 
 namespace travatar {
 
@@ -12,7 +16,8 @@ class HyperNode;
 // A table that allows rules to be looked up in a hash table
 class LookupTableMarisa : public LookupTable {
 public:
-    LookupTableMarisa() { }
+    LookupTableMarisa() : rule_index_(NULL), rule_blob_(NULL),
+        term_index_(NULL), term_keys_(NULL), key_terms_(NULL) { }
     virtual ~LookupTableMarisa();
 
     virtual LookupState * GetInitialState() const {
@@ -22,21 +27,37 @@ public:
     static LookupTableMarisa * ReadFromFile(std::string & filename);
     static LookupTableMarisa * ReadFromRuleTable(std::istream & in);
 
+    // Read a table compiled with WriteBinary. The file is loaded with "load"
+    // (memory mapped by default), and rules are only decoded when they are
+    // first looked up
+    static LookupTableMarisa * ReadFromBinaryFile(const std::string & filename, util::LoadMethod load = util::LAZY);
+
+    // Write the trie, rules, and the symbols they use into a single binary file
+    void WriteBinary(std::ostream & out) const;
+
+    // Create a new table holding only the rules whose source terminals are
+    // all in "vocab", such as the words of the sentences to be translated
+    LookupTableMarisa * Filter(const std::set<WordId> & vocab);
+
     // Find rules associated with a particular source pattern
     virtual const std::vector<TranslationRule*> * FindRules(const LookupState & state) const;
 
 protected:
 
     // Match a single node
-    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const;
 
     // Match the start of an edge
-    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const;
     
     // Match the end of an edge
-    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const;
+
+    LookupState * MatchState(const std::string & next, const LookupState & state, LookupStatePool & pool) const;
 
-    LookupState * MatchState(const std::string & next, const LookupState & state) const;
+    // Get the rules for a particular key in the trie, decoding them from the
+    // binary file if necessary
+    const std::vector<TranslationRule*> & GetRulesForKey(size_t id) const;
 
     // void AddRule(TranslationRule * rule) {
     //     rules_[rule->GetSrcStr()].push_back(rule);
@@ -50,7 +71,25 @@ protected:
 
 protected:
     marisa::Trie trie_;
-    RuleSet rules_;
+    mutable RuleSet rules_;
+
+    // Information for tables read from a binary file
+    util::scoped_memory memory_;
+    const uint64_t * rule_index_;
+    const char * rule_blob_;
+    std::vector<WordId> sym_ids_;
+    mutable std::vector<char> decoded_;
+    mutable boost::shared_mutex mutex_;
+
+    // An inverted index from each source terminal in term_syms_ to the keys
+    // that contain it, and the number of distinct terminals in each key. It is
+    // read from the binary file, or built by the first call to Filter
+    std::vector<WordId> term_syms_;
+    const uint64_t * term_index_;
+    const uint32_t * term_keys_;
+    const uint32_t * key_terms_;
+    std::vector<uint64_t> term_index_buf_;
+    std::vector<uint32_t> term_keys_buf_, key_terms_buf_;
 
 };
 
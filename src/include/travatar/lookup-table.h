@@ -12,17 +12,31 @@
 namespace travatar {
 
 class HyperNode;
+class LookupStatePool;
+
+// An immutable list of the non-terminals matched so far, stored from the
+// last one back to the first. States that extend the same partial match
+// share the list instead of each holding a copy
+struct NontermList {
+    const HyperNode * node;
+    const NontermList * prev;
+    int size;
+};
 
 // A single state for a partial rule match
 // This must be overloaded with a state that is used in a specific implementation
 class LookupState {
 public:
-    LookupState() { }
+    LookupState() : nonterms_(NULL) { }
     virtual ~LookupState() { }
 
-    const std::vector<const HyperNode*> & GetNonterms() const { return nonterm_nodes_; }
-    std::vector<const HyperNode*> & GetNonterms() { return nonterm_nodes_; }
-    void SetNonterms(const std::vector<const HyperNode*> & nonterm_nodes) { nonterm_nodes_ = nonterm_nodes; }
+    // Get the non-terminals in the order they were matched
+    std::vector<const HyperNode*> GetNonterms() const;
+    int GetNumNonterms() const { return nonterms_ ? nonterms_->size : 0; }
+    const NontermList * GetNontermList() const { return nonterms_; }
+    void SetNonterms(const NontermList * nonterms) { nonterms_ = nonterms; }
+    // Add a non-terminal, allocating the new list link from the pool
+    void AddNonterm(const HyperNode * node, LookupStatePool & pool);
     const SparseVector & GetFeatures() const { return features_; }
     void SetFeatures(const SparseVector & feat) { features_ = feat; }
     void AddFeatures(const SparseVector & feat) { features_ += feat; }
@@ -31,13 +45,47 @@ public:
 
 protected:
     // Links to the nodes of non-terminals that are abstracted
-    std::vector<const HyperNode*> nonterm_nodes_;
+    const NontermList * nonterms_;
     SparseVector features_;
     // A string representing the current progress
     std::string curr_string_;
 };
 
-typedef std::pair<std::vector<boost::shared_ptr<LookupState> >, const HyperNode*> SpannedState;
+// An arena that holds the lookup states and non-terminal lists created while
+// matching the rules for one sentence. Nothing is reference counted or freed
+// individually; everything is destroyed together with the pool
+class LookupStatePool {
+public:
+    LookupStatePool() : pos_(BLOCK_SIZE) { }
+    ~LookupStatePool();
+
+    // Create a new state of type T
+    template <class T>
+    T * NewState() {
+        T * ret = new(Allocate(sizeof(T))) T;
+        states_.push_back(ret);
+        return ret;
+    }
+    template <class T, class A>
+    T * NewState(const A & arg) {
+        T * ret = new(Allocate(sizeof(T))) T(arg);
+        states_.push_back(ret);
+        return ret;
+    }
+
+    // Create a new link in a non-terminal list
+    const NontermList * NewNonterm(const HyperNode * node, const NontermList * prev);
+
+protected:
+    static const size_t BLOCK_SIZE = 64*1024;
+    void * Allocate(size_t size);
+
+    std::vector<char*> blocks_;
+    size_t pos_;
+    std::vector<LookupState*> states_;
+};
+
+typedef std::pair<std::vector<LookupState*>, const HyperNode*> SpannedState;
 
 // Class to compare State, basically comparison is based on the span length.
 // The shorter comes first.
@@ -55,11 +103,16 @@ public:
     virtual ~LookupTable();
 
     virtual HyperGraph * TransformGraph(const HyperGraph & parse) const;
+    // Transform the graph, saving the source strings of the rules only if
+    // "save_src_str" is true, whatever SetSaveSrcStr() was set to
+    HyperGraph * TransformGraph(const HyperGraph & parse, bool save_src_str) const;
 
     // Find all the translation rules rooted at a particular node in a parse graph
-    std::vector<boost::shared_ptr<LookupState> > LookupSrc(
+    // The returned states are owned by the pool
+    std::vector<LookupState*> LookupSrc(
             const HyperNode & node, 
-            const std::vector<boost::shared_ptr<LookupState> > & old_states) const;
+            const std::vector<LookupState*> & old_states,
+            LookupStatePool & pool) const;
 
     // Find rules associated with a particular source pattern
     virtual const std::vector<TranslationRule*> * FindRules(const LookupState & state) const = 0;
@@ -82,18 +135,21 @@ protected:
     // For example S(NP(PRN("he")) x0:VP) will match for "he" and VP
     // If matching a non-terminal (e.g. VP), advance the state and push "node"
     // on to the list of non-terminals. Otherwise, just advance the state
-    // Returns NULL if no rules were matched
-    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state) const = 0;
+    // Returns NULL if no rules were matched. New states are allocated from the pool
+    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const = 0;
 
     // Match the start of an edge
     // For example S(NP(PRN("he")) x0:VP) will match the opening bracket 
     // of S( or NP( or PRN(
-    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state) const = 0;
+    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const = 0;
     
     // Match the end of an edge
     // For example S(NP(PRN("he")) x0:VP) will match the closing brackets for
     // of (S...) or (NP...) or (PRN...)
-    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state) const = 0;
+    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const = 0;
+
+    // Get the source string of the rules matched by a state
+    virtual const std::string & GetSrcString(const LookupState & state) const { return state.GetString(); }
 
     TranslationRule unk_rule_;
     // Match all nodes with the unknown rule, not just when no other rule is matched (default false)
@@ -104,8 +160,8 @@ protected:
     bool consider_trg_;
 
     // Basic Transform Graph
-    virtual HyperGraph * TransformGraphSrc(const HyperGraph & parse) const;
-    virtual HyperGraph * TransformGraphSrcTrg(const HyperGraph & parse) const;
+    virtual HyperGraph * TransformGraphSrc(const HyperGraph & parse, bool save_src_str) const;
+    virtual HyperGraph * TransformGraphSrcTrg(const HyperGraph & parse, bool save_src_str) const;
 };
 
 }
@@ -3,27 +3,62 @@
 
 // A class to ensure that outputs are written in the proper order in multi-thread
 // environments. Modeled after the Moses implementation
+//
+// Results are moved into a ring of per-sentence slots without taking a lock,
+// and a single writer thread writes out runs of consecutive finished slots.
+// If a sentence gets more than "capacity" ahead of the oldest unwritten one,
+// Write() blocks until there is space, which keeps memory bounded when one
+// slow sentence holds back the rest. The capacity should be comfortably
+// larger than the number of sentences that can be in flight at once, or
+// threads may block waiting on a sentence that has not been started.
 
-#include <boost/thread/mutex.hpp>
+#include <boost/thread.hpp>
 #include <pthread.h>
+#include <atomic>
 #include <iostream>
+#include <string>
+#include <vector>
 
 namespace travatar {
 
 class OutputCollector {
 public:
-    OutputCollector(std::ostream* out_stream=&std::cout, std::ostream* err_stream=&std::cerr, bool buffer=true) :
-            next_(0), out_stream_(out_stream), err_stream_(err_stream), buffer_(buffer) { }
+    OutputCollector(std::ostream* out_stream=&std::cout, std::ostream* err_stream=&std::cerr, bool buffer=true, int capacity=1024);
+    ~OutputCollector();
 
-    void Write(int id, const std::string & out, const std::string & err);
+    // Output the strings for sentence "id". Each id must be written exactly once
+    void Write(int id, std::string out, std::string err);
     void Skip(int id);
+    // Wait until everything that can be written has been, and flush the streams
     void Flush();
+    // Wait until the sentences with ids below "num" have all been written
+    void WaitUntilWritten(int num);
 private:
-    std::map<int,std::pair<std::string,std::string> > saved_;
-    int next_;
+    struct Slot {
+        // The id of the sentence held in this slot, or -1 if empty
+        std::atomic<int> id;
+        std::string out, err;
+    };
+
+    // The function run by the writer thread
+    void Run();
+
+    bool IsReady(int id) const { return slots_[id % slots_.size()].id == id; }
+
+    std::vector<Slot> slots_;
+    // The id of the next sentence to be written
+    std::atomic<int> next_;
     std::ostream *out_stream_, *err_stream_;
-    boost::mutex mutex_;
     bool buffer_;
+    // The lock and condition variables are only used for sleeping
+    boost::mutex mutex_;
+    boost::condition_variable writer_needed_;
+    boost::condition_variable space_available_;
+    std::atomic<bool> writer_waiting_;
+    std::atomic<int> writes_waiting_;
+    bool flush_requested_;
+    bool stopped_;
+    boost::thread writer_;
 
 };
 
@@ -4,9 +4,11 @@
 #include <travatar/sentence.h>
 #include <travatar/sparse-map.h>
 #include <marisa/marisa.h>
+#include <boost/unordered_map.hpp>
 #include <vector>
 #include <map>
 #include <set>
+#include <string>
 
 namespace travatar {
 
@@ -18,13 +20,74 @@ class CfgData;
 typedef std::vector<WordId> HieroHeadLabels;
 typedef std::vector<std::pair<int,int> > HieroRuleSpans;
 typedef std::map<HieroHeadLabels,std::set<HieroHeadLabels> > UnaryMap;
-typedef std::map<HieroHeadLabels, HyperNode*> HeadNodePairs;
-typedef std::map<std::pair<int,int>, HeadNodePairs> HieroNodeMap;
 typedef std::vector<HyperEdge* > EdgeList;
 typedef std::pair<int, std::pair<int,int> > TailSpanKey;
 typedef std::vector<TranslationRuleHiero*> RuleVec;
 typedef std::vector<RuleVec> RuleSet; 
 
+// The nodes built over a sentence, indexed by their span and head labels.
+// Each span of a sentence of length N has a slot in a flat array of size
+// N*(N+1)/2, ordered by the start and then the end of the span, and each
+// set of head labels is given an integer ID, so finding a node is an array
+// lookup and a scan over the few labels built over the span
+class HieroNodeMap {
+public:
+    // The label IDs and nodes over one span, in the order they were added
+    typedef std::vector<std::pair<int,HyperNode*> > SpanNodes;
+
+    HieroNodeMap(int length = 0) : length_(length), spans_(length*(length+1)/2) { }
+
+    int GetLength() const { return length_; }
+
+    // Get the ID of a set of labels, adding it if it has not been seen
+    int GetLabelId(const HieroHeadLabels & labels);
+    const HieroHeadLabels & GetLabels(int id) const { return labels_[id]; }
+
+    // Get the nodes over [begin,end)
+    const SpanNodes & GetNodes(int begin, int end) const { return spans_[GetSpanId(begin, end)]; }
+    // Get the node over [begin,end) with labels "label_id", or NULL
+    HyperNode * GetNode(int begin, int end, int label_id) const;
+    // Get the node over [begin,end) with labels "labels", adding it if it
+    // does not exist. The ID of a new node is its index in GetAllNodes()
+    HyperNode * FindNode(int begin, int end, const HieroHeadLabels & labels);
+
+    // All of the nodes, in the order they were added
+    const std::vector<HyperNode*> & GetAllNodes() const { return nodes_; }
+
+protected:
+    int GetSpanId(int begin, int end) const { return begin*length_ - begin*(begin-1)/2 + end-begin-1; }
+
+    int length_;
+    std::vector<SpanNodes> spans_;
+    std::vector<HyperNode*> nodes_;
+    boost::unordered_map<HieroHeadLabels, int> label_ids_;
+    std::vector<HieroHeadLabels> labels_;
+};
+
+// The positions in the trie of a RuleFSM that are reached while matching the
+// rules to one sentence. Each cursor stands for a prefix of the keys in the
+// trie, and the cursor reached by adding a symbol is only searched for in the
+// trie the first time that it is needed, so prefixes that are matched from
+// several start positions are only searched for once
+class RuleFSMCursors {
+public:
+    RuleFSMCursors(const marisa::Trie & trie) : trie_(&trie), keys_(1), key_ids_(1, -1) { }
+
+    // The cursor of the empty prefix
+    static int GetRoot() { return 0; }
+    // Get the cursor for the prefix of "cursor" followed by "sym", or -1 if
+    // no key in the trie starts with it
+    int Next(int cursor, WordId sym);
+    // Get the ID of the key that exactly matches the prefix of "cursor", or -1
+    int GetKeyId(int cursor) const { return key_ids_[cursor]; }
+
+protected:
+    const marisa::Trie * trie_;
+    std::vector<std::string> keys_;
+    std::vector<int> key_ids_;
+    boost::unordered_map<std::pair<int,WordId>, int> next_;
+};
+
 class RuleFSM {
 protected:
 
@@ -35,16 +98,17 @@ protected:
     // Other statistics
     UnaryMap unaries_;
     int span_length_;
-    bool save_src_str_;
 public:
 
     friend class LookupTableFSM;
 
-    RuleFSM() : span_length_(20), save_src_str_(false) { }
+    RuleFSM() : span_length_(20) { }
 
     virtual ~RuleFSM();
     
-    static RuleFSM * ReadFromRuleTable(std::istream & in);
+    // Read a rule table. If "vocab" is given, rules with source words that
+    // are not in it are skipped
+    static RuleFSM * ReadFromRuleTable(std::istream & in, const std::set<WordId> * vocab = NULL);
 
     static TranslationRuleHiero * BuildRule(travatar::TranslationRuleHiero * rule, std::vector<std::string> & source, 
             std::vector<std::string> & target, SparseMap& features);
@@ -66,11 +130,19 @@ public:
  
     // MUTATOR
     void SetSpanLimit(const int length) { span_length_ = length; }
-    void SetSaveSrcStr(const bool save_src_str) { save_src_str_ = save_src_str; }
 
 protected:
+    // Match the rules starting at "position" by recursively searching the trie
     void BuildHyperGraphComponent(HieroNodeMap & node_map, EdgeList & edge_set,
-        const Sentence & input, const std::string & state, int position, HieroRuleSpans & spans) const;
+        const Sentence & input, const std::string & state, int position, HieroRuleSpans & spans,
+        bool save_src_str) const;
+
+    // Match the rules starting at "start" with a chart of partially matched
+    // rules indexed by their end position. This finds the same edges as
+    // BuildHyperGraphComponent, and must also be called for each start
+    // position from the last to the first
+    void BuildChartComponent(HieroNodeMap & node_map, EdgeList & edge_list,
+        const Sentence & input, int start, RuleFSMCursors & cursors, bool save_src_str) const;
 
     static std::string CreateKey(const CfgData & src_data,
                                  const std::vector<CfgData> & trg_data);
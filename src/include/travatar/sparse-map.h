@@ -24,7 +24,8 @@ Real operator*(const SparseMap & lhs, const SparseMap & rhs);
 SparseMap operator*(const SparseMap & lhs, Real rhs);
 void NormalizeL1(SparseMap & map, Real val = 1.0);
 
-// Vector-based sparse map
+// Vector-based sparse map. The pairs are kept sorted by key, and each key
+// appears at most once
 class SparseVector {
 public:
     typedef std::vector<SparsePair> SparseVectorImpl;
@@ -71,6 +72,31 @@ SparseMap & operator-=(SparseMap & lhs,    const SparseVector & rhs);
 SparseMap operator+(const SparseMap & lhs, const SparseVector & rhs);
 SparseMap operator-(const SparseMap & lhs, const SparseVector & rhs);
 
+// A dense array of weights indexed by feature ID. When the weights are fixed
+// (e.g. during decoding) this replaces a hash lookup per feature with an
+// array access
+class DenseWeights {
+public:
+    DenseWeights() { }
+    DenseWeights(const SparseMap & weights);
+
+    // Get a single weight, which is zero for any unknown ID
+    inline Real Get(int id) const {
+        return ((size_t)id < weights_.size() ? weights_[id] : 0.0);
+    }
+    // Calculate the dot product with a feature vector
+    Real Dot(const SparseVector & feats) const;
+    // Calculate the dot products of a batch of feature vectors
+    void Dot(const std::vector<const SparseVector*> & feats, std::vector<Real> & scores) const;
+
+    size_t size() const { return weights_.size(); }
+
+protected:
+    std::vector<Real> weights_;
+};
+
+inline Real operator*(const DenseWeights & lhs, const SparseVector & rhs) { return lhs.Dot(rhs); }
+
 }
 
 #endif
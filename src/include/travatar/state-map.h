@@ -0,0 +1,79 @@
+#ifndef TRAVATAR_STATE_MAP_H__
+#define TRAVATAR_STATE_MAP_H__
+
+// An open-addressing hash table used to recombine hypotheses that have the
+// same LM state. The entries are kept in a flat array in insertion order,
+// together with the hash of their key, so lookups only compare whole keys
+// when the hashes match, and nothing is allocated per entry.
+
+#include <lm/left.hh>
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+#include <vector>
+#include <utility>
+
+namespace travatar {
+
+// Hash the LM states of a hypothesis, one for each LM
+inline size_t HashStates(const std::vector<lm::ngram::ChartState> & states, size_t seed = 0) {
+    BOOST_FOREACH(const lm::ngram::ChartState & state, states)
+        boost::hash_combine(seed, lm::ngram::hash_value(state));
+    return seed;
+}
+
+template <class Key, class Value>
+class StateMap {
+
+public:
+    struct Entry {
+        Entry(const Key & k, size_t h, const Value & v) : key(k), hash(h), value(v) { }
+        Key key;
+        size_t hash;
+        Value value;
+    };
+
+    StateMap() : table_(16, -1) { }
+
+    // Find the entry for "key" with hash "hash", or insert it with "value"
+    // if it does not exist. Returns the ID of the entry, which is its
+    // position in insertion order, and whether it was inserted
+    std::pair<int, bool> Insert(const Key & key, size_t hash, const Value & value) {
+        size_t mask = table_.size() - 1;
+        size_t pos = hash & mask;
+        for(int id = table_[pos]; id != -1; pos = (pos + 1) & mask, id = table_[pos])
+            if(entries_[id].hash == hash && entries_[id].key == key)
+                return std::make_pair(id, false);
+        table_[pos] = entries_.size();
+        entries_.push_back(Entry(key, hash, value));
+        // Keep the table at most half full
+        if(entries_.size() * 2 > table_.size())
+            Grow();
+        return std::make_pair((int)entries_.size() - 1, true);
+    }
+
+    int Size() const { return entries_.size(); }
+    const Entry & GetEntry(int id) const { return entries_[id]; }
+    Entry & GetEntry(int id) { return entries_[id]; }
+
+protected:
+
+    void Grow() {
+        std::vector<int>(table_.size() * 2, -1).swap(table_);
+        size_t mask = table_.size() - 1;
+        for(int id = 0; id < (int)entries_.size(); id++) {
+            size_t pos = entries_[id].hash & mask;
+            while(table_[pos] != -1)
+                pos = (pos + 1) & mask;
+            table_[pos] = id;
+        }
+    }
+
+    std::vector<Entry> entries_;
+    // Indexes into entries_, or -1 for empty slots. The size is a power of 2
+    std::vector<int> table_;
+
+};
+
+}
+
+#endif
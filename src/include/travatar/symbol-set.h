@@ -4,13 +4,23 @@
 #include <boost/thread.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/cstdint.hpp>
 #include <vector>
+#include <cstring>
 #include <stdexcept>
 #include <iostream>
 #include <sstream>
 
 namespace travatar {
 
+// A two-way map between strings and integer IDs.
+//
+// Once all of the known symbols have been added (e.g. after the models are
+// loaded), Freeze() moves them into an immutable open-addressing hash table
+// over a contiguous string pool, which is read without taking any locks.
+// Symbols added after freezing go into an overflow table that is still
+// protected by the lock, so only lookups of previously unseen words contend.
 template < class T >
 class SymbolSet {
 
@@ -22,74 +32,188 @@ public:
 
 protected:
     
+    // An entry in the frozen hash table, with id -1 marking empty buckets
+    struct FrozenEntry {
+        boost::uint64_t hash;
+        T id;
+    };
+
     Map map_;
     Vocab vocab_;
     mutable boost::shared_mutex mutex_;
     bool safe_;
+    // The frozen table. When frozen_ is true, vocab_ holds exactly the frozen
+    // symbols and is never modified, and map_ and overflow_ hold the rest
+    bool frozen_;
+    std::vector<FrozenEntry> frozen_table_;
+    std::vector<char> frozen_pool_;
+    std::vector<size_t> frozen_offsets_;
+    Vocab overflow_;
+
+    static boost::uint64_t Hash(const char * str, size_t len) {
+        // 64-bit FNV-1a
+        boost::uint64_t hash = 14695981039346656037ULL;
+        for(size_t i = 0; i < len; i++)
+            hash = (hash ^ (unsigned char)str[i]) * 1099511628211ULL;
+        return hash;
+    }
+
+    // Find a symbol in the frozen table, or return -1
+    T FindFrozen(const char * str, size_t len) const {
+        boost::uint64_t hash = Hash(str, len);
+        size_t mask = frozen_table_.size() - 1;
+        for(size_t i = hash & mask; ; i = (i+1) & mask) {
+            const FrozenEntry & entry = frozen_table_[i];
+            if(entry.id < 0)
+                return -1;
+            if(entry.hash == hash) {
+                size_t start = frozen_offsets_[entry.id];
+                if(frozen_offsets_[entry.id+1] - start == len && memcmp(&frozen_pool_[0]+start, str, len) == 0)
+                    return entry.id;
+            }
+        }
+    }
+
+    // Add a new symbol. The caller must hold a unique lock when needed
+    T AddSymbol(const char * str, size_t len) {
+        T id = vocab_.size() + overflow_.size();
+        std::string * sym = new std::string(str, len);
+        (frozen_ ? overflow_ : vocab_).push_back(sym);
+        map_.insert(std::make_pair(*sym,id));
+        return id;
+    }
+
+    // A symbol that is looked up in map_ without being copied into a string.
+    // It hashes the same as the equal std::string
+    struct SymbolRef { const char * str; size_t len; };
+    struct SymbolRefHash {
+        size_t operator()(const SymbolRef & ref) const { return boost::hash_range(ref.str, ref.str+ref.len); }
+    };
+    struct SymbolRefEqual {
+        bool operator()(const SymbolRef & ref, const std::string & sym) const {
+            return ref.len == sym.size() && memcmp(ref.str, sym.data(), ref.len) == 0;
+        }
+        bool operator()(const std::string & sym, const SymbolRef & ref) const { return (*this)(ref, sym); }
+    };
+
+    // Look up a symbol in the non-frozen part of the set
+    T FindMap(const char * str, size_t len) const {
+        SymbolRef ref = { str, len };
+        typename Map::const_iterator it = map_.find(ref, SymbolRefHash(), SymbolRefEqual());
+        return (it != map_.end() ? it->second : -1);
+    }
 
 public:
-    SymbolSet(bool safe = false) : map_(), vocab_(), mutex_(), safe_(safe) { }
+    SymbolSet(bool safe = false) : map_(), vocab_(), mutex_(), safe_(safe), frozen_(false) { }
     SymbolSet(const SymbolSet & ss) : 
-                map_(ss.map_), vocab_(ss.vocab_), mutex_(), safe_(ss.safe_) {
+                map_(ss.map_), vocab_(ss.vocab_), mutex_(), safe_(ss.safe_),
+                frozen_(ss.frozen_), frozen_table_(ss.frozen_table_),
+                frozen_pool_(ss.frozen_pool_), frozen_offsets_(ss.frozen_offsets_),
+                overflow_(ss.overflow_) {
         for(typename Vocab::iterator it = vocab_.begin(); 
                                                 it != vocab_.end(); it++) 
             if(*it)
                 *it = new std::string(**it);
+        for(typename Vocab::iterator it = overflow_.begin(); 
+                                                it != overflow_.end(); it++) 
+            *it = new std::string(**it);
     }
     ~SymbolSet() {
         for(typename Vocab::iterator it = vocab_.begin(); 
                                             it != vocab_.end(); it++)
             if(*it)
                 delete *it;
+        for(typename Vocab::iterator it = overflow_.begin(); 
+                                            it != overflow_.end(); it++)
+            delete *it;
+    }
+
+    // Move all current symbols into the lock-free frozen table. This must not
+    // be called while other threads are using the set
+    void Freeze() {
+        boost::unique_lock< boost::shared_mutex > lock(mutex_);
+        // Symbols added since an earlier freeze become part of the table
+        vocab_.insert(vocab_.end(), overflow_.begin(), overflow_.end());
+        overflow_.clear();
+        size_t buckets = 16;
+        while(buckets < vocab_.size()*2) buckets *= 2;
+        FrozenEntry empty = { 0, -1 };
+        std::vector<FrozenEntry>(buckets, empty).swap(frozen_table_);
+        frozen_pool_.clear();
+        frozen_offsets_.resize(1, 0);
+        for(size_t id = 0; id < vocab_.size(); id++) {
+            const std::string & sym = *vocab_[id];
+            frozen_pool_.insert(frozen_pool_.end(), sym.begin(), sym.end());
+            frozen_offsets_.push_back(frozen_pool_.size());
+            boost::uint64_t hash = Hash(sym.data(), sym.size());
+            size_t i = hash & (buckets-1);
+            while(frozen_table_[i].id >= 0) i = (i+1) & (buckets-1);
+            frozen_table_[i].hash = hash;
+            frozen_table_[i].id = id;
+        }
+        // Avoid an empty pool so &frozen_pool_[0] is always valid
+        frozen_pool_.push_back(0);
+        Map().swap(map_);
+        frozen_ = true;
     }
+    bool IsFrozen() const { return frozen_; }
 
+    // The symbols in the frozen part of the set (or all symbols if not frozen)
     const std::vector<std::string*> & GetSymbols() const { return vocab_; }
     const std::string & GetSymbol(T id) const {
+        if(frozen_ && id < (T)vocab_.size())
+            return *vocab_[id];
         boost::shared_lock< boost::shared_mutex > lock(mutex_);
-        return *vocab_[id];
+        return (id < (T)vocab_.size() ? *vocab_[id] : *overflow_[id-vocab_.size()]);
         // return *SafeAccess(vocab_, id);
     }
+    T GetIdSafe(const char * str, size_t len, bool add) {
+        if(frozen_) {
+            T id = FindFrozen(str, len);
+            if(id >= 0) return id;
+        }
+        {
+            boost::shared_lock< boost::shared_mutex > lock(mutex_);
+            T id = FindMap(str, len);
+            if(id >= 0 || !add) return id;
+        }
+        // Check again, as another thread may have added it in the meantime
+        boost::unique_lock< boost::shared_mutex > lock(mutex_);
+        T id = FindMap(str, len);
+        return (id >= 0 ? id : AddSymbol(str, len));
+    }
     T GetIdSafe(const std::string & sym, bool add = false) {
-        boost::upgrade_lock< boost::shared_mutex > lock(mutex_);
-        typename Map::const_iterator it = map_.find(sym);
-        if(it != map_.end())
-            return it->second;
-        else if(add) {
-            boost::upgrade_to_unique_lock<boost::shared_mutex> uniqueLock(lock);
-            T id;
-            id = vocab_.size();
-            vocab_.push_back(new std::string(sym));
-            map_.insert(std::make_pair(sym,id));
-            return id;
+        return GetIdSafe(sym.data(), sym.size(), add);
+    }
+    // Get the ID of the symbol in [str, str+len), which does not need to be
+    // in a string, so symbols can be looked up directly in an input buffer
+    T GetId(const char * str, size_t len, bool add) {
+        if(safe_) return GetIdSafe(str, len, add);
+        if(frozen_) {
+            T id = FindFrozen(str, len);
+            if(id >= 0) return id;
         }
-        return -1;
+        T id = FindMap(str, len);
+        if(id >= 0 || !add) return id;
+        return AddSymbol(str, len);
     }
     T GetId(const std::string & sym, bool add = false) {
-        if(safe_) return GetIdSafe(sym, add);
-        typename Map::const_iterator it = map_.find(sym);
-        if(it != map_.end())
-            return it->second;
-        else if(add) {
-            T id;
-            id = vocab_.size();
-            vocab_.push_back(new std::string(sym));
-            map_.insert(std::make_pair(sym,id));
-            return id;
-        }
-        return -1;
+        return GetId(sym.data(), sym.size(), add);
     }
     T GetId(const std::string & sym) const {
         return const_cast< SymbolSet<T>* >(this)->GetId(sym,false);
     }
-    size_t size() const { return vocab_.size(); }
-    size_t capacity() const { return vocab_.size(); }
-    size_t hashCapacity() const { return map_.size(); }
+    size_t size() const { return vocab_.size() + overflow_.size(); }
+    size_t capacity() const { return size(); }
+    size_t hashCapacity() const { return map_.size() + (frozen_ ? vocab_.size() : 0); }
     
     void ToStream(std::ostream & out) {
         boost::unique_lock< boost::shared_mutex >  lock(mutex_);
-        out << vocab_.size() << std::endl;
+        out << size() << std::endl;
         for(int i = 0; i < (int)vocab_.size(); i++)
             out << *vocab_[i] << std::endl;
+        for(int i = 0; i < (int)overflow_.size(); i++)
+            out << *overflow_[i] << std::endl;
         out << std::endl;
     }
     static SymbolSet<T>* FromStream(std::istream & in) {
@@ -106,6 +230,7 @@ public:
         return ret;
     }
 
+    // The map of symbols that are not in the frozen table
     Map & GetMap() { return map_; }
 
 };
@@ -6,6 +6,9 @@ namespace travatar {
 class Task {
 public:
     virtual void Run() = 0;
+    // An estimate of the amount of work the task will take. The ThreadPool
+    // starts tasks with higher costs first
+    virtual int GetCost() const { return 0; }
     virtual ~Task() { }
 };
 
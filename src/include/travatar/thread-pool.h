@@ -4,11 +4,20 @@
 // A thread manager that allows submission of tasks to be run in different
 // threads. (This was highly influenced by Moses's ThreadPool, but
 // re-implemented and tweaked a bit.
+//
+// Each worker has its own deque of tasks, and workers that run out of work
+// steal from the deques of the others, so there is no single lock that all
+// threads contend on. Submitted tasks are held in a look-ahead window and
+// sorted by Task::GetCost() before being handed out, so expensive tasks are
+// started first and do not end up running alone at the end.
 
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
 #include <pthread.h>
-#include <queue>
+#include <atomic>
+#include <deque>
+#include <vector>
 
 namespace travatar {
 
@@ -17,35 +26,72 @@ class Task;
 class ThreadPool {
 
 public:
-    // Create a thread pool with a certain number of threads
+    // Create a thread pool with a certain number of threads. queue_limit is
+    // the maximum number of tasks that may be waiting in the workers' queues
+    // before Submit() blocks, and also the default size of the window of
+    // tasks that are ordered by cost
     ThreadPool(int size, int queue_limit = 0);
+    ~ThreadPool();
 
     // Submit a task for execution
     void Submit(Task * task);
 
     // Stop the remaining values
     void Stop(bool process_remaining);
-    
-    // Wait until all of the running threads have stopped
+
+    // Wait until all of the submitted tasks have finished
     void Wait();
 
     // Set whether to delete tasks after they finish executing
     void SetDeleteTasks(bool delete_tasks) { delete_tasks_ = delete_tasks; }
 
+    // Set the number of tasks that are collected and sorted by cost before
+    // they are dispatched (1 means dispatch in submission order)
+    void SetWindow(int window) { window_ = std::max(window, 1); }
+
 protected:
+    // The per-worker queue of tasks
+    struct WorkerQueue {
+        boost::mutex mutex;
+        std::deque<Task*> tasks;
+    };
+
     // The function executed by each thread, which will wait for a task, then
     // execute it when it is ready
-    void Run();
+    void Run(int id);
+
+    // Get a task from the worker's own queue, or steal one from another
+    Task* NextTask(int id);
+
+    // Sort the tasks in the window and hand them out to the workers. Must be
+    // called while holding window_mutex_
+    void Dispatch();
+
+    // Wake up the submitter if it is waiting on the workers
+    void NotifySubmitter();
 
-    std::queue<Task*> tasks_;
+    std::vector<boost::shared_ptr<WorkerQueue> > queues_;
+    std::vector<Task*> window_tasks_;
+    boost::mutex window_mutex_;
     boost::thread_group threads_;
-    boost::mutex mutex_;
+    // Used only for sleeping when there is no work
+    boost::mutex idle_mutex_;
     boost::condition_variable thread_needed_;
+    // Used only for sleeping while the queues are full
+    boost::mutex submit_mutex_;
     boost::condition_variable thread_available_;
-    bool stopped_;
+    // The number of tasks in the queues, running, and idle threads
+    std::atomic<int> pending_;
+    std::atomic<int> running_;
+    std::atomic<int> idle_;
+    std::atomic<int> submitters_waiting_;
+    std::atomic<bool> stopped_;
     bool stopping_;
+    bool process_remaining_;
     bool delete_tasks_;
     int queue_limit_;
+    int window_;
+    int next_queue_;
 
 };
 
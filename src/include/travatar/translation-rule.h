@@ -5,11 +5,15 @@
 #include <travatar/sentence.h>
 #include <travatar/cfg-data.h>
 #include <travatar/sparse-map.h>
+#include <atomic>
 #include <string>
 #include <vector>
 
 namespace travatar {
 
+struct LMRuleData;
+class Weights;
+
 class TranslationRule {
 
 public:
@@ -17,9 +21,14 @@ public:
                     const CfgDataVector & trg_data = CfgDataVector(),
                     const SparseVector & features = SparseVector()) :
         // src_str_(src_str), 
-        trg_data_(trg_data), features_(features) { }
+        trg_data_(trg_data), features_(features), lm_data_(NULL),
+        score_(0), score_version_(-1) { }
+    TranslationRule(const TranslationRule & rhs) :
+        trg_data_(rhs.trg_data_), features_(rhs.features_), lm_data_(NULL),
+        score_(0), score_version_(-1) { }
+    TranslationRule & operator=(const TranslationRule & rhs);
 
-    virtual ~TranslationRule() {} 
+    virtual ~TranslationRule();
 
     void AddFeature(int id, Real feat);
     void AddFeature(const std::string & str, Real feat);
@@ -59,10 +68,27 @@ public:
         trg_data_[factor].label = lab;
     }
 
+    // Get the target side prepared for scoring with the LM with ID "lm_id",
+    // or NULL if it has not been cached yet
+    const LMRuleData * GetLMRuleData(int lm_id) const;
+    // Cache the target side prepared for an LM, taking ownership of it, and
+    // return the cached copy. Safe to call from several threads at once
+    const LMRuleData * CacheLMRuleData(LMRuleData * lm_data) const;
+
+    // Get the score of the features under "weights". This is cached, and is
+    // only calculated again when the version of the weights changes
+    Real GetScore(const Weights & weights) const;
+
 protected:
     // std::string src_str_;
     CfgDataVector trg_data_;
     SparseVector features_;
+    // A list of the data for each LM. It is only ever added to, so it can
+    // be read without a lock
+    mutable std::atomic<LMRuleData*> lm_data_;
+    // The score under the weights of version "score_version_", or -1 if none
+    mutable std::atomic<Real> score_;
+    mutable std::atomic<int> score_version_;
 
 };
 inline std::ostream &operator<<( std::ostream &out, const TranslationRule &L ) {
@@ -5,6 +5,7 @@
 #include <travatar/nbest-list.h>
 #include <travatar/output-collector.h>
 #include <travatar/sparse-map.h>
+#include <travatar/timer.h>
 #include <boost/shared_ptr.hpp>
 #include <vector>
 
@@ -17,6 +18,11 @@ class LookupTable;
 class Weights;
 class TravatarRunner;
 class EvalMeasure;
+class LatencyStats;
+class DecoderStats;
+class SentenceStats;
+class ThreadPool;
+class TreeIO;
 typedef std::vector<int> Sentence;
 
 class TravatarRunnerTask : public Task {
@@ -32,14 +38,24 @@ public:
                        )
         : sent_(sent), tree_graph_(tree_graph), refs_(refs), runner_(runner),
           collector_(collector), nbest_collector_(nbest_collector), 
-          trace_collector_(trace_collector), forest_collector_(forest_collector) { }
+          trace_collector_(trace_collector), forest_collector_(forest_collector),
+          server_request_(false), request_nbest_(0), request_trace_(false),
+          latency_(NULL) { }
     void Run();
+    // Make this task answer a server request. The translation, followed by
+    // the n-best list and trace if requested, is written to the main
+    // collector, and the time since "received" was started is added to
+    // "latency" when it is written
+    void SetServerRequest(int nbest, bool trace, LatencyStats * latency, const Timer & received);
+    // Longer sentences are more expensive to translate
+    virtual int GetCost() const;
 private:
     // Subtasks
-    void PrintNbestList(const NbestList & nbest_list);
-    void PrintBestTrace(const NbestList & nbest_list, const int best_answer);
-    void PrintNbestTrace(const NbestList & nbest_list);
+    void PrintNbestList(const NbestList & nbest_list, std::ostream & out);
+    void PrintBestTrace(const NbestList & nbest_list, const int best_answer, std::ostream & out);
+    void PrintNbestTrace(const NbestList & nbest_list, std::ostream & out);
     void PrintForest(boost::shared_ptr<HyperGraph> & rule_graph);
+    void FinishStats(SentenceStats & stats);
 
     int sent_; // ID of this sentence
     boost::shared_ptr<HyperGraph> tree_graph_; // The input
@@ -49,6 +65,11 @@ private:
     OutputCollector * nbest_collector_; // The output collector
     OutputCollector * trace_collector_; // The output collector
     OutputCollector * forest_collector_; // The output collector
+    bool server_request_; // Whether this is a request to the server
+    int request_nbest_; // The length of the n-best list to return
+    bool request_trace_; // Whether to return the trace
+    LatencyStats * latency_; // Where to record the latency
+    Timer received_; // The time since the request was received
 };
 
 class TravatarRunner {
@@ -59,6 +80,20 @@ public:
     
     // Run the model
     void Run(const ConfigTravatarRunner & config);
+
+    // Serve requests read line by line from "in", writing the responses to
+    // "out" in the same order. Returns when the input ends or "@quit" or
+    // "@shutdown" is read, and whether the server should shut down
+    bool ServeStream(std::istream & in, std::ostream & out, TreeIO & tree_io, ThreadPool & pool);
+
+    // Accept connections on a Unix domain socket, and serve each of them.
+    // Returns after "@shutdown" is requested or on SIGINT or SIGTERM, once
+    // the requests that were already read have been answered
+    void ServeSocket(const std::string & path, TreeIO & tree_io, ThreadPool & pool);
+
+    // Look up the rules for "graph", saving their source strings for the trace
+    // even if the TM was not set to save them
+    HyperGraph * LookupRulesWithSrc(const HyperGraph & graph) const;
     
     // Getters/setters
     bool HasBinarizer() const { return binarizer_.get() != NULL; }
@@ -72,6 +107,8 @@ public:
     bool HasWeights() const { return weights_.get() != NULL; }
     const Weights & GetWeights() const { return *weights_; }
     Weights & GetWeights() { return *weights_; }
+    bool HasDenseWeights() const { return dense_weights_.get() != NULL; }
+    const DenseWeights & GetDenseWeights() const { return *dense_weights_; }
     bool HasEvalMeasure() const { return tune_eval_measure_.get() != NULL; }
     const EvalMeasure & GetEvalMeasure() const { return *tune_eval_measure_; }
     int GetNbestCount() const { return nbest_count_; }
@@ -79,6 +116,8 @@ public:
     bool GetNbestTree() const { return nbest_tree_; }
     int GetThreads() const { return threads_; }
     bool GetDoTuning() const { return do_tuning_; } 
+    bool HasDecoderStats() const { return decoder_stats_.get() != NULL; }
+    DecoderStats & GetDecoderStats() { return *decoder_stats_; }
 
 private:
 
@@ -88,12 +127,19 @@ private:
         int pop_limit,
         const SparseMap & weights);
 
+    // Write the decoder statistics to the stats_out file if it is open
+    void WriteDecoderStats(std::ostream * stats_out);
+
     boost::shared_ptr<GraphTransformer> binarizer_;
     boost::shared_ptr<GraphTransformer> tm_;
     std::vector<boost::shared_ptr<GraphTransformer> > lms_;
     boost::shared_ptr<GraphTransformer> trimmer_;
     boost::shared_ptr<Weights> weights_;
+    // A dense copy of the weights, used when they do not change during decoding
+    boost::shared_ptr<DenseWeights> dense_weights_;
     boost::shared_ptr<EvalMeasure> tune_eval_measure_;
+    boost::shared_ptr<LatencyStats> latency_;
+    boost::shared_ptr<DecoderStats> decoder_stats_;
     int nbest_count_;
     bool nbest_uniq_;
     bool nbest_tree_;
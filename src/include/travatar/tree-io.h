@@ -3,6 +3,7 @@
 
 #include <travatar/sentence.h>
 #include <vector>
+#include <set>
 #include <iostream>
 
 namespace travatar {
@@ -17,8 +18,10 @@ class TreeIO {
 public:
     virtual ~TreeIO() { };
     virtual HyperGraph * ReadTree(std::istream & in) = 0;
-    HyperGraph * ReadFromString(const std::string & str);
+    virtual HyperGraph * ReadFromString(const std::string & str);
     virtual void WriteTree(const HyperGraph & tree, std::ostream & out) = 0;
+    // Read all the trees in a stream and add their words to a vocabulary
+    void ReadVocabulary(std::istream & in, std::set<WordId> & vocab);
 };
 
 // Read in and write out Penn Treebank format trees
@@ -26,6 +29,10 @@ class PennTreeIO : public TreeIO {
 public:
     virtual ~PennTreeIO() { }
     virtual HyperGraph * ReadTree(std::istream & in);
+    // Read a tree directly from a buffer, such as a line or a memory-mapped
+    // corpus, and move ptr past it. Returns NULL if no tree is left
+    HyperGraph * ReadTree(const char *& ptr, const char * end);
+    virtual HyperGraph * ReadFromString(const std::string & str);
     void WriteNode(const std::vector<WordId> & words,
                    const HyperNode & node, std::ostream & out);
     virtual void WriteTree(const HyperGraph & tree, std::ostream & out);
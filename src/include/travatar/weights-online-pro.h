@@ -27,6 +27,7 @@ public:
     virtual const SparseMap & GetCurrent() const { return weights_->GetCurrent(); }
     virtual const SparseMap & GetFinal() { return weights_->GetFinal(); }
     virtual void SetCurrent(const SparseMap & weights) { weights_->SetCurrent(weights); }
+    virtual int GetVersion() const { return weights_->GetVersion(); }
 
 protected:
     boost::shared_ptr<Weights> weights_;
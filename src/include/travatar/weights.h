@@ -6,6 +6,7 @@
 #include <travatar/nbest-list.h>
 #include <travatar/sentence.h>
 #include <boost/foreach.hpp>
+#include <atomic>
 #include <cfloat>
 
 namespace travatar {
@@ -16,11 +17,11 @@ class Weights {
 
 public:
 
-    Weights(int factor = 0) : factor_(factor) {
+    Weights(int factor = 0) : factor_(factor), version_(next_version_++) {
         ranges_[-1] = std::pair<Real,Real>(-REAL_MAX, REAL_MAX);
     }
     Weights(const SparseMap & current, int factor = 0) :
-        current_(current), factor_(factor) {
+        current_(current), factor_(factor), version_(next_version_++) {
         ranges_[-1] = std::pair<Real,Real>(-REAL_MAX, REAL_MAX);
     }
 
@@ -42,8 +43,13 @@ public:
     }
     virtual void SetCurrent(const SparseMap::key_type & key, Real val) {
         current_[key] = val;
+        Touch();
     }
-    virtual void SetCurrent(const SparseMap & kv) { current_ = kv; }
+    virtual void SetCurrent(const SparseMap & kv) { current_ = kv; Touch(); }
+
+    // A number that is different for every set of values the current
+    // weights take, so scores calculated with them can be cached
+    virtual int GetVersion() const { return version_; }
 
     // Get the final values of the weights
     virtual const SparseMap & GetFinal() {
@@ -84,10 +90,15 @@ public:
     }
 
 protected:
+    // Note that the current weights have changed
+    void Touch() { version_ = next_version_++; }
+
     SparseMap current_;
     typedef boost::unordered_map<WordId, std::pair<Real,Real> > RangeMap;
     RangeMap ranges_;
     int factor_;
+    int version_;
+    static std::atomic<int> next_version_;
 
 };
 
@@ -12,7 +12,7 @@ typedef BinarizerCKY::SNMap SNMap;
 HyperNode * BinarizerCKY::FindIndexedNode(const HyperGraph & hg, HyperGraph & ret, SNMap & snmap, const vector<int> & str, WordId xbar) const {
     SNMap::const_iterator it = snmap.find(str);
     if(it != snmap.end()) return it->second;
-    HyperNode * new_node = new HyperNode;
+    HyperNode * new_node = ret.NewNode();
     for(int i = 0; i < (int)str.size(); i++) {
         const HyperNode* old_node = hg.GetNode(str[i]);
         new_node->AddSpan(old_node->GetSpan());
@@ -45,7 +45,7 @@ HyperGraph * BinarizerCKY::TransformGraph(const HyperGraph & hg) const {
         // We need to deal with two cases: binarization is necessary or not
         // First, we handle the "not" case, as it is simpler
         if(edge->NumTails() <= 2 || edge->NumTails() > max_tails_) {
-            HyperEdge * new_edge = new HyperEdge(*edge);
+            HyperEdge * new_edge = ret->NewEdge(*edge);
             new_edge->SetHead(FindIndexedNode(hg, *ret, built_nodes, head_str, xbar));
             for(int i = 0; i < (int)edge->GetTails().size(); i++) {
                 tail_str[i] = edge->GetTail(i)->GetId();
@@ -76,7 +76,7 @@ HyperGraph * BinarizerCKY::TransformGraph(const HyperGraph & hg) const {
                     HyperNode* left = FindIndexedNode(hg, *ret, built_nodes, VectorSubstr(tail_str, i, k-i), xbar);
                     HyperNode* right = FindIndexedNode(hg, *ret, built_nodes, VectorSubstr(tail_str, k, j-k), xbar);
                     // Create the left and right edges
-                    HyperEdge * next_edge = new HyperEdge(head);
+                    HyperEdge * next_edge = ret->NewEdge(head);
                     next_edge->AddTail(left);
                     next_edge->AddTail(right);
                     // Score only the top edge
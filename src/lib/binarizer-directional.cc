@@ -11,7 +11,7 @@ typedef BinarizerDirectional::SNMap SNMap;
 HyperNode * BinarizerDirectional::FindIndexedNode(const HyperGraph & hg, HyperGraph & ret, SNMap & snmap, const vector<int> & str, WordId xbar) const {
     SNMap::const_iterator it = snmap.find(str);
     if(it != snmap.end()) return it->second;
-    HyperNode * new_node = new HyperNode;
+    HyperNode * new_node = ret.NewNode();
     for(int i = 1; i < (int)str.size(); i++) {
         const HyperNode* old_node = hg.GetNode(str[i]);
         new_node->AddSpan(old_node->GetSpan());
@@ -88,7 +88,7 @@ HyperGraph * BinarizerDirectional::TransformGraph(const HyperGraph & hg) const {
                 // cerr << "big: " << Dict::WSym(xbar) << endl;
             }
             // Create the left and right edges
-            HyperEdge * next_edge = new HyperEdge(head);
+            HyperEdge * next_edge = ret->NewEdge(head);
             if(dir == BINARIZE_RIGHT) {
                 if(small) next_edge->AddTail(small);
                 if(big) next_edge->AddTail(big);
@@ -0,0 +1,133 @@
+#include <travatar/decoder-stats.h>
+#include <travatar/output-collector.h>
+#include <travatar/global-debug.h>
+#include <cmath>
+#include <sstream>
+
+using namespace travatar;
+using namespace std;
+
+thread_local SentenceStats * SentenceStats::current_ = NULL;
+
+namespace {
+const char * kStageNames[NUM_STAGES] = {
+    "binarize", "rule_lookup", "rule_score", "lm", "nbest", "output", "tune"
+};
+const char * kCounterNames[NUM_COUNTERS] = {
+    "words", "rule_nodes", "rule_edges", "lm_nodes", "lm_edges",
+    "cube_pops", "lm_queries", "lookup_hits", "lookup_misses"
+};
+}
+
+SentenceStats::SentenceStats(int sent) : sent_(sent), stage_(-1), stage_start_(0), attached_(false) {
+    for(int i = 0; i < NUM_STAGES; i++) times_[i] = 0;
+    for(int i = 0; i < NUM_COUNTERS; i++) counts_[i] = 0;
+    timer_.start();
+}
+
+void SentenceStats::Attach() {
+    current_ = this;
+    attached_ = true;
+}
+
+void SentenceStats::Detach() {
+    if(attached_ && current_ == this)
+        current_ = NULL;
+    attached_ = false;
+}
+
+void SentenceStats::StartStage(DecoderStage stage) {
+    double now = timer_.get_elapsed_time();
+    if(stage_ >= 0)
+        times_[stage_] += now - stage_start_;
+    stage_ = stage;
+    stage_start_ = now;
+}
+
+void SentenceStats::EndStage() {
+    if(stage_ >= 0)
+        times_[stage_] += timer_.get_elapsed_time() - stage_start_;
+    stage_ = -1;
+}
+
+double SentenceStats::GetTotalTime() const {
+    double ret = 0;
+    for(int i = 0; i < NUM_STAGES; i++) ret += times_[i];
+    return ret;
+}
+
+void SentenceStats::WriteJSON(ostream & out) const {
+    out << "{\"sent\": " << sent_ << ", \"total_ms\": " << GetTotalTime() * 1000 << ", \"stages_ms\": {";
+    for(int i = 0; i < NUM_STAGES; i++)
+        out << (i ? ", " : "") << '"' << kStageNames[i] << "\": " << times_[i] * 1000;
+    out << "}, \"counters\": {";
+    for(int i = 0; i < NUM_COUNTERS; i++)
+        out << (i ? ", " : "") << '"' << kCounterNames[i] << "\": " << counts_[i];
+    out << "}}";
+}
+
+const char * DecoderStats::GetStageName(int stage) {
+    if(stage < 0 || stage >= NUM_STAGES)
+        THROW_ERROR("Bad decoder stage " << stage);
+    return kStageNames[stage];
+}
+
+const char * DecoderStats::GetCounterName(int counter) {
+    if(counter < 0 || counter >= NUM_COUNTERS)
+        THROW_ERROR("Bad decoder counter " << counter);
+    return kCounterNames[counter];
+}
+
+void DecoderStats::Histogram::Add(double val) {
+    int bucket = (val < 1 ? 0 : (int)floor(log2(val)) + 1);
+    if((int)buckets.size() <= bucket)
+        buckets.resize(bucket+1, 0);
+    buckets[bucket]++;
+    sum += val;
+    max = std::max(max, val);
+}
+
+void DecoderStats::Histogram::WriteJSON(ostream & out) const {
+    out << "{\"sum\": " << sum << ", \"max\": " << max << ", \"hist\": [";
+    for(int i = 0; i < (int)buckets.size(); i++)
+        out << (i ? ", " : "") << buckets[i];
+    out << "]}";
+}
+
+void DecoderStats::Add(const SentenceStats & stats) {
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        num_sents_++;
+        total_hist_.Add(stats.GetTotalTime() * 1000);
+        for(int i = 0; i < NUM_STAGES; i++)
+            stage_hists_[i].Add(stats.GetTime(i) * 1000);
+        for(int i = 0; i < NUM_COUNTERS; i++)
+            counter_hists_[i].Add(stats.GetCount(i));
+    }
+    if(sent_collector_ != NULL) {
+        ostringstream oss;
+        stats.WriteJSON(oss);
+        oss << endl;
+        sent_collector_->Write(stats.GetSent(), oss.str(), "");
+    }
+}
+
+void DecoderStats::WriteJSON(ostream & out) const {
+    boost::mutex::scoped_lock lock(mutex_);
+    out << "{" << endl << "  \"sentences\": " << num_sents_ << "," << endl;
+    out << "  \"total_ms\": ";
+    total_hist_.WriteJSON(out);
+    out << "," << endl << "  \"stages_ms\": {" << endl;
+    for(int i = 0; i < NUM_STAGES; i++) {
+        out << "    \"" << kStageNames[i] << "\": ";
+        stage_hists_[i].WriteJSON(out);
+        out << (i+1 < NUM_STAGES ? "," : "") << endl;
+    }
+    out << "  }," << endl << "  \"counters\": {" << endl;
+    for(int i = 0; i < NUM_COUNTERS; i++) {
+        out << "    \"" << kCounterNames[i] << "\": ";
+        counter_hists_[i].WriteJSON(out);
+        out << (i+1 < NUM_COUNTERS ? "," : "") << endl;
+    }
+    out << "  }" << endl << "}" << endl;
+}
@@ -64,6 +64,10 @@ SparseVector Dict::ParseSparseVector(const std::string & str) {
     return ParseSparseVector(iss);
 }
 
+void Dict::FreezeVocab() {
+    wids_.Freeze();
+}
+
 const std::string & Dict::WSym(WordId id) {
     return wids_.GetSymbol(id);
 }
@@ -72,6 +76,10 @@ WordId Dict::WID(const std::string & str) {
     return wids_.GetId(str, add_);
 }
 
+WordId Dict::WID(const char * str, size_t len) {
+    return wids_.GetId(str, len, add_);
+}
+
 std::string Dict::WSymEscaped(WordId id) {
     ostringstream oss;
     if(id < 0) {
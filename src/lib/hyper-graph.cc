@@ -1,5 +1,7 @@
 #include <queue>
 #include <map>
+#include <algorithm>
+#include <functional>
 #include <boost/shared_ptr.hpp>
 #include <boost/regex.hpp>
 #include <lm/left.hh>
@@ -287,90 +289,146 @@ public:
     }
 };
 
-boost::shared_ptr<NbestState> HyperGraph::NbestCalcState(int node, vector<boost::shared_ptr<NbestState> > & states) {
-    if(states[node].get() == NULL) {
-        states[node].reset(new NbestState);
-        // Get the edges and sort in descending order of score
-        BOOST_FOREACH(HyperEdge* edge, nodes_[node]->GetEdges()) {
-            Real score = edge->GetScore();
-            BOOST_FOREACH(HyperNode* node, edge->GetTails())
-                score += node->CalcViterbiScore();
-            states[node]->edges.push_back(make_pair(score, edge->GetId()));
-        }
-        sort(states[node]->edges.begin(), states[node]->edges.end(), RankScoreMore());
-        // Initialize stack with all edges
-        for(int i = 0; i < (int)states[node]->edges.size(); i++) {
-            NbestEdge n_edge = states[node]->edges[i];
-            states[node]->PushStack(boost::shared_ptr<NbestStackItem>(new NbestStackItem(n_edge.first, i, vector<int>(edges_[n_edge.second]->GetTails().size(), 0))));
-        }
-    }
-    return states[node];
-}
-
-boost::shared_ptr<HyperPath> HyperGraph::NbestCreatePath(int node, NbestStackItem & item, bool uniq, vector<boost::shared_ptr<NbestState> > & states) {
-    boost::shared_ptr<HyperPath> ret(new HyperPath);
-    ret->SetScore(item.score);
-    HyperEdge* my_edge = edges_[states[node]->edges[item.edge_rank].second];
-    ret->AddEdge(my_edge);
-    for(int i = 0; i < (int)item.child_ranks.size(); i++) {
-        boost::shared_ptr<HyperPath> child_path = NbestGetNthPath(my_edge->GetTail(i)->GetId(), item.child_ranks[i], uniq, states);
-        if(child_path.get() == NULL) return child_path;
-        ret->AddEdges(child_path->GetEdges());
-    }
-    return ret;
+namespace {
+// The base of the polynomial hashes of target words
+const size_t kYieldBase = 1000003;
 }
 
-boost::shared_ptr<NbestStackItem> HyperGraph::NbestStackIncrementChild(int node, NbestStackItem & item, int child_num, bool uniq, vector<boost::shared_ptr<NbestState> > & states) {
-    HyperEdge* my_edge = edges_[states[node]->edges[item.edge_rank].second];
-    boost::shared_ptr<HyperPath> curr_path = NbestGetNthPath(my_edge->GetTail(child_num)->GetId(), item.child_ranks[child_num], uniq, states);
-    boost::shared_ptr<HyperPath> next_path = NbestGetNthPath(my_edge->GetTail(child_num)->GetId(), item.child_ranks[child_num]+1, uniq, states);
-    if(next_path.get() == NULL)
-        return boost::shared_ptr<NbestStackItem>();
-    Real diff = next_path->GetScore() - curr_path->GetScore();
-    boost::shared_ptr<NbestStackItem> ret(new NbestStackItem(item));
-    ret->score += diff;
-    ret->child_ranks[child_num]++;
-    return ret;
+NbestIterator::NbestIterator(HyperGraph & graph, bool uniq) :
+        graph_(graph), uniq_(uniq), next_(0), states_(graph.NumNodes()) { }
+
+bool NbestIterator::CandidateLess::operator()(int x, int y) const {
+    const Candidate & a = iter_.candidates_[x], & b = iter_.candidates_[y];
+    if(a.score != b.score) return a.score < b.score;
+    if(a.edge_rank != b.edge_rank) return a.edge_rank > b.edge_rank;
+    for(int i = 0; i < (int)a.edge->GetTails().size(); i++)
+        if(iter_.ranks_[a.ranks+i] != iter_.ranks_[b.ranks+i])
+            return iter_.ranks_[a.ranks+i] > iter_.ranks_[b.ranks+i];
+    return false;
+}
+
+void NbestIterator::PushCandidate(int node, int edge_rank, HyperEdge * edge, const int * ranks) {
+    // Find the tails' derivations, which can add candidates to the pools
+    int num_tails = edge->GetTails().size();
+    Real score = edge->GetScore();
+    for(int i = 0; i < num_tails; i++) {
+        int deriv = GetDerivation(edge->GetTail(i)->GetId(), ranks[i]);
+        if(deriv == -1) return;
+        score += candidates_[deriv].score;
+    }
+    candidates_.push_back(Candidate(score, edge_rank, edge, ranks_.size()));
+    ranks_.insert(ranks_.end(), ranks, ranks + num_tails);
+    vector<int> & heap = states_[node].heap;
+    heap.push_back(candidates_.size()-1);
+    push_heap(heap.begin(), heap.end(), CandidateLess(*this));
+}
+
+void NbestIterator::InitializeNode(int node) {
+    states_[node].initialized = true;
+    // Sort the edges in descending order of score
+    vector<pair<Real,int> > edges;
+    BOOST_FOREACH(HyperEdge* edge, graph_.GetNode(node)->GetEdges()) {
+        Real score = edge->GetScore();
+        BOOST_FOREACH(HyperNode* tail, edge->GetTails())
+            score += tail->CalcViterbiScore();
+        edges.push_back(make_pair(score, edge->GetId()));
+    }
+    sort(edges.begin(), edges.end(), RankScoreMore());
+    // Add the best derivation of each edge
+    vector<int> zeros;
+    for(int i = 0; i < (int)edges.size(); i++) {
+        HyperEdge * edge = graph_.GetEdge(edges[i].second);
+        zeros.resize(edge->GetTails().size(), 0);
+        PushCandidate(node, i, edge, zeros.size() ? &zeros[0] : NULL);
+    }
 }
 
-boost::shared_ptr<HyperPath> HyperGraph::NbestGetNthPath(int node, int rank, bool uniq, vector<boost::shared_ptr<NbestState> > & states) {
-    boost::shared_ptr<NbestState> state = NbestCalcState(node, states);
-    // Until we've found a path or the stack is exhausted
-    while(state->paths.size() <= rank && state->stack.size() != 0) {
-        // Get an item from the stack and create the path
-        boost::shared_ptr<NbestStackItem> item = state->PopStack();
-        boost::shared_ptr<HyperPath> act_path = NbestCreatePath(node, *item, uniq, states);
-        // Check whether to add it or not
-        if(uniq) {
-            CfgDataVector trg = act_path->CalcTranslations();
-            if(state->uniq_sents.find(trg) == state->uniq_sents.end()) {
-                state->uniq_sents.insert(trg);
-                state->paths.push_back(act_path);
+bool NbestIterator::CheckUnique(int node, int cand) {
+    // Combine the hashes of the tails' words, using the fact that the hash
+    // of a concatenation is h(a)*base^len(b)+h(b)
+    int factors = GlobalVars::trg_factors;
+    const Candidate & my_cand = candidates_[cand];
+    const CfgDataVector & trg_data = my_cand.edge->GetTrgData();
+    vector<pair<size_t,size_t> > yield(factors, make_pair(0, 1));
+    size_t combined = 0;
+    for(int f = 0; f < factors; f++) {
+        if(f < (int)trg_data.size()) {
+            BOOST_FOREACH(WordId wid, trg_data[f].words) {
+                if(wid >= 0) {
+                    yield[f].first = yield[f].first * kYieldBase + wid + 1;
+                    yield[f].second *= kYieldBase;
+                } else {
+                    int tail = my_cand.edge->GetTail(-1-wid)->GetId();
+                    int rank = ranks_[my_cand.ranks-1-wid];
+                    const pair<size_t,size_t> & child = states_[tail].yields[rank*factors+f];
+                    yield[f].first = yield[f].first * child.second + child.first;
+                    yield[f].second *= child.second;
+                }
             }
-        } else {
-            state->paths.push_back(act_path);
         }
-        // Expand the stack by incrementing each path's child by one
-        for(int i = 0; i < item->child_ranks.size(); i++) {
-            boost::shared_ptr<NbestStackItem> next_item = NbestStackIncrementChild(node, *item, i, uniq, states);
-            if(next_item.get() != NULL)
-                state->PushStack(next_item);
+        boost::hash_combine(combined, yield[f].first);
+        boost::hash_combine(combined, yield[f].second);
+    }
+    if(!states_[node].yield_hashes.insert(combined).second)
+        return false;
+    states_[node].yields.insert(states_[node].yields.end(), yield.begin(), yield.end());
+    return true;
+}
+
+int NbestIterator::GetDerivation(int node, int rank) {
+    if(!states_[node].initialized)
+        InitializeNode(node);
+    NodeState & state = states_[node];
+    // Until we've found the derivation or there are no more candidates
+    while((int)state.derivs.size() <= rank && state.heap.size() != 0) {
+        pop_heap(state.heap.begin(), state.heap.end(), CandidateLess(*this));
+        int cand = state.heap.back();
+        state.heap.pop_back();
+        // Add the candidates that advance one tail. Each combination is only
+        // reached by advancing its last non-zero rank, so none is added twice
+        HyperEdge * edge = candidates_[cand].edge;
+        int edge_rank = candidates_[cand].edge_rank;
+        vector<int> next_ranks(ranks_.begin() + candidates_[cand].ranks,
+                               ranks_.begin() + candidates_[cand].ranks + edge->GetTails().size());
+        for(int i = (int)next_ranks.size()-1; i >= 0; i--) {
+            next_ranks[i]++;
+            PushCandidate(node, edge_rank, edge, &next_ranks[0]);
+            if(--next_ranks[i] != 0) break;
         }
+        if(!uniq_ || CheckUnique(node, cand))
+            state.derivs.push_back(cand);
     }
-    // Return the path if found, null if not
-    if(state->paths.size() > rank)
-        return state->paths[rank];
-    else
-        return boost::shared_ptr<HyperPath>();
+    return ((int)state.derivs.size() > rank ? state.derivs[rank] : -1);
+}
+
+void NbestIterator::AddEdges(int cand, HyperPath & path) const {
+    const Candidate & my_cand = candidates_[cand];
+    path.AddEdge(my_cand.edge);
+    for(int i = 0; i < (int)my_cand.edge->GetTails().size(); i++) {
+        int tail = my_cand.edge->GetTail(i)->GetId();
+        AddEdges(states_[tail].derivs[ranks_[my_cand.ranks+i]], path);
+    }
+}
+
+boost::shared_ptr<HyperPath> NbestIterator::Next() {
+    boost::shared_ptr<HyperPath> path;
+    if(graph_.NumNodes() == 0) return path;
+    int cand = GetDerivation(0, next_);
+    if(cand == -1) return path;
+    next_++;
+    path.reset(new HyperPath);
+    path->SetScore(candidates_[cand].score);
+    AddEdges(cand, *path);
+    path->SetTrgData(path->CalcTranslations());
+    return path;
 }
 
 vector<boost::shared_ptr<HyperPath> > HyperGraph::GetNbest(int n, bool uniq) {
-    vector<boost::shared_ptr<NbestState> > states(nodes_.size());
+    NbestIterator iter(*this, uniq);
     vector<boost::shared_ptr<HyperPath> > ret;
     for(int i = 0; i < n; i++) {
-        boost::shared_ptr<HyperPath> path = NbestGetNthPath(0, i, uniq, states);
+        boost::shared_ptr<HyperPath> path = iter.Next();
         if(path.get() == NULL) break;
-        path->SetTrgData(path->CalcTranslations());
         ret.push_back(path);
     }
     return ret;
@@ -450,6 +508,16 @@ void HyperGraph::ScoreEdges(const Weights & weights) {
         edge->SetScore(weights.GetCurrent() * edge->GetFeatures());
 }
 
+void HyperGraph::ScoreEdges(const DenseWeights & weights) {
+    vector<const SparseVector*> feats(edges_.size());
+    for(int i = 0; i < (int)edges_.size(); i++)
+        feats[i] = &edges_[i]->GetFeatures();
+    vector<Real> scores;
+    weights.Dot(feats, scores);
+    for(int i = 0; i < (int)edges_.size(); i++)
+        edges_[i]->SetScore(scores[i]);
+}
+
 class QueueEntry {
 public:
     QueueEntry(Real score, Real lm_score, const vector<int> & id) :
@@ -463,6 +531,7 @@ void HyperEdge::SetRule(const TranslationRule * rule, const SparseVector & orig_
     // src_str_ = rule->GetSrcStr();
     features_ = rule->GetFeatures() + orig_features;
     trg_data_ = rule->GetTrgData();
+    rule_ = rule;
 }
 
 Real HyperNode::GetInsideProb(vector<Real> & inside) {
@@ -542,11 +611,11 @@ Real HyperNode::CalcViterbiScore() {
 // First copy the edges and nodes, then refresh the pointers
 HyperGraph::HyperGraph(const HyperGraph & rhs) : words_(rhs.words_), edge_type_(rhs.edge_type_) {
     BOOST_FOREACH(HyperNode * node, rhs.nodes_)
-        nodes_.push_back(new HyperNode(*node));
+        nodes_.push_back(NewNode(*node));
     edge_type_ = rhs.edge_type_;
     if(edge_type_ == HYPER_EDGE) {
         BOOST_FOREACH(HyperEdge * edge, rhs.edges_)
-            edges_.push_back(new HyperEdge(*edge));
+            edges_.push_back(NewEdge(*edge));
     } else if (edge_type_ == RULE_EDGE) {
         BOOST_FOREACH(HyperEdge * edge, rhs.edges_)
             edges_.push_back(new RuleEdge(*static_cast<RuleEdge*>(edge)));
@@ -556,23 +625,61 @@ HyperGraph::HyperGraph(const HyperGraph & rhs) : words_(rhs.words_), edge_type_(
     BOOST_FOREACH(HyperEdge * edge, edges_)
         edge->RefreshPointers(*this);
 }
+// Values allocated from the pools are freed together with the pools
 HyperGraph::~HyperGraph() {
     BOOST_FOREACH(HyperNode* node, nodes_)
-        delete node;
+        if(!node_pool_.is_from(node))
+            delete node;
     BOOST_FOREACH(HyperEdge* edge, edges_)
-        delete edge;
+        if(!edge_pool_.is_from(edge))
+            delete edge;
 };
 
 void HyperGraph::DeleteNodes() {
-    BOOST_FOREACH(HyperNode* node, nodes_)
-        delete node;
+    FreeNodes(nodes_);
     nodes_.resize(0);
 }
 void HyperGraph::DeleteEdges() {
-    BOOST_FOREACH(HyperEdge* edge, edges_)
-        delete edge;
+    FreeEdges(edges_);
     edges_.resize(0);
 }
+// The pools keep their free lists ordered by address, so freeing from the
+// highest address down avoids walking the list for each value
+void HyperGraph::FreeNodes(vector<HyperNode*> nodes) {
+    std::sort(nodes.begin(), nodes.end(), std::greater<HyperNode*>());
+    BOOST_FOREACH(HyperNode * node, nodes)
+        FreeNode(node);
+}
+void HyperGraph::FreeEdges(vector<HyperEdge*> edges) {
+    std::sort(edges.begin(), edges.end(), std::greater<HyperEdge*>());
+    BOOST_FOREACH(HyperEdge * edge, edges)
+        FreeEdge(edge);
+}
+void HyperGraph::FreeNode(HyperNode * node) {
+    if(node_pool_.is_from(node))
+        node_pool_.destroy(node);
+    else
+        delete node;
+}
+void HyperGraph::FreeEdge(HyperEdge * edge) {
+    if(edge_pool_.is_from(edge))
+        edge_pool_.destroy(edge);
+    else
+        delete edge;
+}
+
+HyperNode * HyperGraph::NewNode(WordId sym, WordId trg_sym, SpanId span) {
+    return node_pool_.construct(HyperNode(sym, trg_sym, span));
+}
+HyperNode * HyperGraph::NewNode(const HyperNode & node) {
+    return node_pool_.construct(node);
+}
+HyperEdge * HyperGraph::NewEdge(HyperNode * head) {
+    return edge_pool_.construct(HyperEdge(head));
+}
+HyperEdge * HyperGraph::NewEdge(const HyperEdge & edge) {
+    return edge_pool_.construct(edge);
+}
 
 
 void HyperGraph::ResetViterbiScores() {
@@ -585,9 +692,9 @@ int HyperGraph::Append(const HyperGraph & rhs) {
     int edge_start = edges_.size();
     // Append the nodes
     BOOST_FOREACH(const HyperNode * node, rhs.GetNodes())
-        nodes_.push_back(new HyperNode(*node));
+        nodes_.push_back(NewNode(*node));
     BOOST_FOREACH(const HyperEdge * edge, rhs.GetEdges())
-        edges_.push_back(new HyperEdge(*edge));
+        edges_.push_back(NewEdge(*edge));
     // Re-adjust the links
     for(int i = node_start; i < (int)nodes_.size(); i++) {
         nodes_[i]->SetId(i);
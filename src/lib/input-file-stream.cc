@@ -22,25 +22,326 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <travatar/global-debug.h>
 #include <travatar/input-file-stream.h>
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/copy.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
+#include <travatar/thread-pool.h>
+#include <travatar/task.h>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <zlib.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <vector>
 
 using namespace std;
 using namespace boost;
-using namespace boost::iostreams;
 
 namespace travatar {
 
+namespace {
+
+// The amount of decompressed data in each buffer, and the number of buffers
+// that may be filled ahead of the reader
+const size_t kChunkSize = 1 << 20;
+const int kNumChunks = 4;
+const size_t kReadSize = 1 << 18;
+
+// A source of the contents of a file, which are read one buffer at a time
+class ChunkSource {
+public:
+    virtual ~ChunkSource() { }
+    // Fill the buffer with the next data from the file, leaving it empty at
+    // the end of the file
+    virtual void Fill(vector<char> & buf) = 0;
+};
+
+// Decompress a gzip file with zlib, including files with several members
+// (such as those made by concatenating gzip files)
+class GzipSource : public ChunkSource {
+public:
+    GzipSource(const string & file_name) :
+            file_name_(file_name), in_(file_name.c_str(), ios::in | ios::binary),
+            in_buf_(kReadSize), member_end_(true), done_(false) {
+        if(!in_) THROW_ERROR("Could not open " << file_name);
+        memset(&strm_, 0, sizeof(strm_));
+        if(inflateInit2(&strm_, 15+16) != Z_OK)
+            THROW_ERROR("Could not initialize zlib");
+    }
+    virtual ~GzipSource() { inflateEnd(&strm_); }
+
+    virtual void Fill(vector<char> & buf) {
+        buf.resize(kChunkSize);
+        strm_.next_out = reinterpret_cast<Bytef*>(&buf[0]);
+        strm_.avail_out = buf.size();
+        while(strm_.avail_out > 0 && !done_) {
+            if(strm_.avail_in == 0) {
+                in_.read(&in_buf_[0], in_buf_.size());
+                strm_.next_in = reinterpret_cast<Bytef*>(&in_buf_[0]);
+                strm_.avail_in = in_.gcount();
+                if(strm_.avail_in == 0) {
+                    if(!member_end_) THROW_ERROR("Compressed file ended prematurely: " << file_name_);
+                    done_ = true;
+                    break;
+                }
+            }
+            int ret = inflate(&strm_, Z_NO_FLUSH);
+            if(ret == Z_STREAM_END) {
+                // Continue with the next member, if there is one
+                inflateReset(&strm_);
+                member_end_ = true;
+            } else if(ret == Z_OK) {
+                member_end_ = false;
+            } else {
+                THROW_ERROR("Error decompressing " << file_name_ << ": " << (strm_.msg ? strm_.msg : "bad data"));
+            }
+        }
+        buf.resize(buf.size() - strm_.avail_out);
+    }
+
+protected:
+    string file_name_;
+    ifstream in_;
+    vector<char> in_buf_;
+    z_stream strm_;
+    bool member_end_, done_;
+};
+
+// Check whether a file starts with a BGZF block, a gzip member with a "BC"
+// extra field giving the size of the block
+bool IsBgzf(const string & file_name) {
+    ifstream in(file_name.c_str(), ios::in | ios::binary);
+    unsigned char header[18];
+    if(!in.read(reinterpret_cast<char*>(header), sizeof(header)))
+        return false;
+    return header[0] == 0x1f && header[1] == 0x8b && header[2] == 8 && (header[3] & 4) &&
+           header[12] == 'B' && header[13] == 'C' && header[14] == 2 && header[15] == 0;
+}
+
+// Decompress one BGZF block
+class InflateBlockTask : public Task {
+public:
+    InflateBlockTask(const string & file_name, const unsigned char * in, size_t in_size, char * out, size_t out_size, uint32_t crc, string & error) :
+        file_name_(file_name), in_(in), in_size_(in_size), out_(out), out_size_(out_size), crc_(crc), error_(error) { }
+    virtual void Run() {
+        z_stream strm;
+        memset(&strm, 0, sizeof(strm));
+        if(inflateInit2(&strm, -15) != Z_OK) { error_ = "Could not initialize zlib"; return; }
+        strm.next_in = const_cast<Bytef*>(in_);
+        strm.avail_in = in_size_;
+        strm.next_out = reinterpret_cast<Bytef*>(out_);
+        strm.avail_out = out_size_;
+        int ret = inflate(&strm, Z_FINISH);
+        inflateEnd(&strm);
+        if(ret != Z_STREAM_END || strm.avail_out != 0 ||
+           crc32(crc32(0, NULL, 0), reinterpret_cast<const Bytef*>(out_), out_size_) != crc_)
+            error_ = "Error decompressing a block of " + file_name_;
+    }
+protected:
+    const string & file_name_;
+    const unsigned char * in_;
+    size_t in_size_;
+    char * out_;
+    size_t out_size_;
+    uint32_t crc_;
+    string & error_;
+};
+
+// Decompress a BGZF file, whose blocks are independent gzip members of at
+// most 64kB, on several threads. The blocks that fill one buffer are read
+// together, and then decompressed in parallel
+class BgzfSource : public ChunkSource {
+public:
+    BgzfSource(const string & file_name, int threads) :
+            file_name_(file_name), in_(file_name.c_str(), ios::in | ios::binary), pool_(threads) {
+        if(!in_) THROW_ERROR("Could not open " << file_name);
+    }
+
+    virtual void Fill(vector<char> & buf) {
+        // Skip batches that only contain empty blocks, such as the end of
+        // file marker of files that were concatenated
+        buf.clear();
+        while(buf.empty() && ReadBlocks()) {
+            size_t out_size = 0;
+            for(size_t i = 0; i < blocks_.size(); i++)
+                out_size += blocks_[i].out_size;
+            buf.resize(out_size);
+            vector<string> errors(blocks_.size());
+            size_t out_pos = 0;
+            for(size_t i = 0; i < blocks_.size(); i++) {
+                const Block & block = blocks_[i];
+                if(block.out_size > 0)
+                    pool_.Submit(new InflateBlockTask(file_name_, &in_buf_[block.in_pos], block.in_size,
+                                                      &buf[out_pos], block.out_size, block.crc, errors[i]));
+                out_pos += block.out_size;
+            }
+            pool_.Wait();
+            for(size_t i = 0; i < errors.size(); i++)
+                if(errors[i] != "") THROW_ERROR(errors[i]);
+        }
+    }
+
+protected:
+    struct Block {
+        size_t in_pos, in_size, out_size;
+        uint32_t crc;
+    };
+
+    static uint32_t ReadLE(const unsigned char * ptr, int bytes) {
+        uint32_t val = 0;
+        for(int i = bytes-1; i >= 0; i--)
+            val = (val << 8) | ptr[i];
+        return val;
+    }
+
+    // Read the compressed blocks that fit in one buffer, and return false
+    // at the end of the file
+    bool ReadBlocks() {
+        in_buf_.clear();
+        blocks_.clear();
+        size_t out_size = 0;
+        const size_t max_block = 1 << 16;
+        while(out_size + max_block <= kChunkSize) {
+            // Read the fixed part of the header and the extra fields
+            unsigned char header[12];
+            if(!in_.read(reinterpret_cast<char*>(header), sizeof(header))) {
+                if(in_.gcount() != 0) THROW_ERROR("Compressed file ended prematurely: " << file_name_);
+                break;
+            }
+            if(header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || !(header[3] & 4))
+                THROW_ERROR("Bad BGZF block header in " << file_name_);
+            size_t xlen = ReadLE(header+10, 2);
+            vector<unsigned char> extra(xlen);
+            if(xlen > 0 && !in_.read(reinterpret_cast<char*>(&extra[0]), xlen))
+                THROW_ERROR("Compressed file ended prematurely: " << file_name_);
+            size_t block_size = 0;
+            for(size_t i = 0; i + 4 <= xlen; i += 4 + ReadLE(&extra[i+2], 2))
+                if(extra[i] == 'B' && extra[i+1] == 'C' && ReadLE(&extra[i+2], 2) == 2 && i + 6 <= xlen)
+                    block_size = ReadLE(&extra[i+4], 2) + 1;
+            if(block_size < 12 + xlen + 8)
+                THROW_ERROR("Missing or bad BGZF block size in " << file_name_);
+            // Read the compressed data and the trailer
+            Block block;
+            block.in_pos = in_buf_.size();
+            block.in_size = block_size - 12 - xlen - 8;
+            in_buf_.resize(in_buf_.size() + block.in_size + 8);
+            if(!in_.read(reinterpret_cast<char*>(&in_buf_[block.in_pos]), block.in_size + 8))
+                THROW_ERROR("Compressed file ended prematurely: " << file_name_);
+            block.crc = ReadLE(&in_buf_[block.in_pos + block.in_size], 4);
+            block.out_size = ReadLE(&in_buf_[block.in_pos + block.in_size + 4], 4);
+            if(block.out_size > max_block)
+                THROW_ERROR("BGZF block is too large in " << file_name_);
+            blocks_.push_back(block);
+            out_size += block.out_size;
+        }
+        return blocks_.size() > 0;
+    }
+
+    string file_name_;
+    ifstream in_;
+    vector<unsigned char> in_buf_;
+    vector<Block> blocks_;
+    ThreadPool pool_;
+};
+
+// A stream buffer that reads a source into a ring of buffers on a background
+// thread, so the next part of the file is read and decompressed while the
+// previous part is being parsed
+class ReadAheadBuf : public std::streambuf {
+public:
+    ReadAheadBuf(ChunkSource * source) : source_(source), current_(NULL), done_(false), stop_(false) {
+        for(int i = 0; i < kNumChunks; i++)
+            free_.push_back(new vector<char>);
+        thread_ = boost::thread(&ReadAheadBuf::Produce, this);
+    }
+    virtual ~ReadAheadBuf() {
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            stop_ = true;
+            cond_.notify_all();
+        }
+        thread_.join();
+        delete current_;
+        BOOST_FOREACH(vector<char> * buf, free_) delete buf;
+        BOOST_FOREACH(vector<char> * buf, full_) delete buf;
+    }
+
+protected:
+    virtual int_type underflow() {
+        if(gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        boost::mutex::scoped_lock lock(mutex_);
+        // Give the buffer that was read back to the background thread
+        if(current_ != NULL) {
+            free_.push_back(current_);
+            current_ = NULL;
+            cond_.notify_all();
+        }
+        while(full_.empty() && !done_)
+            cond_.wait(lock);
+        if(full_.empty()) {
+            setg(NULL, NULL, NULL);
+            if(error_ != "") THROW_ERROR(error_);
+            return traits_type::eof();
+        }
+        current_ = full_.front(); full_.pop_front();
+        char * begin = &(*current_)[0];
+        setg(begin, begin, begin + current_->size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+    // Fill free buffers until the end of the file
+    void Produce() {
+        try {
+            while(true) {
+                vector<char> * buf;
+                {
+                    boost::mutex::scoped_lock lock(mutex_);
+                    while(free_.empty() && !stop_)
+                        cond_.wait(lock);
+                    if(stop_) break;
+                    buf = free_.front(); free_.pop_front();
+                }
+                source_->Fill(*buf);
+                boost::mutex::scoped_lock lock(mutex_);
+                if(buf->empty()) {
+                    free_.push_back(buf);
+                    break;
+                }
+                full_.push_back(buf);
+                cond_.notify_all();
+            }
+        } catch(std::exception & e) {
+            boost::mutex::scoped_lock lock(mutex_);
+            error_ = e.what();
+        }
+        boost::mutex::scoped_lock lock(mutex_);
+        done_ = true;
+        cond_.notify_all();
+    }
+
+    boost::scoped_ptr<ChunkSource> source_;
+    vector<char> * current_;
+    deque<vector<char>*> free_, full_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    boost::thread thread_;
+    string error_;
+    bool done_, stop_;
+};
+
+}
+
 inline bool FileExists(const std::string& filePath)
 {
   ifstream ifs(filePath.c_str());
   return !ifs.fail();
 }
 
+int InputFileStream::inflate_threads_ = std::max(1, std::min(4, (int)boost::thread::hardware_concurrency()));
+
 InputFileStream::InputFileStream(std::string filePath)
-  : std::istream(NULL), m_streambuf(NULL), ifs_(NULL) {
+  : std::istream(NULL), m_streambuf(NULL) {
     if(!FileExists(filePath)) {
         if(FileExists(filePath+".gz"))
             filePath += ".gz";
@@ -49,11 +350,12 @@ InputFileStream::InputFileStream(std::string filePath)
     }
     if(filePath.size() > 3 &&
        filePath.substr(filePath.size() - 3, 3) == ".gz") {
-      filtering_streambuf<input> * in = new filtering_streambuf<input>;
-      ifs_ = new ifstream(filePath.c_str());
-      in->push(gzip_decompressor());
-      in->push(*ifs_);
-      m_streambuf = in;
+      ChunkSource * source;
+      if(inflate_threads_ > 1 && IsBgzf(filePath))
+          source = new BgzfSource(filePath, inflate_threads_);
+      else
+          source = new GzipSource(filePath);
+      m_streambuf = new ReadAheadBuf(source);
     } else {
       std::filebuf* fb = new std::filebuf();
       fb = fb->open(filePath.c_str(), std::ios::in);
@@ -64,13 +366,14 @@ InputFileStream::InputFileStream(std::string filePath)
       m_streambuf = fb;
     }
     this->init(m_streambuf);
+    // Pass on errors from decompression instead of just ending the stream
+    this->exceptions(std::ios::badbit);
 }
 
 InputFileStream::~InputFileStream()
 {
   delete m_streambuf;
   m_streambuf = NULL;
-  if(ifs_) delete ifs_;
 }
 
 void InputFileStream::Close()
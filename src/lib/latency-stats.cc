@@ -0,0 +1,48 @@
+#include <travatar/latency-stats.h>
+#include <algorithm>
+#include <sstream>
+
+using namespace travatar;
+using namespace std;
+
+void LatencyStats::Add(double seconds) {
+    boost::mutex::scoped_lock lock(mutex_);
+    // Overwrite the oldest sample once the window is full
+    if((int)samples_.size() < window_)
+        samples_.push_back(seconds);
+    else
+        samples_[count_ % window_] = seconds;
+    count_++;
+    total_ += seconds;
+}
+
+double LatencyStats::GetPercentile(double p) const {
+    vector<double> sorted;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        sorted = samples_;
+    }
+    if(sorted.size() == 0)
+        return 0.0;
+    sort(sorted.begin(), sorted.end());
+    int pos = (int)(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[max(0, min(pos, (int)sorted.size()-1))];
+}
+
+string LatencyStats::GetSummary() const {
+    long count;
+    double total;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        count = count_;
+        total = total_;
+    }
+    ostringstream oss;
+    oss << "requests=" << count
+        << " mean_ms=" << (count ? total / count * 1000 : 0.0)
+        << " p50_ms=" << GetPercentile(50) * 1000
+        << " p90_ms=" << GetPercentile(90) * 1000
+        << " p99_ms=" << GetPercentile(99) * 1000
+        << " max_ms=" << GetPercentile(100) * 1000;
+    return oss.str();
+}
@@ -2,13 +2,14 @@
 #include <travatar/hyper-graph.h>
 #include <travatar/dict.h>
 #include <travatar/global-debug.h>
-#include <travatar/vector-hash.h>
-#include <boost/unordered_set.hpp>
+#include <travatar/decoder-stats.h>
+#include <travatar/state-map.h>
+#include <travatar/task.h>
+#include <travatar/thread-pool.h>
 #include <boost/foreach.hpp>
 #include <lm/left.hh>
 #include <vector>
 #include <queue>
-#include <map>
 
 using namespace travatar;
 using namespace std;
@@ -38,11 +39,16 @@ inline string PrintContext(const Left & context) {
     return out.str();
 }
 
-class NodeScoreMore {
+// Order the recombined hypotheses so the best come first
+class StateEntryScoreMore {
 public:
-    bool operator()(const HyperNode* x, const HyperNode* y) {
-        return x->GetViterbiScore() > y->GetViterbiScore();
+    typedef StateMap<vector<ChartState>, HyperNode*> Map;
+    StateEntryScoreMore(const Map & map) : map_(map) { }
+    bool operator()(int x, int y) {
+        return map_.GetEntry(x).value->GetViterbiScore() > map_.GetEntry(y).value->GetViterbiScore();
     }
+private:
+    const Map & map_;
 };
 
 class NodeSrcLess {
@@ -54,36 +60,83 @@ public:
 
 }
 
-const ChartEntry & LMComposerBU::BuildChartCubePruning(
-                    const HyperGraph & parse,
-                    vector<boost::shared_ptr<ChartEntry> > & chart,
-                    vector<vector<ChartState> > & states,
-                    int id,
-                    HyperGraph & rule_graph) const {
-    // Save the nodes for easy access
-    const vector<HyperNode*> & nodes = parse.GetNodes();
-    // Don't build already finished charts
-    if(chart[id].get() != NULL) return *chart[id];
-    chart[id].reset(new ChartEntry);
-    ChartEntry & my_chart = *chart[id].get();
+LMComposerBU::~LMComposerBU() { }
+
+void LMComposerBU::SetChartThreads(int threads) {
+    if(threads > 1) {
+        chart_pool_.reset(new ThreadPool(threads));
+        // Hand cells out as soon as they are submitted
+        chart_pool_->SetWindow(1);
+    } else {
+        chart_pool_.reset();
+    }
+}
+
+Real LMComposerBU::EstimateEdge(const HyperEdge & edge, LMRuleData & buffer) const {
+    Real score = 0;
+    for(int lm_id = 0; lm_id < (int)lm_data_.size(); lm_id++) {
+        const LMRuleData & rule = lm_data_[lm_id]->GetRuleData(edge, buffer);
+        BOOST_FOREACH(Real run_score, rule.run_scores)
+            score += lm_data_[lm_id]->GetWeight() * run_score;
+        score += lm_data_[lm_id]->GetUnkWeight() * rule.unk;
+    }
+    return score;
+}
+
+Real LMComposerBU::ScoreEdge(const HyperEdge & id_edge,
+                              HyperEdge & next_edge,
+                              const vector<vector<ChartState> > & states,
+                              vector<ChartState> & my_state) const {
+    Real total_score = 0;
+    vector<SparsePair> lm_features;
+    Sentence lm_buffer;
+    for(int lm_id = 0; lm_id < (int)lm_data_.size(); lm_id++) {
+        LMData* data = lm_data_[lm_id];
+        // Edges from rules use the rule's precomputed scores
+        pair<Real,int> lm_scores = (id_edge.GetRule() != NULL ?
+            funcs_[lm_id]->CalcNontermScore(data, data->GetRuleData(*id_edge.GetRule()), next_edge.GetTails(), states, lm_id, my_state[lm_id]) :
+            funcs_[lm_id]->CalcNontermScore(data, data->MapWords(id_edge, lm_buffer), next_edge.GetTails(), states, lm_id, my_state[lm_id]));
+        // Add to the features and the score
+        total_score += lm_scores.first * data->GetWeight() + lm_scores.second * data->GetUnkWeight();
+        if(lm_scores.first != 0.0)
+            lm_features.push_back(make_pair(data->GetFeatureName(), lm_scores.first));
+        if(lm_scores.second != 0)
+            lm_features.push_back(make_pair(data->GetUnkFeatureName(), lm_scores.second));
+    }
+    // Clean up the features
+    next_edge.GetFeatures() += SparseVector(lm_features);
+    return total_score;
+}
+
+void LMComposerBU::CubePruneCell(
+                    const HyperNode & parse_node,
+                    const vector<boost::shared_ptr<ChartEntry> > & chart,
+                    const vector<vector<ChartState> > & states,
+                    HyperGraph * rule_graph,
+                    ChartEntry & my_chart,
+                    vector<vector<ChartState> > & my_states) const {
     // The priority queue of values yet to be expanded
     priority_queue<pair<Real, vector<int> > > hypo_queue;
-    // The hypothesis combination map
-    map<vector<ChartState>, HyperNode*> hypo_comb;
-    map<HyperNode*, vector<ChartState> > hypo_rev;
-    // The set indicating already-expanded combinations
-    unordered_set<vector<int>, VectorHash<int> > finished;
+    // The hypothesis combination map, which also holds the state of each
+    // new node
+    StateMap<vector<ChartState>, HyperNode*> hypo_comb;
     // For each edge outgoing from this node, add its best hypothesis
     // to the chart
-    const vector<HyperEdge*> & node_edges = nodes[id]->GetEdges();
+    const vector<HyperEdge*> & node_edges = parse_node.GetEdges();
+    // If using rest costs, the estimated LM score of each edge's terminals,
+    // which is added to the priority of its hypotheses but not their scores
+    vector<Real> estimates(node_edges.size(), 0);
+    LMRuleData rule_buffer;
     for(int i = 0; i < (int)node_edges.size(); i++) {
         HyperEdge * my_edge = node_edges[i];
         vector<int> q_id(my_edge->GetTails().size()+1);
         q_id[0] = i;
-        Real viterbi_score = my_edge->GetScore();
+        if(rest_cost_)
+            estimates[i] = EstimateEdge(*my_edge, rule_buffer);
+        Real viterbi_score = my_edge->GetScore() + estimates[i];
         for(int j = 1; j < (int)q_id.size(); j++) {
             q_id[j] = 0;
-            const ChartEntry & my_entry = BuildChartCubePruning(parse, chart, states, my_edge->GetTail(j-1)->GetId(), rule_graph);
+            const ChartEntry & my_entry = *chart[my_edge->GetTail(j-1)->GetId()];
             // For empty nodes, break
             if(my_entry.size() == 0) {
                 viterbi_score = -REAL_MAX;
@@ -99,93 +152,417 @@ const ChartEntry & LMComposerBU::BuildChartCubePruning(
     int num_popped = 0;
     while(hypo_queue.size() != 0) {
         if(num_popped++ >= stack_pop_limit_) break;
+        CountStat(COUNT_CUBE_POPS);
         // Get the score, id string, and edge
         Real top_score = hypo_queue.top().first;
         vector<int> id_str = hypo_queue.top().second;
-        const HyperEdge * id_edge = nodes[id]->GetEdge(id_str[0]);
+        const HyperEdge * id_edge = parse_node.GetEdge(id_str[0]);
         // cerr << "Processing ID string: " << id_str << endl;
         hypo_queue.pop();
         // Find the chart state and LM probability
-        HyperEdge * next_edge = new HyperEdge;
+        HyperEdge * next_edge = (rule_graph != NULL ? rule_graph->NewEdge() : new HyperEdge);
+        next_edge->GetTails().resize(id_edge->GetTails().size());
         next_edge->SetFeatures(id_edge->GetFeatures());
         next_edge->SetTrgData(id_edge->GetTrgData());
         next_edge->SetSrcStr(id_edge->GetSrcStr());
         vector<ChartState> my_state(lm_data_.size());
         // *** Get the data, etc. necessary for scoring
-        for(int curr_id = 0; curr_id < (int)id_edge->GetTails().size(); curr_id++) {
+        bool advance = true;
+        for(int curr_id = (int)id_edge->GetTails().size()-1; curr_id >= 0; curr_id--) {
             const HyperNode * tail = id_edge->GetTail(curr_id);
             // Get the chart for the particular node we're interested in
-            const ChartEntry & my_entry = BuildChartCubePruning(parse, chart, states, tail->GetId(), rule_graph);
+            const ChartEntry & my_entry = *chart[tail->GetId()];
             // From the node, get the appropriately ranked node
             int edge_pos = id_str[curr_id+1];
             HyperNode * chart_node = my_entry[edge_pos];
-            next_edge->AddTail(chart_node);
-            // If we have not gotten to the end, insert a new value into the queue
-            if(edge_pos+1 < (int)my_entry.size()) {
+            next_edge->GetTails()[curr_id] = chart_node;
+            // If we have not gotten to the end, insert a new value into the
+            // queue. Each combination is only reached by advancing its last
+            // non-zero position, so no combination is added twice
+            if(edge_pos+1 < (int)my_entry.size() && advance) {
                 vector<int> next_str = id_str;
                 next_str[curr_id+1]++;
-                if(finished.find(next_str) == finished.end()) {
-                    finished.insert(next_str);
-                    Real next_score = top_score - my_entry[edge_pos]->CalcViterbiScore() + my_entry[edge_pos+1]->CalcViterbiScore();
-                    hypo_queue.push(make_pair(next_score, next_str));
-                }
+                Real next_score = top_score - my_entry[edge_pos]->CalcViterbiScore() + my_entry[edge_pos+1]->CalcViterbiScore();
+                hypo_queue.push(make_pair(next_score, next_str));
             }
+            advance = advance && (edge_pos == 0);
         }
         // *** Actually step through in target order, scoring
-        Real total_score = 0;
-        vector<SparsePair> lm_features;
-        for(int lm_id = 0; lm_id < (int)lm_data_.size(); lm_id++) {
-            LMData* data = lm_data_[lm_id];
-
-            pair<Real,int> lm_scores = funcs_[lm_id]->CalcNontermScore(data, id_edge->GetTrgData()[data->GetFactor()].words, next_edge->GetTails(), states, lm_id, my_state[lm_id]);
-            // Add to the features and the score
-            total_score += lm_scores.first * data->GetWeight() + lm_scores.second * data->GetUnkWeight();
-            if(lm_scores.first != 0.0)
-                lm_features.push_back(make_pair(data->GetFeatureName(), lm_scores.first));
-            if(lm_scores.second != 0)
-                lm_features.push_back(make_pair(data->GetUnkFeatureName(), lm_scores.second));
-        }
-        // Clean up the features
-        next_edge->GetFeatures() += SparseVector(lm_features);
-        // Retrieve the hypothesis
-        map<vector<ChartState>, HyperNode*>::iterator it = hypo_comb.find(my_state);
-        HyperNode * next_node;
-        if(it == hypo_comb.end()) {
-            // Create a new copy of the current node
-            next_node = new HyperNode(nodes[id]->GetSym(), -1, nodes[id]->GetSpan());
-            // rule_graph.AddNode(next_node);
-            // states.push_back(my_state);
-            hypo_comb.insert(make_pair(my_state, next_node));
-            hypo_rev.insert(make_pair(next_node, my_state));
-            my_chart.push_back(next_node);
-        } else {
-            next_node = it->second;
-        }
-        next_node->SetViterbiScore(max(next_node->GetViterbiScore(),total_score + top_score));
+        Real total_score = ScoreEdge(*id_edge, *next_edge, states, my_state);
+        // Retrieve the hypothesis, or create a new copy of the current node
+        pair<int, bool> it = hypo_comb.Insert(my_state, HashStates(my_state), NULL);
+        if(it.second)
+            hypo_comb.GetEntry(it.first).value = (rule_graph != NULL ?
+                rule_graph->NewNode(parse_node.GetSym(), -1, parse_node.GetSpan()) :
+                new HyperNode(parse_node.GetSym(), -1, parse_node.GetSpan()));
+        HyperNode * next_node = hypo_comb.GetEntry(it.first).value;
+        next_node->SetViterbiScore(max(next_node->GetViterbiScore(),total_score + top_score - estimates[id_str[0]]));
         next_edge->SetHead(next_node);
         next_edge->SetScore(id_edge->GetScore() + total_score);
         // rule_graph.AddEdge(next_edge);
         next_node->AddEdge(next_edge);
         // cerr << " Updated node: " << *next_node << ", edge score = " << id_edge->GetScore() + total_score << endl;
     }
-    sort(my_chart.begin(), my_chart.end(), NodeScoreMore());
+    vector<int> order(hypo_comb.Size());
+    for(int i = 0; i < (int)order.size(); i++)
+        order[i] = i;
+    sort(order.begin(), order.end(), StateEntryScoreMore(hypo_comb));
     // Destroy all edges/nodes over the chart limit
-    if(chart_limit_ > 0 && (int)my_chart.size() > chart_limit_) {
-        for(int i = chart_limit_; i < (int)my_chart.size(); i++) {
-            BOOST_FOREACH(HyperEdge * edge, my_chart[i]->GetEdges())
-                delete edge;
-            delete my_chart[i];
+    if(chart_limit_ > 0 && (int)order.size() > chart_limit_) {
+        if(rule_graph == NULL) {
+            for(int i = chart_limit_; i < (int)order.size(); i++)
+                DeleteNode(hypo_comb.GetEntry(order[i]).value);
+        } else {
+            vector<HyperNode*> dropped_nodes;
+            vector<HyperEdge*> dropped_edges;
+            for(int i = chart_limit_; i < (int)order.size(); i++) {
+                HyperNode * node = hypo_comb.GetEntry(order[i]).value;
+                dropped_nodes.push_back(node);
+                dropped_edges.insert(dropped_edges.end(), node->GetEdges().begin(), node->GetEdges().end());
+            }
+            rule_graph->FreeEdges(dropped_edges);
+            rule_graph->FreeNodes(dropped_nodes);
         }
-        my_chart.resize(chart_limit_);
+        order.resize(chart_limit_);
     }
     // Add the rest of the nodes to the chart
-    BOOST_FOREACH(HyperNode * node, my_chart) {
-        rule_graph.AddNode(node);
-        states.push_back(hypo_rev[node]);
-        BOOST_FOREACH(HyperEdge * edge, node->GetEdges())
+    BOOST_FOREACH(int i, order) {
+        my_chart.push_back(hypo_comb.GetEntry(i).value);
+        my_states.push_back(hypo_comb.GetEntry(i).key);
+    }
+}
+
+void LMComposerBU::DeleteNode(HyperNode * node) {
+    BOOST_FOREACH(HyperEdge * edge, node->GetEdges())
+        delete edge;
+    delete node;
+}
+
+void LMComposerBU::AddChartEntry(const ChartEntry & entry,
+                                 vector<vector<ChartState> > & entry_states,
+                                 vector<vector<ChartState> > & states,
+                                 HyperGraph & rule_graph) {
+    for(int i = 0; i < (int)entry.size(); i++) {
+        rule_graph.AddNode(entry[i]);
+        states.push_back(vector<ChartState>());
+        states.back().swap(entry_states[i]);
+        BOOST_FOREACH(HyperEdge * edge, entry[i]->GetEdges())
             rule_graph.AddEdge(edge);
     }
-    return my_chart;
+}
+
+const ChartEntry & LMComposerBU::BuildChartCubePruning(
+                    const HyperGraph & parse,
+                    vector<boost::shared_ptr<ChartEntry> > & chart,
+                    vector<vector<ChartState> > & states,
+                    int id,
+                    HyperGraph & rule_graph) const {
+    // Don't build already finished charts
+    if(chart[id].get() != NULL) return *chart[id];
+    // Build the tails of every edge first, stopping at the first one that
+    // is empty, as the edge cannot be used
+    BOOST_FOREACH(const HyperEdge * edge, parse.GetNode(id)->GetEdges())
+        BOOST_FOREACH(const HyperNode * tail, edge->GetTails())
+            if(BuildChartCubePruning(parse, chart, states, tail->GetId(), rule_graph).size() == 0)
+                break;
+    boost::shared_ptr<ChartEntry> my_chart(new ChartEntry);
+    vector<vector<ChartState> > my_states;
+    CubePruneCell(*parse.GetNode(id), chart, states, &rule_graph, *my_chart, my_states);
+    AddChartEntry(*my_chart, my_states, states, rule_graph);
+    chart[id] = my_chart;
+    return *my_chart;
+}
+
+namespace travatar {
+
+// Counts down the chart cells in a wave that are still being built
+class CellLatch {
+public:
+    CellLatch(int count) : count_(count) { }
+    // Count down one cell, recording "error" if building it failed
+    void CountDown(const string & error = "") {
+        boost::mutex::scoped_lock lock(mutex_);
+        if(error_ == "")
+            error_ = error;
+        if(--count_ == 0)
+            finished_.notify_all();
+    }
+    void Wait() {
+        boost::mutex::scoped_lock lock(mutex_);
+        while(count_ > 0)
+            finished_.wait(lock);
+    }
+    // The first error that occurred, or empty if there was none
+    const string & GetError() const { return error_; }
+private:
+    int count_;
+    string error_;
+    boost::mutex mutex_;
+    boost::condition_variable finished_;
+};
+
+// A task that builds a single chart cell on one of the chart threads
+class CubePruningTask : public Task {
+public:
+    CubePruningTask(const LMComposerBU & composer, const HyperNode & parse_node,
+                    const vector<boost::shared_ptr<ChartEntry> > & chart,
+                    const vector<vector<ChartState> > & states,
+                    vector<vector<ChartState> > & my_states,
+                    SentenceStats & stats, CellLatch & latch) :
+        composer_(composer), parse_node_(parse_node), chart_(chart), states_(states),
+        my_states_(my_states), stats_(stats), latch_(latch) { }
+    virtual void Run() {
+        // The counts are added to the sentence's statistics after the wave
+        // Errors are passed to the decoding thread, which would otherwise wait
+        // for this cell forever
+        stats_.Attach();
+        string error;
+        try {
+            composer_.CubePruneCell(parse_node_, chart_, states_, NULL, *chart_[parse_node_.GetId()], my_states_);
+        } catch(std::exception & e) {
+            error = e.what();
+        }
+        stats_.Detach();
+        latch_.CountDown(error);
+    }
+    virtual int GetCost() const { return parse_node_.GetEdges().size(); }
+private:
+    const LMComposerBU & composer_;
+    const HyperNode & parse_node_;
+    const vector<boost::shared_ptr<ChartEntry> > & chart_;
+    const vector<vector<ChartState> > & states_;
+    vector<vector<ChartState> > & my_states_;
+    SentenceStats & stats_;
+    CellLatch & latch_;
+};
+
+}
+
+int LMComposerBU::CalcHeights(const HyperGraph & parse, int id, vector<int> & heights) {
+    if(heights[id] != -1) return heights[id];
+    int height = 0;
+    BOOST_FOREACH(const HyperEdge * edge, parse.GetNode(id)->GetEdges())
+        BOOST_FOREACH(const HyperNode * tail, edge->GetTails())
+            height = max(height, CalcHeights(parse, tail->GetId(), heights) + 1);
+    return (heights[id] = height);
+}
+
+void LMComposerBU::AddChartParallel(const HyperGraph & parse,
+                                    const vector<boost::shared_ptr<ChartEntry> > & chart,
+                                    vector<vector<ChartState> > & cell_states,
+                                    int id, vector<bool> & added,
+                                    vector<vector<ChartState> > & states,
+                                    HyperGraph & rule_graph) {
+    if(added[id]) return;
+    added[id] = true;
+    // Visit the cells in the same order as BuildChartCubePruning()
+    BOOST_FOREACH(const HyperEdge * edge, parse.GetNode(id)->GetEdges()) {
+        BOOST_FOREACH(const HyperNode * tail, edge->GetTails()) {
+            AddChartParallel(parse, chart, cell_states, tail->GetId(), added, states, rule_graph);
+            if(chart[tail->GetId()]->size() == 0)
+                break;
+        }
+    }
+    // The nodes are numbered by their position in cell_states until now
+    vector<vector<ChartState> > my_states;
+    BOOST_FOREACH(HyperNode * node, *chart[id]) {
+        my_states.push_back(vector<ChartState>());
+        my_states.back().swap(cell_states[node->GetId()]);
+        node->SetId(-1);
+    }
+    AddChartEntry(*chart[id], my_states, states, rule_graph);
+}
+
+const ChartEntry & LMComposerBU::BuildChartParallel(
+                    const HyperGraph & parse,
+                    vector<boost::shared_ptr<ChartEntry> > & chart,
+                    vector<vector<ChartState> > & states,
+                    HyperGraph & rule_graph) const {
+    // Cells only depend on the cells of their tails, so build all the cells
+    // of the same height at once
+    vector<int> heights(parse.NumNodes(), -1);
+    CalcHeights(parse, 0, heights);
+    vector<vector<int> > waves;
+    for(int id = 0; id < (int)heights.size(); id++) {
+        if(heights[id] == -1) continue;
+        if((int)waves.size() <= heights[id])
+            waves.resize(heights[id]+1);
+        waves[heights[id]].push_back(id);
+    }
+    // The states of the nodes while the chart is built, indexed by a
+    // temporary node id
+    vector<vector<ChartState> > cell_states;
+    BOOST_FOREACH(const vector<int> & wave, waves) {
+        vector<vector<vector<ChartState> > > wave_states(wave.size());
+        vector<SentenceStats> wave_stats(wave.size());
+        CellLatch latch(wave.size());
+        for(int i = 0; i < (int)wave.size(); i++) {
+            chart[wave[i]].reset(new ChartEntry);
+            chart_pool_->Submit(new CubePruningTask(*this, *parse.GetNode(wave[i]), chart, cell_states, wave_states[i], wave_stats[i], latch));
+        }
+        latch.Wait();
+        if(latch.GetError() != "") {
+            BOOST_FOREACH(const boost::shared_ptr<ChartEntry> & entry, chart) {
+                if(entry.get() == NULL)
+                    continue;
+                BOOST_FOREACH(HyperNode * node, *entry)
+                    DeleteNode(node);
+            }
+            THROW_ERROR("Could not build the chart: " << latch.GetError());
+        }
+        // Number the new nodes in a fixed order, so the output does not
+        // depend on which thread built which cell
+        for(int i = 0; i < (int)wave.size(); i++) {
+            for(int c = 0; c < NUM_COUNTERS; c++)
+                CountStat((DecoderCounter)c, wave_stats[i].GetCount(c));
+            const ChartEntry & entry = *chart[wave[i]];
+            for(int j = 0; j < (int)entry.size(); j++) {
+                entry[j]->SetId(cell_states.size());
+                cell_states.push_back(vector<ChartState>());
+                cell_states.back().swap(wave_states[i][j]);
+            }
+        }
+    }
+    // Add the nodes to the graph in the order that the serial search would,
+    // so the result is the same
+    vector<bool> added(parse.NumNodes(), false);
+    AddChartParallel(parse, chart, cell_states, 0, added, states, rule_graph);
+    // Delete the cells that the serial search would not have built
+    for(int id = 0; id < (int)added.size(); id++) {
+        if(!added[id] && chart[id].get() != NULL) {
+            BOOST_FOREACH(HyperNode * node, *chart[id])
+                DeleteNode(node);
+        }
+    }
+    return *chart[0];
+}
+
+namespace travatar {
+
+// The partially built chart for one node of the input parse in cube growing
+struct CubeGrowingEntry {
+    CubeGrowingEntry() : num_popped(0) { }
+    // Combinations of edges and positions of their tails that have not been
+    // scored yet, ordered by their score without the LM at their boundaries
+    priority_queue<pair<Real, vector<int> > > candidates;
+    // Nodes that have been scored, but might still be beaten by one of the
+    // candidates. Each is an index into recomb, and may be in the queue more
+    // than once if its score improves
+    priority_queue<pair<Real, int> > buffer;
+    // The nodes for each LM state, and whether each is in the chart yet
+    StateMap<vector<ChartState>, HyperNode*> recomb;
+    vector<bool> in_chart;
+    // The nodes in the chart, in the order they were found
+    ChartEntry chart;
+    int num_popped;
+};
+
+}
+
+HyperNode * LMComposerBU::GetCubeGrowingNode(
+                    const HyperGraph & parse,
+                    vector<boost::shared_ptr<CubeGrowingEntry> > & chart,
+                    vector<vector<ChartState> > & states,
+                    int id, int k,
+                    HyperGraph & rule_graph) const {
+    if(chart_limit_ > 0 && k >= chart_limit_)
+        return NULL;
+    const HyperNode * parse_node = parse.GetNode(id);
+    // The first time, add the best combination for each edge to the candidates
+    if(chart[id].get() == NULL) {
+        chart[id].reset(new CubeGrowingEntry);
+        LMRuleData rule_buffer;
+        const vector<HyperEdge*> & node_edges = parse_node->GetEdges();
+        for(int i = 0; i < (int)node_edges.size(); i++) {
+            const HyperEdge * my_edge = node_edges[i];
+            vector<int> q_id(my_edge->GetTails().size()+1, 0);
+            q_id[0] = i;
+            // Estimate the LM score using the words inside the rule
+            Real score = my_edge->GetScore() + EstimateEdge(*my_edge, rule_buffer);
+            for(int j = 0; j < (int)my_edge->GetTails().size() && score != -REAL_MAX; j++) {
+                HyperNode * tail = GetCubeGrowingNode(parse, chart, states, my_edge->GetTail(j)->GetId(), 0, rule_graph);
+                score = (tail != NULL ? score + tail->GetViterbiScore() : -REAL_MAX);
+            }
+            if(score != -REAL_MAX)
+                chart[id]->candidates.push(make_pair(score, q_id));
+        }
+    }
+    CubeGrowingEntry & entry = *chart[id];
+    while((int)entry.chart.size() <= k) {
+        // Nodes already in the chart may have been added to the buffer again
+        while(entry.buffer.size() && entry.in_chart[entry.buffer.top().second])
+            entry.buffer.pop();
+        bool can_pop = entry.candidates.size() && entry.num_popped < stack_pop_limit_;
+        // If the best scored node is better than any of the candidates can
+        // be expected to be, add it to the chart
+        if(entry.buffer.size() && (!can_pop || entry.buffer.top().first >= entry.candidates.top().first)) {
+            int rid = entry.buffer.top().second;
+            entry.buffer.pop();
+            entry.in_chart[rid] = true;
+            HyperNode * node = entry.recomb.GetEntry(rid).value;
+            entry.chart.push_back(node);
+            rule_graph.AddNode(node);
+            states.push_back(entry.recomb.GetEntry(rid).key);
+            BOOST_FOREACH(HyperEdge * edge, node->GetEdges())
+                rule_graph.AddEdge(edge);
+            continue;
+        } else if(!can_pop) {
+            return NULL;
+        }
+        // Otherwise, score the best candidate
+        entry.num_popped++;
+        CountStat(COUNT_CUBE_POPS);
+        Real top_score = entry.candidates.top().first;
+        vector<int> id_str = entry.candidates.top().second;
+        entry.candidates.pop();
+        const HyperEdge * id_edge = parse_node->GetEdge(id_str[0]);
+        HyperEdge * next_edge = rule_graph.NewEdge();
+        next_edge->GetTails().resize(id_edge->GetTails().size());
+        next_edge->SetFeatures(id_edge->GetFeatures());
+        next_edge->SetTrgData(id_edge->GetTrgData());
+        next_edge->SetSrcStr(id_edge->GetSrcStr());
+        Real viterbi_score = id_edge->GetScore();
+        // Add the next combinations, building the tails' next nodes if
+        // necessary. Each combination is only reached by advancing its last
+        // non-zero position, so no combination is added twice
+        bool advance = true;
+        for(int curr_id = (int)id_edge->GetTails().size()-1; curr_id >= 0; curr_id--) {
+            int tail_id = id_edge->GetTail(curr_id)->GetId(), edge_pos = id_str[curr_id+1];
+            HyperNode * chart_node = chart[tail_id]->chart[edge_pos];
+            next_edge->GetTails()[curr_id] = chart_node;
+            viterbi_score += chart_node->GetViterbiScore();
+            if(advance) {
+                HyperNode * next_node = GetCubeGrowingNode(parse, chart, states, tail_id, edge_pos+1, rule_graph);
+                if(next_node != NULL) {
+                    vector<int> next_str = id_str;
+                    next_str[curr_id+1]++;
+                    entry.candidates.push(make_pair(top_score - chart_node->GetViterbiScore() + next_node->GetViterbiScore(), next_str));
+                }
+            }
+            advance = advance && (edge_pos == 0);
+        }
+        // Score with the LM and recombine
+        vector<ChartState> my_state(lm_data_.size());
+        Real total_score = ScoreEdge(*id_edge, *next_edge, states, my_state);
+        pair<int, bool> it = entry.recomb.Insert(my_state, HashStates(my_state), NULL);
+        int rid = it.first;
+        if(it.second) {
+            entry.recomb.GetEntry(rid).value = rule_graph.NewNode(parse_node->GetSym(), -1, parse_node->GetSpan());
+            entry.in_chart.push_back(false);
+        }
+        HyperNode * next_node = entry.recomb.GetEntry(rid).value;
+        next_edge->SetHead(next_node);
+        next_edge->SetScore(id_edge->GetScore() + total_score);
+        next_node->AddEdge(next_edge);
+        if(entry.in_chart[rid]) {
+            rule_graph.AddEdge(next_edge);
+            next_node->SetViterbiScore(max(next_node->GetViterbiScore(), total_score + viterbi_score));
+        } else if(it.second || next_node->GetViterbiScore() < total_score + viterbi_score) {
+            next_node->SetViterbiScore(total_score + viterbi_score);
+            entry.buffer.push(make_pair(next_node->GetViterbiScore(), rid));
+        }
+    }
+    return entry.chart[k];
 }
 
 // Intersect this rule_graph with a language model, using cube pruning to control
@@ -205,16 +582,26 @@ HyperGraph * LMComposerBU::TransformGraph(const HyperGraph & parse) const {
     ret->SetWords(parse.GetWords());
     // Add the root node and its corresponding state
     int len = (nodes.size() > 0) ? nodes[0]->GetSpan().second : 0;
-    HyperNode * root = new HyperNode(root_sym_, -1, make_pair(0,len));
+    HyperNode * root = ret->NewNode(root_sym_, -1, make_pair(0,len));
     ret->AddNode(root);
     if(parse.NumNodes() == 0) return ret;
     states.resize(1);
     // Build the chart
-    BuildChartCubePruning(parse, chart, states, 0, *ret);
+    const ChartEntry * top_entry;
+    vector<boost::shared_ptr<CubeGrowingEntry> > growing_chart;
+    if(cube_growing_) {
+        growing_chart.resize(nodes.size());
+        for(int k = 0; GetCubeGrowingNode(parse, growing_chart, states, 0, k, *ret) != NULL; k++) { }
+        top_entry = &growing_chart[0]->chart;
+    } else if(chart_pool_.get() != NULL) {
+        top_entry = &BuildChartParallel(parse, chart, states, *ret);
+    } else {
+        top_entry = &BuildChartCubePruning(parse, chart, states, 0, *ret);
+    }
 
     // Build the final nodes
-    BOOST_FOREACH(HyperNode * node, *chart[0]) {
-        HyperEdge * edge = new HyperEdge(root);
+    BOOST_FOREACH(HyperNode * node, *top_entry) {
+        HyperEdge * edge = ret->NewEdge(root);
         edge->SetTrgData(CfgDataVector(GlobalVars::trg_factors, CfgData(Sentence(1, -1))));
         edge->AddTail(node);
         Real total_score = 0;
@@ -2,6 +2,7 @@
 #include <travatar/hyper-graph.h>
 #include <travatar/dict.h>
 #include <travatar/global-debug.h>
+#include <travatar/decoder-stats.h>
 #include <boost/unordered_set.hpp>
 #include <boost/foreach.hpp>
 #include <lm/left.hh>
@@ -21,10 +22,7 @@ using namespace lm;
 using namespace search;
 
 LMComposerIncremental::LMComposerIncremental(const std::vector<std::string> & str) :
-    LMComposer(str), stack_pop_limit_(0), edge_limit_(1000) {
-    if(lm_data_.size() != 1)
-        THROW_ERROR("Cannot perform search using 'inc' when using more than one language model. Try using 'cp' instead.");
-}
+    LMComposer(str), stack_pop_limit_(0), edge_limit_(1000) { }
 
 // At the beginning, just add new edges
 void Forest::Add(std::vector<PartialEdge> &existing, PartialEdge add) const {
@@ -41,34 +39,43 @@ NBestComplete Forest::Complete(std::vector<PartialEdge> &partial) {
     // For each edge, add a hyperedge to the graph
     PartialEdge best;
     HyperEdge *old_edge = NULL, *edge = NULL;
+    // The best score and other LM states after exact scoring of the other LMs
+    Real best_score = -REAL_MAX;
+    vector<lm::ngram::ChartState> best_states, my_states(other_lms_.size());
+    LMRuleData rule_buffer;
     BOOST_FOREACH(const PartialEdge & add, partial) {
         if (!best.Valid() || best.GetScore() < add.GetScore())
             best = add;
         old_edge = (HyperEdge*)add.GetNote().vp;
-        Real edge_score = add.GetScore();
-        // Add the new tails in *source* order 
-        vector<HyperNode*> tails;
+        Real edge_score = add.GetScore(), child_score = 0;
         Sentence wids;
         vector<WordId> node_id;
+        vector<HyperNode*> tails;
         if(old_edge) {
             wids = old_edge->GetTrgData()[factor_].words;
             node_id = vector<WordId>(old_edge->GetTails().size()+1);
             node_id[old_edge->GetTails().size()] = old_edge->GetId();
+            tails.resize(old_edge->GetTails().size());
         } else{
             wids = Sentence(1,-1);
             node_id = vector<WordId>(1);
+            tails.resize(1);
         }
+        // Add the new tails in *source* order. The non-terminals of the
+        // partial edge are in target order
+        int nt = 0;
         BOOST_FOREACH(WordId wid, wids) {
             if(wid < 0) {
                 int tid = -1-wid;
-                const PartialVertex & part = add.NT()[tid];
+                const PartialVertex & part = add.NT()[nt++];
                 HyperNode* child = (HyperNode*)part.End();
-                tails.push_back(child);
-                edge_score -= child->GetViterbiScore();
+                tails[tid] = child;
+                child_score += child->GetViterbiScore();
                 // Keep track of the node ID
                 node_id[tid] = child->GetId();
             }
         }
+        edge_score -= child_score;
         // Skip duplicate edges
         if(node_memo.find(node_id) != node_memo.end())
             continue;
@@ -77,9 +84,12 @@ NBestComplete Forest::Complete(std::vector<PartialEdge> &partial) {
             // }
         // Create the new edge
         int lm_unk = 0;
+        Real other_est = 0;
         if(old_edge) {
             edge = new HyperEdge(*old_edge);
             lm_unk = lm_unks_[old_edge->GetId()];
+            if(other_lms_.size())
+                other_est = other_ests_[old_edge->GetId()];
         } else {
             edge = new HyperEdge;
             edge->SetTrgData(CfgDataVector(GlobalVars::trg_factors, CfgData(Sentence(1,-1))));
@@ -88,11 +98,30 @@ NBestComplete Forest::Complete(std::vector<PartialEdge> &partial) {
         edge->SetHead(node);
         edge->SetTails(tails);
         hg->AddEdge(edge); node->AddEdge(edge);
+        edge_score -= other_est;
         Real lm_score = (edge_score - lm_unk * lm_unk_weight_ - edge->GetScore())/lm_weight_;
         edge->GetFeatures().Add(lm_id_, lm_score);
         if(lm_unk)
             edge->GetFeatures().Add(lm_unk_id_, lm_unk);
+        // Replace the estimates of the other LMs with their exact scores
+        for(int i = 0; i < (int)other_lms_.size(); i++) {
+            const LMData* data = other_lms_[i];
+            pair<Real,int> other_score(0, 0);
+            if(old_edge) {
+                other_score = data->GetFunc().CalcNontermScore(data, data->GetRuleData(*old_edge, rule_buffer), tails, other_states_, i, my_states[i]);
+            } else {
+                other_score.first = data->GetFunc().CalcFinalScore(data->GetLM(), other_states_[tails[0]->GetId()][i]);
+            }
+            edge->GetFeatures().Add(data->GetFeatureName(), other_score.first);
+            if(other_score.second)
+                edge->GetFeatures().Add(data->GetUnkFeatureName(), other_score.second);
+            edge_score += other_score.first * data->GetWeight() + other_score.second * data->GetUnkWeight();
+        }
         edge->SetScore(edge_score);
+        if(best_score < edge_score + child_score) {
+            best_score = edge_score + child_score;
+            best_states = my_states;
+        }
     }
     // Set the span for either the internal or final nodes
     if(old_edge) {
@@ -102,12 +131,20 @@ NBestComplete Forest::Complete(std::vector<PartialEdge> &partial) {
         node->SetSpan(edge->GetTail(0)->GetSpan());
         node->SetSym(root_sym_);
     }
-    node->SetViterbiScore(best.GetScore());
+    // Without other LMs, the scores are exactly those of the search
+    if(other_lms_.size()) {
+        if((int)other_states_.size() <= node->GetId())
+            other_states_.resize(node->GetId()+1);
+        other_states_[node->GetId()] = best_states;
+    } else {
+        best_score = best.GetScore();
+    }
+    node->SetViterbiScore(best_score);
     // Return the n-best
     if (!best.Valid())
         return NBestComplete(NULL, lm::ngram::ChartState(), -INFINITY);
     else
-        return NBestComplete(node, best.CompletedState(), best.GetScore());
+        return NBestComplete(node, best.CompletedState(), best_score);
 }
 
 // Calculate a single vertex
@@ -124,6 +161,8 @@ search::Vertex* LMComposerIncremental::CalculateVertex(
     search::EdgeGenerator edges;
     int num_edges = 0;
     LMData* data = lm_data_[0];
+    Sentence lm_buffer;
+    LMRuleData rule_buffer;
     if(id < 0 || id >= (int)nodes.size() || nodes[id] == NULL)
         THROW_ERROR("Bad id=" << id << " at nodes.size() == " << nodes.size());
     BOOST_FOREACH(const HyperEdge * edge, nodes[id]->GetEdges()) {
@@ -134,7 +173,7 @@ search::Vertex* LMComposerIncremental::CalculateVertex(
         float below_score = 0.0;
         int unk = 0;
         // Iterate over all output words in the target edge
-        BOOST_FOREACH(WordId wid, edge->GetTrgData()[data->GetFactor()].words) {
+        BOOST_FOREACH(WordId wid, data->MapWords(*edge, lm_buffer)) {
             // Add non-terminal
             if(wid < 0) {
                 words.push_back(lm::kMaxWordIndex);
@@ -148,7 +187,7 @@ search::Vertex* LMComposerIncremental::CalculateVertex(
                 below_score += children.back()->Bound();
             // Add terminal
             } else {
-                lm::WordIndex index = data->GetMapping(wid);
+                lm::WordIndex index = wid;
                 if(index == 0) unk++;
                 words.push_back(index);
                 ++terminals;
@@ -167,8 +206,19 @@ search::Vertex* LMComposerIncremental::CalculateVertex(
 
         // Score the rule
         search::ScoreRuleRet score = search::ScoreRule(*static_cast<LMType*>(data->GetLM()), words, pedge.Between());
-        pedge.SetScore(below_score + edge->GetScore() + data->GetWeight() * score.prob + data->GetUnkWeight() * score.oov);
+        CountStat(COUNT_LM_QUERIES);
+        // Estimate the other LMs by the words inside the rule
+        Real other_est = 0;
+        for(int i = 1; i < (int)lm_data_.size(); i++) {
+            const LMRuleData & rule = lm_data_[i]->GetRuleData(*edge, rule_buffer);
+            BOOST_FOREACH(Real run_score, rule.run_scores)
+                other_est += lm_data_[i]->GetWeight() * run_score;
+            other_est += lm_data_[i]->GetUnkWeight() * rule.unk;
+        }
+        pedge.SetScore(below_score + edge->GetScore() + data->GetWeight() * score.prob + data->GetUnkWeight() * score.oov + other_est);
         best.SetLMUnk(edge->GetId(), score.oov);
+        if(lm_data_.size() > 1)
+            best.SetOtherEstimate(edge->GetId(), other_est);
 
         // Set the note
         search::Note note;
@@ -215,6 +265,7 @@ search::Vertex* LMComposerIncremental::CalculateRootVertex(
     edges.AddEdge(pedge);
     // Perform scoring and add the edge
     search::ScoreRuleRet score = search::ScoreRule(*static_cast<LMType*>(data->GetLM()), words, pedge.Between());
+    CountStat(COUNT_LM_QUERIES);
     pedge.SetScore(below_score + data->GetWeight() * score.prob + data->GetUnkWeight() * score.oov);
     edges.AddEdge(pedge);
     // Create the vertex
@@ -257,6 +308,7 @@ HyperGraph * LMComposerIncremental::TransformGraphTemplate(const HyperGraph & pa
     search::Context<LMType> context(config, *static_cast<LMType*>(data->GetLM()));
     search::Forest best(data->GetFeatureName(), data->GetWeight(), data->GetUnkFeatureName(), data->GetUnkWeight(), root_sym_, data->GetFactor());
     // search::Forest best(data->GetWeight(), data->GetUnkWeight(), data->GetFactor());
+    best.SetOtherLMs(vector<LMData*>(lm_data_.begin()+1, lm_data_.end()));
 
     // Create the search graph
     vector<search::Vertex*> vertices(parse.NumNodes() + 1);
@@ -9,7 +9,7 @@ using namespace std;
 using namespace travatar;
 
 void MapEnumerateVocab::Add(lm::WordIndex index, const StringPiece &str) {
-    vocab_map_->insert(std::make_pair(Dict::WID(str.as_string()), index));
+    vocab_map_->Set(Dict::WID(str.as_string()), index);
 }
 
 LMComposer::LMComposer(const std::vector<std::string> & params) : lm_data_(), root_sym_(Dict::WID("LMROOT")) {
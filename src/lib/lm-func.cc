@@ -1,9 +1,12 @@
 #include <boost/foreach.hpp>
 #include <travatar/lm-func.h>
+#include <travatar/load-method.h>
 #include <travatar/global-debug.h>
+#include <travatar/decoder-stats.h>
 #include <travatar/hyper-graph.h>
 #include <travatar/string-util.h>
 #include <travatar/dict.h>
+#include <travatar/translation-rule.h>
 
 using namespace travatar;
 using namespace std;
@@ -28,22 +31,26 @@ LMFunc * LMFunc::CreateFromType(lm::ngram::ModelType type) {
     }
 }
 
+// The number of words that the LM looks up is counted as the number of LM
+// queries. For a non-terminal, the words in its left state are rescored
 template <class LMType>
 pair<Real,int> LMFuncTemplate<LMType>::CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<lm::ngram::ChartState> & states, ChartState & out_state) {
     // Get the rule score for the appropriate model
     RuleScore<LMType> my_rule_score(*static_cast<const LMType*>(data->GetLM()), out_state);
-    int unk = 0;
+    int unk = 0, queries = 0;
     BOOST_FOREACH(int trg_id, syms) {
         if(trg_id < 0) {
             int curr_id = -1 - trg_id;
             my_rule_score.NonTerminal(states[curr_id], 0);
+            queries += states[curr_id].left.length;
         } else {
-            // Re-index vocabulary
-            lm::WordIndex index = data->GetMapping(trg_id);
+            lm::WordIndex index = trg_id;
             if(index == 0) unk++;
             my_rule_score.Terminal(index);
+            queries++;
         }
     }
+    CountStat(COUNT_LM_QUERIES, queries);
     return make_pair(my_rule_score.Finish(), unk);
 }
 
@@ -51,18 +58,20 @@ template <class LMType>
 pair<Real,int> LMFuncTemplate<LMType>::CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, ChartState & out_state) {
     // Get the rule score for the appropriate model
     RuleScore<LMType> my_rule_score(*static_cast<const LMType*>(data->GetLM()), out_state);
-    int unk = 0;
+    int unk = 0, queries = 0;
     BOOST_FOREACH(int trg_id, syms) {
         if(trg_id < 0) {
             int curr_id = -1 - trg_id;
             my_rule_score.NonTerminal(states[curr_id][lm_id], 0);
+            queries += states[curr_id][lm_id].left.length;
         } else {
-            // Re-index vocabulary
-            lm::WordIndex index = data->GetMapping(trg_id);
+            lm::WordIndex index = trg_id;
             if(index == 0) unk++;
             my_rule_score.Terminal(index);
+            queries++;
         }
     }
+    CountStat(COUNT_LM_QUERIES, queries);
     return make_pair(my_rule_score.Finish(), unk);
 }
 
@@ -70,25 +79,66 @@ template <class LMType>
 pair<Real,int> LMFuncTemplate<LMType>::CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<HyperNode*> & tails, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, ChartState & out_state) {
     // Get the rule score for the appropriate model
     RuleScore<LMType> my_rule_score(*static_cast<const LMType*>(data->GetLM()), out_state);
-    int unk = 0;
+    int unk = 0, queries = 0;
     BOOST_FOREACH(int trg_id, syms) {
         if(trg_id < 0) {
             int curr_id = -1 - trg_id;
             // Add that edge to our non-terminal
             const vector<ChartState> & child_state = states[tails[curr_id]->GetId()];
             my_rule_score.NonTerminal(child_state[lm_id], 0);
+            queries += child_state[lm_id].left.length;
         } else {
-            // Re-index vocabulary
-            lm::WordIndex index = data->GetMapping(trg_id);
+            lm::WordIndex index = trg_id;
             if(index == 0) unk++;
             my_rule_score.Terminal(index);
+            queries++;
         }
     }
+    CountStat(COUNT_LM_QUERIES, queries);
     return make_pair(my_rule_score.Finish(), unk);
 }
 
+template <class LMType>
+pair<Real,int> LMFuncTemplate<LMType>::CalcNontermScore(const LMData* data, const LMRuleData & rule, const std::vector<HyperNode*> & tails, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, ChartState & out_state) {
+    RuleScore<LMType> my_rule_score(*static_cast<const LMType*>(data->GetLM()), out_state);
+    int queries = 0;
+    BOOST_FOREACH(int piece, rule.pieces) {
+        // The runs of terminals were already scored internally, so only
+        // their boundaries are scored here
+        if(piece < 0) {
+            const ChartState & child_state = states[tails[-1-piece]->GetId()][lm_id];
+            my_rule_score.NonTerminal(child_state, 0);
+            queries += child_state.left.length;
+        } else {
+            my_rule_score.NonTerminal(rule.run_states[piece], rule.run_scores[piece]);
+            queries += rule.run_states[piece].left.length;
+        }
+    }
+    CountStat(COUNT_LM_QUERIES, queries);
+    return make_pair(my_rule_score.Finish(), rule.unk);
+}
+
+template <class LMType>
+pair<Real,int> LMFuncTemplate<LMType>::CalcNontermScore(const LMData* data, const LMRuleData & rule, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, ChartState & out_state) {
+    RuleScore<LMType> my_rule_score(*static_cast<const LMType*>(data->GetLM()), out_state);
+    int queries = 0;
+    BOOST_FOREACH(int piece, rule.pieces) {
+        if(piece < 0) {
+            const ChartState & child_state = states[-1-piece][lm_id];
+            my_rule_score.NonTerminal(child_state, 0);
+            queries += child_state.left.length;
+        } else {
+            my_rule_score.NonTerminal(rule.run_states[piece], rule.run_scores[piece]);
+            queries += rule.run_states[piece].left.length;
+        }
+    }
+    CountStat(COUNT_LM_QUERIES, queries);
+    return make_pair(my_rule_score.Finish(), rule.unk);
+}
+
 template <class LMType>
 Real LMFuncTemplate<LMType>::CalcFinalScore(const void * lm, const ChartState & prev_state) {
+    CountStat(COUNT_LM_QUERIES, prev_state.left.length + 1);
     ChartState my_state;
     RuleScore<LMType> my_rule_score(*static_cast<const LMType*>(lm), my_state);
     my_rule_score.BeginSentence();
@@ -97,11 +147,35 @@ Real LMFuncTemplate<LMType>::CalcFinalScore(const void * lm, const ChartState &
     return my_rule_score.Finish();
 }
 
+template <class LMType>
+void LMFuncTemplate<LMType>::PrepareRule(const LMData* data, LMRuleData & rule) {
+    const LMType & lm = *static_cast<const LMType*>(data->GetLM());
+    const Sentence & words = rule.words;
+    rule.unk = 0;
+    for(int i = 0; i < (int)words.size(); ) {
+        if(words[i] < 0) {
+            rule.pieces.push_back(words[i++]);
+            continue;
+        }
+        // Score the run of terminals starting here on its own
+        ChartState run_state;
+        RuleScore<LMType> run_score(lm, run_state);
+        for( ; i < (int)words.size() && words[i] >= 0; i++) {
+            if(words[i] == 0) rule.unk++;
+            run_score.Terminal(words[i]);
+        }
+        Real score = run_score.Finish();
+        rule.pieces.push_back(rule.run_states.size());
+        rule.run_states.push_back(run_state);
+        rule.run_scores.push_back(score);
+    }
+}
 
 LMData::LMData(void * model, lm::ngram::ModelType type, VocabMap* vocab_map) :
         lm_feat_(Dict::WID("lm")), lm_unk_feat_(Dict::WID("lmunk")), 
         lm_(model), type_(type), vocab_map_(vocab_map), 
-        lm_weight_(1), lm_unk_weight_(0), factor_(0) { }
+        lm_weight_(1), lm_unk_weight_(0), factor_(0), id_(next_id_++),
+        func_(LMFunc::CreateFromType(type)) { }
 
 LMData::~LMData() {
     if(lm_) {
@@ -129,17 +203,52 @@ LMData::~LMData() {
         }
     }
     if(vocab_map_) delete vocab_map_;
+    if(func_) delete func_;
+}
+
+std::atomic<int> LMData::next_id_(0);
+util::LoadMethod LMData::default_load_(util::POPULATE_OR_READ);
+
+void LMData::MapWords(const Sentence & words, Sentence & lm_words) const {
+    lm_words.resize(words.size());
+    for(int i = 0; i < (int)words.size(); i++)
+        lm_words[i] = (words[i] < 0 ? words[i] : (int)vocab_map_->Get(words[i]));
+}
+
+const LMRuleData & LMData::GetRuleData(const TranslationRule & rule) const {
+    const LMRuleData * ret = rule.GetLMRuleData(id_);
+    if(ret == NULL) {
+        LMRuleData * data = new LMRuleData;
+        data->lm_id = id_;
+        MapWords(rule.GetTrgData()[factor_].words, data->words);
+        func_->PrepareRule(this, *data);
+        ret = rule.CacheLMRuleData(data);
+    }
+    return *ret;
+}
+
+const LMRuleData & LMData::GetRuleData(const HyperEdge & edge, LMRuleData & buffer) const {
+    if(edge.GetRule() != NULL)
+        return GetRuleData(*edge.GetRule());
+    buffer = LMRuleData();
+    buffer.lm_id = id_;
+    MapWords(edge.GetTrgData()[factor_].words, buffer.words);
+    func_->PrepareRule(this, buffer);
+    return buffer;
 }
 
-lm::WordIndex LMData::GetMapping(WordId wid) const {
-    VocabMap::const_iterator it = vocab_map_->find(wid);
-    return it == vocab_map_->end() ? 0 : it->second;
+const Sentence & LMData::MapWords(const HyperEdge & edge, Sentence & buffer) const {
+    if(edge.GetRule() != NULL)
+        return MapWords(*edge.GetRule());
+    MapWords(edge.GetTrgData()[factor_].words, buffer);
+    return buffer;
 }
 
 LMData::LMData(const std::string & str) : 
-        lm_feat_(Dict::WID("lm")), lm_unk_feat_(Dict::WID("lmunk")), lm_weight_(1), lm_unk_weight_(0), factor_(0) { 
+        lm_feat_(Dict::WID("lm")), lm_unk_feat_(Dict::WID("lmunk")), lm_weight_(1), lm_unk_weight_(0), factor_(0), id_(next_id_++), func_(NULL) { 
     // Get the LM file name and parameters
     std::vector<std::string> cols = Tokenize(str, '|');
+    util::LoadMethod load = default_load_;
     if(cols.size() > 2)
         THROW_ERROR("Bad LM parameter string with two or more pipes:" << endl << str);
     // Load the parameters
@@ -156,6 +265,8 @@ LMData::LMData(const std::string & str) :
                 lm_feat_ = Dict::WID(kv[1]);
             } else if(kv[0] == "lm_unk_feat") {
                 lm_unk_feat_ = Dict::WID(kv[1]);
+            } else if(kv[0] == "load") {
+                load = ParseLoadMethod(kv[1]);
             } else {
                 THROW_ERROR("Bad parameter name " << kv[0] << " in " << endl << str);
             }
@@ -165,6 +276,7 @@ LMData::LMData(const std::string & str) :
     MapEnumerateVocab lm_save;
     lm::ngram::Config lm_config;
     lm_config.enumerate_vocab = &lm_save;
+    lm_config.load_method = load;
     if (!lm::ngram::RecognizeBinary(cols[0].c_str(), type_))
         type_ = lm::ngram::PROBING;
     switch(type_) {
@@ -190,4 +302,5 @@ LMData::LMData(const std::string & str) :
         THROW_ERROR("Unrecognized kenlm model type " << type_);
     }
     vocab_map_ = lm_save.GetAndFreeVocabMap();    
+    func_ = LMFunc::CreateFromType(type_);
 }
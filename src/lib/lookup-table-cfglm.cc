@@ -8,6 +8,7 @@
 #include <travatar/input-file-stream.h>
 #include <travatar/lm-func.h>
 #include <travatar/vector-hash.h>
+#include <travatar/state-map.h>
 #include <travatar/weights.h>
 #include <marisa/marisa.h>
 #include <boost/foreach.hpp>
@@ -15,6 +16,7 @@
 #include <sstream>
 #include <fstream>
 #include <queue>
+#include <algorithm>
 
 using namespace travatar;
 using namespace std;
@@ -24,15 +26,33 @@ using namespace boost;
 //  A CKY+ Variant for SCFG Decoding Without a Dot Chart
 //  Rico Sennrich. SSST 2014.
 
-void CFGCollection::AddRules(const CFGPath & path, const RuleVec & rules) {
+class RuleScoresMore {
+public:
+    RuleScoresMore(const Weights & weights) : weights_(weights) { }
+    bool operator()(const TranslationRuleHiero* x, const TranslationRuleHiero* y) {
+        return x->GetScore(weights_) > y->GetScore(weights_);
+    }
+private:
+    const Weights & weights_;
+};
+
+void CFGCollection::AddRules(const CFGPath & path, const RuleVec & rules, const Weights & weights) {
     boost::shared_ptr<HieroRuleSpans> span(new HieroRuleSpans(path.spans));
     boost::shared_ptr<std::vector<HieroHeadLabels> > label(new std::vector<HieroHeadLabels>(path.labels));
+    size_t start = rules_.size();
     for(size_t i = 0; i < rules.size(); i++) {
         //cerr << " AddRules: " << *rules[i] << endl;
         rules_.push_back(rules[i]);
         spans_.push_back(span);
         labels_.push_back(label);
     }
+    // The rules in the group share their children, so sorting them lets
+    // cube pruning expand them best-first
+    stable_sort(rules_.begin() + start, rules_.end(), RuleScoresMore(weights));
+    for(size_t i = start; i < rules_.size(); i++) {
+        scores_.push_back(rules_[i]->GetScore(weights));
+        group_ends_.push_back(rules_.size());
+    }
 }
 
 CFGChartItem::~CFGChartItem() {
@@ -76,7 +96,7 @@ void CFGChartItem::FinalizeNodes() {
 }
 
 LookupTableCFGLM::LookupTableCFGLM() : 
-      pop_limit_(-1), chart_limit_(-1), trg_factors_(1),
+      pop_limit_(-1), chart_limit_(-1), rest_cost_(false), trg_factors_(1),
       root_symbol_(HieroHeadLabels(vector<WordId>(GlobalVars::trg_factors+1,Dict::WID("S")))),
       unk_symbol_(HieroHeadLabels(vector<WordId>(GlobalVars::trg_factors+1,Dict::WID("X")))),
       empty_symbol_(HieroHeadLabels(vector<WordId>(GlobalVars::trg_factors+1,Dict::WID("")))),
@@ -87,7 +107,7 @@ LookupTableCFGLM::~LookupTableCFGLM() {
     BOOST_FOREACH(LMData * lm, lm_data_) delete lm;
 }
 
-LookupTableCFGLM * LookupTableCFGLM::ReadFromFiles(const std::vector<std::string> & filenames) {
+LookupTableCFGLM * LookupTableCFGLM::ReadFromFiles(const std::vector<std::string> & filenames, const std::set<WordId> * vocab) {
     if(filenames.size() != 1) THROW_ERROR("LookupTableCFGLM currently only supports a single translation model");
     LookupTableCFGLM * ret = new LookupTableCFGLM;
     BOOST_FOREACH(const std::string & filename, filenames) {
@@ -95,7 +115,7 @@ LookupTableCFGLM * LookupTableCFGLM::ReadFromFiles(const std::vector<std::string
         //cerr << "Reading TM file from "<<filename<<"..." << endl;
         if(!tm_in)
             THROW_ERROR("Could not find TM: " << filename);
-        ret->AddRuleFSM(RuleFSM::ReadFromRuleTable(tm_in));
+        ret->AddRuleFSM(RuleFSM::ReadFromRuleTable(tm_in, vocab));
     }
     return ret;
 }
@@ -152,7 +172,7 @@ void LookupTableCFGLM::AddToChart(CFGPath & a, const Sentence & sent, int N, int
     if(!u) {
         BOOST_FOREACH(const RuleFSM * fsm, rule_fsms_) {
             if(fsm->GetTrie().lookup(a.agent))
-                collections[i*N+j].AddRules(a, fsm->GetRules()[a.agent.key().id()]);
+                collections[i*N+j].AddRules(a, fsm->GetRules()[a.agent.key().id()], *weights_);
         }
     }
     if(PredictiveSearch(a.agent))
@@ -160,6 +180,19 @@ void LookupTableCFGLM::AddToChart(CFGPath & a, const Sentence & sent, int N, int
             Consume(a, sent, N, i, j+1, k, chart, collections);
 }
 
+Real LookupTableCFGLM::EstimateRule(const TranslationRuleHiero & rule) const {
+    Real score = 0;
+    if(rest_cost_) {
+        BOOST_FOREACH(const LMData * data, lm_data_) {
+            const LMRuleData & rule_data = data->GetRuleData(rule);
+            BOOST_FOREACH(Real run_score, rule_data.run_scores)
+                score += data->GetWeight() * run_score;
+            score += data->GetUnkWeight() * rule_data.unk;
+        }
+    }
+    return score;
+}
+
 void LookupTableCFGLM::CubePrune(int N, int i, int j, vector<CFGCollection> & collection, vector<CFGChartItem> & chart, HyperGraph & ret) const {
     //cerr << "CubePrune(" << N << ", " << i << ", " << j << ")" << endl;
     // Don't build already finished charts
@@ -167,19 +200,19 @@ void LookupTableCFGLM::CubePrune(int N, int i, int j, vector<CFGCollection> & co
     assert(!chart[id].IsPopulated());
     // The priority queue of values yet to be expanded
     priority_queue<pair<Real, vector<int> > > hypo_queue;
-    // The set indicating already-expanded combinations
-    unordered_set<vector<int>, VectorHash<int> > finished;
     // For each rule in the collection, add its best edge to the chart
     const RuleVec & rules = collection[i*N+j].GetRules();
     const CFGCollection::SpanVec & spans = collection[i*N+j].GetSpans();
     const CFGCollection::LabelVec & labels = collection[i*N+j].GetLabels();
+    const vector<Real> & scores = collection[i*N+j].GetScores();
     assert(rules.size() == spans.size());
 
-    // Score the top hypotheses of each rule
+    // Score the top hypotheses of the best rule in each group. The other
+    // rules are added when the one before them is expanded
     //cerr << " Scoring hypotheses for " << rules.size() << " rules" << endl;
-    for(size_t rid = 0; rid < rules.size(); rid++) {
+    for(size_t rid = 0; rid < rules.size(); rid = collection[i*N+j].GetGroupEnd(rid)) {
         // Get the base score for the rule
-        Real score = weights_->GetCurrent() * rules[rid]->GetFeatures();
+        Real score = scores[rid] + EstimateRule(*rules[rid]);
         const vector<pair<int,int> > & path = *spans[rid];
         const vector<HieroHeadLabels> & lab = *labels[rid];
         assert(lab.size() == path.size());
@@ -195,9 +228,11 @@ void LookupTableCFGLM::CubePrune(int N, int i, int j, vector<CFGCollection> & co
     
     // Create a map for recombination
     typedef std::pair<HieroHeadLabels, std::vector<lm::ngram::ChartState> > RecombIndex;
-    typedef std::map<RecombIndex, HyperNode*> RecombMap;
-    RecombMap recomb_map;
-    set<vector<int> > finished_hyps;
+    StateMap<RecombIndex, HyperNode*> recomb_map;
+    // Combinations of rules and children are each added to the queue once,
+    // but unary rules can be added after any hypothesis with the same
+    // label, so remember which ones have been added already
+    vector<bool> unary_added;
 
     // Create the unary path
     vector<pair<int,int> > unary_path(1, pair<int,int>(i,j));
@@ -205,14 +240,11 @@ void LookupTableCFGLM::CubePrune(int N, int i, int j, vector<CFGCollection> & co
     // Go through the priority queue
     for(int num_popped = 0; hypo_queue.size() != 0 && 
                             (pop_limit_ < 0 || num_popped < pop_limit_) &&
-                            (chart_limit_ < 0 || (int)recomb_map.size() < chart_limit_); num_popped++) {
+                            (chart_limit_ < 0 || recomb_map.Size() < chart_limit_); num_popped++) {
         // Pop the top hypothesis
         Real top_score = hypo_queue.top().first;
         vector<int> id_str = hypo_queue.top().second;
         hypo_queue.pop();
-        // Check if this has already been expanded
-        if(finished_hyps.find(id_str) != finished_hyps.end()) continue;
-        finished_hyps.insert(id_str);
         // Find the paths and rules
         const vector<pair<int,int> > * path;
         const TranslationRuleHiero * rule;
@@ -227,6 +259,7 @@ void LookupTableCFGLM::CubePrune(int N, int i, int j, vector<CFGCollection> & co
             rule = unary_rules_[-1-id_str[0]];
             //cerr << " Unary ["<<i<<","<<j+1<<"] (s=" << top_score << "): " << *rule << endl;
         }
+        Real rule_score = (id_str[0] >= 0 ? scores[id_str[0]] : rule->GetScore(*weights_));
         // Create the next edge
         HyperEdge * next_edge = new HyperEdge;
         next_edge->SetFeatures(rule->GetFeatures());
@@ -245,7 +278,7 @@ void LookupTableCFGLM::CubePrune(int N, int i, int j, vector<CFGCollection> & co
         vector<SparsePair> lm_features;
         for(int lm_id = 0; lm_id < (int)lm_data_.size(); lm_id++) {
             LMData* data = lm_data_[lm_id];
-            pair<Real,int> lm_scores = funcs_[lm_id]->CalcNontermScore(data, next_edge->GetTrgData()[data->GetFactor()].words, states, lm_id, my_state[lm_id]);
+            pair<Real,int> lm_scores = funcs_[lm_id]->CalcNontermScore(data, data->GetRuleData(*rule), states, lm_id, my_state[lm_id]);
             // Add to the features and the score
             total_score += lm_scores.first * data->GetWeight() + lm_scores.second * data->GetUnkWeight();
             if(lm_scores.first != 0.0)
@@ -254,39 +287,59 @@ void LookupTableCFGLM::CubePrune(int N, int i, int j, vector<CFGCollection> & co
                 lm_features.push_back(make_pair(data->GetUnkFeatureName(), lm_scores.second));
         }
         next_edge->GetFeatures() += SparseVector(lm_features);
+        next_edge->SetScore(rule_score + total_score);
+        Real viterbi_score = next_edge->GetScore();
+        BOOST_FOREACH(HyperNode * tail, next_edge->GetTails())
+            viterbi_score += tail->GetViterbiScore();
         // Add the hypothesis to the hypergraph
         RecombIndex ridx = make_pair(rule->GetHeadLabels(), my_state);
-        RecombMap::iterator rit = recomb_map.find(ridx);
+        size_t hash = HashStates(my_state, boost::hash_range(ridx.first.begin(), ridx.first.end()));
+        pair<int, bool> rit = recomb_map.Insert(ridx, hash, NULL);
         ret.AddEdge(next_edge);
-        if(rit != recomb_map.end()) {
-            rit->second->AddEdge(next_edge);
-            next_edge->SetHead(rit->second);
+        if(!rit.second) {
+            HyperNode * node = recomb_map.GetEntry(rit.first).value;
+            node->AddEdge(next_edge);
+            node->SetViterbiScore(max(node->GetViterbiScore(), viterbi_score));
+            next_edge->SetHead(node);
         } else {
             HyperNode * node = new HyperNode;
             node->SetSpan(make_pair(i, j+1));
             node->SetSym(rule->GetSrcData().label);
+            node->SetViterbiScore(viterbi_score);
             next_edge->SetHead(node);
             ret.AddNode(node);
             chart[id].AddStatefulNode(rule->GetHeadLabels(), node, my_state);
             node->AddEdge(next_edge);
-            recomb_map.insert(make_pair(ridx, node));
+            recomb_map.GetEntry(rit.first).value = node;
         }
-        // Advance the hypothesis
-        for(size_t j = 0; j < path->size(); j++) {
+        // Advance the hypothesis. Each combination is only reached by
+        // advancing its last non-zero position, so none is added twice
+        bool advance = true;
+        for(int j = path->size()-1; j >= 0 && advance; j--) {
             const pair<int,int> & my_span = (*path)[j];
             Real my_score = top_score + chart[my_span.first*N + my_span.second].GetHypScoreDiff(rule->GetChildHeadLabels(j), id_str[j+1]+1);
             if(my_score > -REAL_MAX/2) {
                 vector<int> pos(id_str); pos[j+1]++;
                 hypo_queue.push(make_pair(my_score, pos));
             }
+            advance = (id_str[j+1] == 0);
+        }
+        // Advance to the next rule with the same children
+        if(advance && id_str[0] >= 0 && id_str[0]+1 < collection[i*N+j].GetGroupEnd(id_str[0])) {
+            vector<int> pos(id_str); pos[0]++;
+            hypo_queue.push(make_pair(top_score - scores[id_str[0]] - EstimateRule(*rules[id_str[0]])
+                                                + scores[id_str[0]+1] + EstimateRule(*rules[id_str[0]+1]), pos));
         }
         // If unary rules exist
         UnaryIds::const_iterator uit = unary_ids_.find(rule->GetHeadLabels());
         if(uit != unary_ids_.end()) {
+            if(unary_added.empty())
+                unary_added.resize(unary_rules_.size(), false);
             BOOST_FOREACH(int urid, uit->second) {
+                if(unary_added[urid]) continue;
+                unary_added[urid] = true;
                 vector<int> pos(2); pos[0] = -1-urid; pos[1] = 0;
-                // TODO: Recalculating the features for unary rules every time is extremely wasteful. Do something.
-                Real my_score = top_score + weights_->GetCurrent() * unary_rules_[urid]->GetFeatures();
+                Real my_score = top_score + unary_rules_[urid]->GetScore(*weights_) + EstimateRule(*unary_rules_[urid]);
                 hypo_queue.push(make_pair(my_score, pos));
             }
         }
@@ -324,7 +377,7 @@ HyperGraph * LookupTableCFGLM::TransformGraph(const HyperGraph & graph) const {
                 CFGPath next(root_path, sent, i);
                 BOOST_FOREACH(const RuleFSM * fsm, rule_fsms_) {
                     if(fsm->GetTrie().lookup(next.agent))
-                        collections[i*N+j].AddRules(next, fsm->GetRules()[next.agent.key().id()]);
+                        collections[i*N+j].AddRules(next, fsm->GetRules()[next.agent.key().id()], *weights_);
                 }
                 // if(PredictiveSearch(next.agent))
                 //     AddToChart(next, sent, N, i, i, false, chart, collections);
@@ -1,12 +1,14 @@
 #include <travatar/translation-rule-hiero.h>
 #include <travatar/dict.h>
 #include <travatar/global-debug.h>
+#include <travatar/decoder-stats.h>
 #include <travatar/string-util.h>
 #include <travatar/hyper-graph.h>
 #include <travatar/lookup-table-fsm.h>
 #include <travatar/sentence.h>
 #include <travatar/input-file-stream.h>
 #include <boost/foreach.hpp>
+#include <algorithm>
 #include <sstream>
 
 using namespace travatar;
@@ -37,7 +39,8 @@ LookupTableFSM::LookupTableFSM() : rule_fsms_(),
                    root_symbol_(HieroHeadLabels(vector<WordId>(GlobalVars::trg_factors+1,Dict::WID("S")))),
                    unk_symbol_(HieroHeadLabels(vector<WordId>(GlobalVars::trg_factors+1,Dict::WID("X")))),
                    empty_symbol_(HieroHeadLabels(vector<WordId>(GlobalVars::trg_factors+1,Dict::WID("")))),
-                   save_src_str_(false) { }
+                   save_src_str_(false),
+                   chart_match_(true) { }
 
 LookupTableFSM::~LookupTableFSM() {
     BOOST_FOREACH(RuleFSM* rule_fsm, rule_fsms_) {
@@ -71,10 +74,11 @@ string RuleFSM::CreateKey(const CfgData & src_data,
     return string((char*)&key_str[0], sizeof(WordId)*key_str.size());
 }
 
-HyperEdge * LookupTableFSM::LookupUnknownRule(int index, const Sentence & sent, const HieroHeadLabels & syms, HieroNodeMap & node_map) const {
+HyperEdge * LookupTableFSM::LookupUnknownRule(int index, const Sentence & sent, const HieroHeadLabels & syms, HieroNodeMap & node_map, bool save_src_str) const {
     TranslationRuleHiero* unk_rule = GetUnknownRule(sent[index], delete_unknown_? Dict::WID("") : sent[index], syms);
     vector<TailSpanKey> temp_spans;
-    HyperEdge* unk_edge = RuleFSM::TransformRuleIntoEdge(node_map, index, index+1, temp_spans, unk_rule, save_src_str_);
+    HyperEdge* unk_edge = RuleFSM::TransformRuleIntoEdge(node_map, index, index+1, temp_spans, unk_rule, save_src_str);
+    unk_edge->ClearRule();
     delete unk_rule;
     return unk_edge;
 }
@@ -95,14 +99,14 @@ TranslationRuleHiero* LookupTableFSM::GetUnknownRule(WordId src, WordId unknown_
     );
 }
 
-LookupTableFSM * LookupTableFSM::ReadFromFiles(const std::vector<std::string> & filenames) {
+LookupTableFSM * LookupTableFSM::ReadFromFiles(const std::vector<std::string> & filenames, const std::set<WordId> * vocab) {
     LookupTableFSM * ret = new LookupTableFSM;
     BOOST_FOREACH(const std::string & filename, filenames) {
         InputFileStream tm_in(filename.c_str());
         cerr << "Reading TM file from "<<filename<<"..." << endl;
         if(!tm_in)
             THROW_ERROR("Could not find TM: " << filename);
-        ret->AddRuleFSM(RuleFSM::ReadFromRuleTable(tm_in));
+        ret->AddRuleFSM(RuleFSM::ReadFromRuleTable(tm_in, vocab));
     }
     return ret;
 }
@@ -114,12 +118,6 @@ void LookupTableFSM::SetSpanLimits(const std::vector<int>& limits) {
         rule_fsms_[i]->SetSpanLimit(limits[i]);
 }
 
-void LookupTableFSM::SetSaveSrcStr(const bool save_src_str) {
-    save_src_str_ = save_src_str;
-    BOOST_FOREACH(RuleFSM* rfsm, rule_fsms_) 
-        rfsm->SetSaveSrcStr(save_src_str);
-}
-
 
 ///////////////////////////////////
 ///     LOOK UP NODE FSM         //
@@ -170,138 +168,139 @@ LookupNodeFSM::~LookupNodeFSM() {
     }
 }
 
+namespace {
+
+// Order the nodes over a span by their labels
+struct LabelLess {
+    LabelLess(const HieroNodeMap & node_map) : node_map_(node_map) { }
+    bool operator()(const HieroNodeMap::SpanNodes::value_type & a, const HieroNodeMap::SpanNodes::value_type & b) const {
+        return node_map_.GetLabels(a.first) < node_map_.GetLabels(b.first);
+    }
+    const HieroNodeMap & node_map_;
+};
+
+}
+
 HyperGraph * LookupTableFSM::TransformGraph(const HyperGraph & graph) const {
-    int VALID_NODE = 9999999; 
+    return TransformGraph(graph, save_src_str_);
+}
+
+HyperGraph * LookupTableFSM::TransformGraph(const HyperGraph & graph, bool save_src_str) const {
     HyperGraph* ret = new HyperGraph;
     Sentence sent = graph.GetWords();
     ret->SetWords(sent);
+    int N = sent.size();
 
     HieroRuleSpans span = HieroRuleSpans();
-    HieroNodeMap node_map = HieroNodeMap();
+    HieroNodeMap node_map(N);
     EdgeList edge_list = EdgeList(); 
 
+    // The trie positions reached by each grammar
+    vector<RuleFSMCursors> cursors;
+    BOOST_FOREACH(RuleFSM* rule_fsm, rule_fsms_)
+        cursors.push_back(RuleFSMCursors(rule_fsm->GetTrie()));
+
     // For each starting point
-    for(int i = sent.size()-1; i >= 0; i--) {
+    for(int i = N-1; i >= 0; i--) {
         if (unk_symbol_ != empty_symbol_) {
             // Add a size 0 node for unknown words
             RuleFSM::FindNode(node_map, i, i+1, unk_symbol_);
         }
         // For each grammar, add rules
-        BOOST_FOREACH(RuleFSM* rule_fsm, rule_fsms_)
-            rule_fsm->BuildHyperGraphComponent(node_map, edge_list, sent, "", i, span);
+        for(int j = 0; j < (int)rule_fsms_.size(); j++) {
+            if(chart_match_)
+                rule_fsms_[j]->BuildChartComponent(node_map, edge_list, sent, i, cursors[j], save_src_str);
+            else
+                rule_fsms_[j]->BuildHyperGraphComponent(node_map, edge_list, sent, "", i, span, save_src_str);
+        }
     }
+    CountStat(COUNT_LOOKUP_HITS, edge_list.size());
 
     // Add rules for unknown words
-    BOOST_FOREACH(HieroNodeMap::value_type & val, node_map) {
-        BOOST_FOREACH(HeadNodePairs::value_type & head_node, val.second) {
-            HyperNode* node = head_node.second;
-            HieroHeadLabels node_label = head_node.first;
-            pair<int,int> node_span = node->GetSpan();
-            // -unk_symbol is the empty string, 
-            // we add unk rule to all symbol
-            // OR if -unk_symbol is not the empty string we add unk rule only to SPECIFIED symbol. 
-            if (unk_symbol_ == empty_symbol_ || unk_symbol_ == node_label) {
-                // Unknown spanning [x, x+1]
-                if (node_span.second - node_span.first == 1) {
-                    if(node->GetEdges().size() == 0) {
-                        HyperEdge * unk_edge = LookupUnknownRule(node_span.first, sent, head_node.first, node_map);
-                        edge_list.push_back(unk_edge);
-                    } 
-                }
+    // -unk_symbol is the empty string, 
+    // we add unk rule to all symbol
+    // OR if -unk_symbol is not the empty string we add unk rule only to SPECIFIED symbol. 
+    int unk_id = (unk_symbol_ == empty_symbol_ ? -1 : node_map.GetLabelId(unk_symbol_));
+    for(int i = 0; i < N; i++) {
+        BOOST_FOREACH(const HieroNodeMap::SpanNodes::value_type & label_node, node_map.GetNodes(i, i+1)) {
+            if ((unk_id == -1 || unk_id == label_node.first) && label_node.second->GetEdges().size() == 0) {
+                HyperEdge * unk_edge = LookupUnknownRule(i, sent, node_map.GetLabels(label_node.first), node_map, save_src_str);
+                edge_list.push_back(unk_edge);
+                CountStat(COUNT_LOOKUP_MISSES);
             }
         }
     }
 
     // Find the root node
-    HyperNode * root_node = NULL;
-    HieroNodeMap::iterator big_span_node = node_map.find(make_pair(0,(int)sent.size()));
-    if(big_span_node != node_map.end()) {
-        HieroHeadLabels root_sym = GetRootSymbol();
-        BOOST_FOREACH(HeadNodePairs::value_type & hnp, big_span_node->second) {
-            if(hnp.first == root_sym) {
-                root_node = hnp.second;
-                break;
-            }
-        }
-    }
+    HyperNode * root_node = (N > 0 ? node_map.GetNode(0, N, node_map.GetLabelId(GetRootSymbol())) : NULL);
 
     // If the node is not found, delete and return an empty graph
+    const vector<HyperNode*> & nodes = node_map.GetAllNodes();
     if(root_node == NULL) {
         // cerr << "Could not find Span "<<Dict::WSym(GetRootSymbol()[0])<<"[0,"<<sent.size()<<"]"<<endl;
         BOOST_FOREACH (HyperEdge* edges, edge_list) 
             if(edges)
                 delete edges;
-        BOOST_FOREACH(HieroNodeMap::value_type nodes, node_map)
-            BOOST_FOREACH(HeadNodePairs::value_type & hnp, nodes.second)
-                delete hnp.second;
+        BOOST_FOREACH(HyperNode * node, nodes)
+            delete node;
         return new HyperGraph;
-    } else {
-        // Deleting nodes that are unreachable from root node
-        // First traverse the root node
-        vector<HyperNode*> stack;
-        stack.push_back(root_node);
-        while (!stack.empty()) {
-            HyperNode* now = stack.back();
-            stack.pop_back();
-            if (now->GetId() != VALID_NODE) {
-                now->SetId(VALID_NODE); 
-                BOOST_FOREACH(HyperEdge* edge, now->GetEdges()) {
-                    edge->SetId(VALID_NODE);
-                    BOOST_FOREACH(HyperNode* node, edge->GetTails()) {
-                        stack.push_back(node);
-                    }
+    }
+
+    // Mark the nodes that are reachable from the root node, using the node
+    // IDs set by the node map
+    vector<char> reachable(nodes.size(), 0);
+    vector<HyperNode*> stack(1, root_node);
+    reachable[root_node->GetId()] = 1;
+    while (!stack.empty()) {
+        HyperNode* now = stack.back();
+        stack.pop_back();
+        BOOST_FOREACH(HyperEdge* edge, now->GetEdges()) {
+            BOOST_FOREACH(HyperNode* node, edge->GetTails()) {
+                if(!reachable[node->GetId()]) {
+                    reachable[node->GetId()] = 1;
+                    stack.push_back(node);
                 }
             }
         }
-        // Delete the edges that are unreachable from root
-        EdgeList::iterator it = edge_list.begin();
-        while(it != edge_list.end()) {
-            if ((*it)->GetId() != VALID_NODE) {
-                delete *it;
-                it = edge_list.erase(it);
-            } else {
-                ++it;
-            }
-        }
-
-        // // Delete the nodes that are unreachable from root
-        // HieroNodeMap::iterator itr = node_map.begin();
-        // while(itr != node_map.end()) {
-        //     if (itr->second->GetId() != 0) {
-        //         node_map.erase(itr++);
-        //     } else {
-        //         ++itr;
-        //     }
-        // }
     }
-
-    // Add the root node
-    if (root_node != NULL) {
-        root_node->SetId(-1);
-        ret->AddNode(root_node);
+    // Delete the edges that are unreachable from root, which are exactly
+    // those with unreachable heads
+    size_t num_edges = 0;
+    BOOST_FOREACH(HyperEdge* edge, edge_list) {
+        if(edge == NULL)
+            THROW_ERROR("All edges here should be valid, but found 1 with invalid.");
+        if(reachable[edge->GetHead()->GetId()])
+            edge_list[num_edges++] = edge;
+        else
+            delete edge;
     }
+    edge_list.resize(num_edges);
 
-    // Add the rest of the nodes
-    BOOST_FOREACH (HieroNodeMap::value_type nodes, node_map) {
-        BOOST_FOREACH(HeadNodePairs::value_type & head_node, nodes.second) {
-            if(head_node.second->GetId() == VALID_NODE) {
-                head_node.second->SetId(-1);
-                ret->AddNode(head_node.second);
-            } else if (head_node.second != root_node) {
-                delete head_node.second;
+    // Add the root node, and then the rest of the nodes ordered by their
+    // span and labels, and delete the unreachable ones
+    root_node->SetId(-1);
+    ret->AddNode(root_node);
+    for(int i = 0; i < N; i++) {
+        for(int j = i+1; j <= N; j++) {
+            HieroNodeMap::SpanNodes span_nodes = node_map.GetNodes(i, j);
+            sort(span_nodes.begin(), span_nodes.end(), LabelLess(node_map));
+            BOOST_FOREACH(const HieroNodeMap::SpanNodes::value_type & label_node, span_nodes) {
+                HyperNode * node = label_node.second;
+                if(node != root_node && reachable[node->GetId()]) {
+                    node->SetId(-1);
+                    ret->AddNode(node);
+                }
             }
         }
     }
+    for(size_t i = 0; i < nodes.size(); i++)
+        if(!reachable[i])
+            delete nodes[i];
     
     BOOST_FOREACH (HyperEdge* edges, edge_list) { 
-        if(edges) {
-            edges->SetId(-1);
-            ret->AddEdge(edges);
-        } else {
-            THROW_ERROR("All edges here should be valid, but found 1 with invalid.");
-        }
+        edges->SetId(-1);
+        ret->AddEdge(edges);
     }
 
     return ret;
 }
-
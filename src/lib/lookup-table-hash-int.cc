@@ -0,0 +1,123 @@
+#include <travatar/translation-rule.h>
+#include <travatar/lookup-table-hash-int.h>
+#include <travatar/dict.h>
+#include <travatar/hyper-graph.h>
+#include <travatar/input-file-stream.h>
+#include <travatar/global-debug.h>
+#include <travatar/string-util.h>
+#include <boost/foreach.hpp>
+#include <cstdlib>
+
+using namespace travatar;
+using namespace std;
+using namespace boost;
+
+LookupTableHashInt::~LookupTableHashInt() {
+    BOOST_FOREACH(vector<TranslationRule*> & rules, rules_)
+        BOOST_FOREACH(TranslationRule * rule, rules)
+            delete rule;
+};
+
+// Match the start of an edge
+LookupState * LookupTableHashInt::MatchStart(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const {
+    return MatchState(MakeToken(TOKEN_START, node.GetSym()), state, pool);
+}
+
+// Match the end of an edge
+LookupState * LookupTableHashInt::MatchEnd(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const {
+    return MatchState(MakeToken(TOKEN_END, 0), state, pool);
+}
+
+// Match a single node
+LookupState * LookupTableHashInt::MatchNode(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const {
+    LookupState * ret = NULL;
+    if(node.IsTerminal()) {
+        ret = MatchState(MakeToken(TOKEN_TERM, node.GetSym()), state, pool);
+    } else {
+        ret = MatchState(MakeToken(TOKEN_NONTERM, node.GetSym(), state.GetNumNonterms()), state, pool);
+        if(ret != NULL)
+            ret->AddNonterm(&node, pool);
+    }
+    return ret;
+}
+
+LookupState * LookupTableHashInt::MatchState(uint64_t token, const LookupState & state, LookupStatePool & pool) const {
+    int curr = static_cast<const LookupStateHashInt &>(state).GetTrieNode();
+    TrieMap::const_iterator it = next_.find(make_pair(curr, token));
+    if(it == next_.end())
+        return NULL;
+    LookupStateHashInt * ret = pool.NewState<LookupStateHashInt>(it->second);
+    ret->SetNonterms(state.GetNontermList());
+    ret->SetFeatures(state.GetFeatures());
+    return ret;
+}
+
+vector<uint64_t> LookupTableHashInt::TokenizeSrc(const std::string & src) {
+    vector<string> words = Tokenize(src, ' ');
+    vector<uint64_t> ret;
+    int nt_count = 0;
+    for(size_t i = 0; i < words.size(); i++) {
+        const string & word = words[i];
+        if(word == ")") {
+            ret.push_back(MakeToken(TOKEN_END, 0));
+        } else if(i+1 < words.size() && words[i+1] == "(") {
+            ret.push_back(MakeToken(TOKEN_START, Dict::WID(word)));
+            i++;
+        } else if(word.size() >= 2 && word[0] == '"' && word[word.size()-1] == '"') {
+            ret.push_back(MakeToken(TOKEN_TERM, Dict::WID(word.substr(1, word.size()-2))));
+        } else if(word.size() >= 4 && word[0] == 'x' && word.find(':') != string::npos) {
+            size_t pos = word.find(':');
+            int nt_id = atoi(word.substr(1, pos-1).c_str());
+            // Non-terminals are only matched in order, as in the string-based tables
+            if(nt_id != nt_count++)
+                THROW_ERROR("Non-terminals out of order in source pattern: " << src);
+            ret.push_back(MakeToken(TOKEN_NONTERM, Dict::WID(word.substr(pos+1)), nt_id));
+        } else {
+            THROW_ERROR("Bad token in source pattern: " << src);
+        }
+    }
+    return ret;
+}
+
+void LookupTableHashInt::AddRule(const std::string & str, TranslationRule * rule) {
+    // Walk down the trie, adding nodes where necessary
+    int curr = 0;
+    BOOST_FOREACH(uint64_t token, TokenizeSrc(str)) {
+        pair<TrieMap::iterator, bool> it = next_.insert(make_pair(make_pair(curr, token), (int)rules_.size()));
+        if(it.second) {
+            rules_.push_back(vector<TranslationRule*>());
+            src_strs_.push_back("");
+        }
+        curr = it.first->second;
+    }
+    rules_[curr].push_back(rule);
+    src_strs_[curr] = str;
+}
+
+LookupTableHashInt * LookupTableHashInt::ReadFromFile(std::string & filename) {
+    InputFileStream tm_in(filename.c_str());
+    cerr << "Reading TM file from "<<filename<<"..." << endl;
+    if(!tm_in)
+        THROW_ERROR("Could not find TM: " << filename);
+    return ReadFromRuleTable(tm_in);
+}
+
+LookupTableHashInt * LookupTableHashInt::ReadFromRuleTable(std::istream & in) {
+    string line;
+    LookupTableHashInt * ret = new LookupTableHashInt;
+    while(getline(in, line)) {
+        vector<string> columns = Tokenize(line, " ||| ");
+        if(columns.size() < 3) { delete ret; THROW_ERROR("Bad line in rule table: " << line); }
+        CfgDataVector trg_data = Dict::ParseAnnotatedVector(columns[1]);
+        SparseVector features = Dict::ParseSparseVector(columns[2]);
+        TranslationRule * rule = new TranslationRule(trg_data, features);
+        try {
+            ret->AddRule(columns[0], rule);
+        } catch(std::runtime_error & e) {
+            delete rule;
+            delete ret;
+            throw;
+        }
+    }
+    return ret;
+}
@@ -19,24 +19,24 @@ LookupTableHash::~LookupTableHash() {
 };
 
 // Match the start of an edge
-LookupState * LookupTableHash::MatchStart(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableHash::MatchStart(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const {
     const std::string & p = state.GetString();
     std::string next = p + (p.size()?" ":"") + Dict::WSym(node.GetSym()) + " (";
-    return MatchState(next, state);
+    return MatchState(next, state, pool);
 }
 
 // Match the end of an edge
-LookupState * LookupTableHash::MatchEnd(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableHash::MatchEnd(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const {
     std::string next = state.GetString() + " )";
-    return MatchState(next, state);
+    return MatchState(next, state, pool);
 }
 
-LookupState * LookupTableHash::MatchState(const std::string & next, const LookupState & state) const {
+LookupState * LookupTableHash::MatchState(const std::string & next, const LookupState & state, LookupStatePool & pool) const {
     if(src_matches.find(next) != src_matches.end()) {
         // std::cerr << "Matching " << next << " --> success!" << std::endl;
-        LookupState * ret = new LookupState;
+        LookupState * ret = pool.NewState<LookupState>();
         ret->SetString(next);
-        ret->SetNonterms(state.GetNonterms());
+        ret->SetNonterms(state.GetNontermList());
         ret->SetFeatures(state.GetFeatures());
         return ret;
     } else {
@@ -80,19 +80,17 @@ LookupTableHash * LookupTableHash::ReadFromRuleTable(std::istream & in) {
 }
 
 // Match a single node
-LookupState * LookupTableHash::MatchNode(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableHash::MatchNode(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const {
     LookupState * ret = NULL;
     if(node.IsTerminal()) {
         string next = state.GetString() + " \"" + Dict::WSym(node.GetSym()) + "\""; 
-        ret = MatchState(next, state);
+        ret = MatchState(next, state, pool);
     } else {
         ostringstream next;
-        next << state.GetString() << " x" << state.GetNonterms().size() << ":" << Dict::WSym(node.GetSym());
-        ret = MatchState(next.str(), state);
-        if(ret != NULL) {
-            ret->GetNonterms().push_back(&node);
-            ret->SetFeatures(state.GetFeatures());
-        }
+        next << state.GetString() << " x" << state.GetNumNonterms() << ":" << Dict::WSym(node.GetSym());
+        ret = MatchState(next.str(), state, pool);
+        if(ret != NULL)
+            ret->AddNonterm(&node, pool);
     }
     return ret;
 }
@@ -5,25 +5,30 @@
 #include <travatar/global-debug.h>
 #include <travatar/string-util.h>
 #include <marisa/marisa.h>
+#include <util/file.hh>
 #include <boost/foreach.hpp>
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <algorithm>
 #include <sstream>
+#include <cstring>
+#include <cstddef>
 
 using namespace travatar;
 using namespace std;
 using namespace boost;
 
 // Match the start of an edge
-LookupState * LookupTableMarisa::MatchStart(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableMarisa::MatchStart(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const {
     const std::string & p = state.GetString();
     std::string next = p + (p.size()?" ":"") + Dict::WSym(node.GetSym()) + " (";
-    return MatchState(next, state);
+    return MatchState(next, state, pool);
 }
 
 // Match the end of an edge
-LookupState * LookupTableMarisa::MatchEnd(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableMarisa::MatchEnd(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const {
     std::string next = state.GetString() + " )";
-    return MatchState(next, state);
+    return MatchState(next, state, pool);
 }
 
 LookupTableMarisa * LookupTableMarisa::ReadFromFile(std::string & filename) {
@@ -73,30 +78,317 @@ LookupTableMarisa * LookupTableMarisa::ReadFromRuleTable(std::istream & in) {
     return ret;
 }
 
+namespace {
+
+// The layout of the binary rule table file. All offsets are in bytes from
+// the start of the file, and the trie is aligned to 8 bytes so that it can
+// be mapped directly by marisa. Version 1 files end the header before the
+// offsets of the source terminal index, and do not contain the index.
+const char kMarisaBinMagic[8] = {'T','R','V','M','R','S','A','2'};
+const char kMarisaBinMagicV1[8] = {'T','R','V','M','R','S','A','1'};
+struct MarisaBinHeader {
+    char magic[8];
+    uint64_t num_syms, sym_offset;
+    uint64_t num_keys, index_offset;
+    uint64_t rule_offset, rule_size;
+    uint64_t trie_offset, trie_size;
+    uint64_t term_index_offset, term_keys_offset, num_term_keys, key_terms_offset;
+};
+const size_t kMarisaBinHeaderV1Size = offsetof(MarisaBinHeader, term_index_offset);
+
+// Helpers for reading and writing fixed-width values
+inline void WriteInt(std::string & buf, int32_t val) {
+    buf.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+inline void WriteDouble(std::string & buf, double val) {
+    buf.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+inline int32_t ReadInt(const char *& ptr) {
+    int32_t val; memcpy(&val, ptr, sizeof(val)); ptr += sizeof(val);
+    return val;
+}
+inline double ReadDouble(const char *& ptr) {
+    double val; memcpy(&val, ptr, sizeof(val)); ptr += sizeof(val);
+    return val;
+}
+inline void PadTo8(std::ostream & out, uint64_t & pos) {
+    while(pos % 8) { out.put(0); pos++; }
+}
+
+// Map a global word ID to an ID local to the binary file
+int32_t LocalId(WordId wid, map<WordId,int32_t> & local_ids, vector<WordId> & syms) {
+    if(wid < 0) return wid;
+    map<WordId,int32_t>::const_iterator it = local_ids.find(wid);
+    if(it != local_ids.end()) return it->second;
+    int32_t id = syms.size();
+    syms.push_back(wid);
+    local_ids.insert(make_pair(wid, id));
+    return id;
+}
+
+// Build an inverted index from the source terminals of the keys in a trie,
+// which are given local IDs, to the keys that contain them
+void IndexTerms(const marisa::Trie & trie, map<WordId,int32_t> & local_ids, vector<WordId> & syms,
+                vector<uint64_t> & term_index, vector<uint32_t> & term_keys, vector<uint32_t> & key_terms) {
+    vector<vector<uint32_t> > postings;
+    vector<int32_t> terms;
+    marisa::Agent agent;
+    key_terms.resize(trie.num_keys());
+    for(size_t i = 0; i < trie.num_keys(); i++) {
+        agent.set_query(i);
+        trie.reverse_lookup(agent);
+        terms.clear();
+        BOOST_FOREACH(const string & tok, Tokenize(string(agent.key().ptr(), agent.key().length())))
+            if(tok.size() >= 2 && tok[0] == '"' && tok[tok.size()-1] == '"')
+                terms.push_back(LocalId(Dict::WID(tok.substr(1, tok.size()-2)), local_ids, syms));
+        sort(terms.begin(), terms.end());
+        terms.erase(unique(terms.begin(), terms.end()), terms.end());
+        key_terms[i] = terms.size();
+        BOOST_FOREACH(int32_t term, terms) {
+            if((int32_t)postings.size() <= term) postings.resize(term+1);
+            postings[term].push_back(i);
+        }
+    }
+    postings.resize(syms.size());
+    term_index.assign(1, 0);
+    term_keys.clear();
+    BOOST_FOREACH(const vector<uint32_t> & keys, postings) {
+        term_keys.insert(term_keys.end(), keys.begin(), keys.end());
+        term_index.push_back(term_keys.size());
+    }
+}
+
+}
+
+void LookupTableMarisa::WriteBinary(std::ostream & out) const {
+    // Encode the rules and collect the symbols that they use
+    map<WordId,int32_t> local_ids;
+    vector<WordId> syms;
+    vector<uint64_t> index(1, 0);
+    string rule_buf;
+    for(size_t i = 0; i < trie_.num_keys(); i++) {
+        const vector<TranslationRule*> & rules = GetRulesForKey(i);
+        WriteInt(rule_buf, rules.size());
+        BOOST_FOREACH(const TranslationRule * rule, rules) {
+            const CfgDataVector & trg = rule->GetTrgData();
+            WriteInt(rule_buf, trg.size());
+            BOOST_FOREACH(const CfgData & data, trg) {
+                WriteInt(rule_buf, LocalId(data.label, local_ids, syms));
+                WriteInt(rule_buf, data.words.size());
+                BOOST_FOREACH(WordId wid, data.words)
+                    WriteInt(rule_buf, LocalId(wid, local_ids, syms));
+                WriteInt(rule_buf, data.syms.size());
+                BOOST_FOREACH(WordId wid, data.syms)
+                    WriteInt(rule_buf, LocalId(wid, local_ids, syms));
+            }
+            WriteInt(rule_buf, rule->GetFeatures().size());
+            BOOST_FOREACH(const SparsePair & feat, rule->GetFeatures().GetImpl()) {
+                WriteInt(rule_buf, LocalId(feat.first, local_ids, syms));
+                WriteDouble(rule_buf, feat.second);
+            }
+        }
+        index.push_back(rule_buf.size());
+    }
+    vector<uint64_t> term_index;
+    vector<uint32_t> term_keys, key_terms;
+    IndexTerms(trie_, local_ids, syms, term_index, term_keys, key_terms);
+    string sym_buf;
+    BOOST_FOREACH(WordId wid, syms) {
+        sym_buf += Dict::WSym(wid);
+        sym_buf += '\0';
+    }
+    // Calculate the layout and write
+    MarisaBinHeader header;
+    memcpy(header.magic, kMarisaBinMagic, sizeof(header.magic));
+    header.num_syms = syms.size();
+    header.sym_offset = sizeof(MarisaBinHeader);
+    header.num_keys = trie_.num_keys();
+    header.index_offset = (header.sym_offset + sym_buf.size() + 7) / 8 * 8;
+    header.rule_offset = header.index_offset + index.size() * sizeof(uint64_t);
+    header.rule_size = rule_buf.size();
+    header.term_index_offset = (header.rule_offset + rule_buf.size() + 7) / 8 * 8;
+    header.term_keys_offset = header.term_index_offset + term_index.size() * sizeof(uint64_t);
+    header.num_term_keys = term_keys.size();
+    header.key_terms_offset = header.term_keys_offset + term_keys.size() * sizeof(uint32_t);
+    header.trie_offset = (header.key_terms_offset + key_terms.size() * sizeof(uint32_t) + 7) / 8 * 8;
+    header.trie_size = trie_.io_size();
+    uint64_t pos = 0;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header)); pos += sizeof(header);
+    out.write(sym_buf.c_str(), sym_buf.size()); pos += sym_buf.size();
+    PadTo8(out, pos);
+    out.write(reinterpret_cast<const char*>(&index[0]), index.size() * sizeof(uint64_t)); pos += index.size() * sizeof(uint64_t);
+    out.write(rule_buf.c_str(), rule_buf.size()); pos += rule_buf.size();
+    PadTo8(out, pos);
+    out.write(reinterpret_cast<const char*>(&term_index[0]), term_index.size() * sizeof(uint64_t)); pos += term_index.size() * sizeof(uint64_t);
+    if(term_keys.size())
+        out.write(reinterpret_cast<const char*>(&term_keys[0]), term_keys.size() * sizeof(uint32_t));
+    pos += term_keys.size() * sizeof(uint32_t);
+    if(key_terms.size())
+        out.write(reinterpret_cast<const char*>(&key_terms[0]), key_terms.size() * sizeof(uint32_t));
+    pos += key_terms.size() * sizeof(uint32_t);
+    PadTo8(out, pos);
+    marisa::write(out, trie_);
+    if(!out)
+        THROW_ERROR("Failed when writing the binary rule table");
+}
+
+LookupTableMarisa * LookupTableMarisa::ReadFromBinaryFile(const std::string & filename, util::LoadMethod load) {
+    cerr << "Reading binary TM file from "<<filename<<"..." << endl;
+    LookupTableMarisa * ret = new LookupTableMarisa;
+    MarisaBinHeader header;
+    try {
+        util::scoped_fd fd(util::OpenReadOrThrow(filename.c_str()));
+        uint64_t file_size = util::SizeOrThrow(fd.get());
+        if(file_size < sizeof(header)) { delete ret; THROW_ERROR("Binary TM is too short: " << filename); }
+        util::MapRead(load, fd.get(), 0, file_size, ret->memory_);
+    } catch(util::Exception & e) {
+        delete ret;
+        THROW_ERROR("Could not load binary TM: " << filename << endl << e.what());
+    }
+    const char * base = ret->memory_.begin();
+    size_t file_size = ret->memory_.size();
+    memcpy(&header, base, sizeof(header));
+    bool has_terms = !memcmp(header.magic, kMarisaBinMagic, sizeof(header.magic));
+    bool is_v1 = !memcmp(header.magic, kMarisaBinMagicV1, sizeof(header.magic));
+    if(is_v1)
+        memset(reinterpret_cast<char*>(&header) + kMarisaBinHeaderV1Size, 0, sizeof(header) - kMarisaBinHeaderV1Size);
+    if((!has_terms && !is_v1) ||
+       (has_terms && header.key_terms_offset + header.num_keys * sizeof(uint32_t) > header.trie_offset) ||
+       header.trie_offset + header.trie_size > file_size) {
+        delete ret;
+        THROW_ERROR("Bad or truncated binary TM: " << filename);
+    }
+    // Map the symbols to IDs in the current dictionary
+    ret->sym_ids_.resize(header.num_syms);
+    const char * sym_ptr = base + header.sym_offset;
+    for(size_t i = 0; i < header.num_syms; i++) {
+        size_t len = strlen(sym_ptr);
+        ret->sym_ids_[i] = Dict::WID(string(sym_ptr, len));
+        sym_ptr += len + 1;
+    }
+    // The rules themselves are decoded on demand
+    ret->rule_index_ = reinterpret_cast<const uint64_t*>(base + header.index_offset);
+    ret->rule_blob_ = base + header.rule_offset;
+    ret->rules_.resize(header.num_keys);
+    ret->decoded_.resize(header.num_keys, 0);
+    // So is the index of source terminals, if the file has one
+    if(has_terms) {
+        ret->term_syms_ = ret->sym_ids_;
+        ret->term_index_ = reinterpret_cast<const uint64_t*>(base + header.term_index_offset);
+        ret->term_keys_ = reinterpret_cast<const uint32_t*>(base + header.term_keys_offset);
+        ret->key_terms_ = reinterpret_cast<const uint32_t*>(base + header.key_terms_offset);
+    }
+    ret->GetTrie().map(base + header.trie_offset, header.trie_size);
+    return ret;
+}
+
+LookupTableMarisa * LookupTableMarisa::Filter(const std::set<WordId> & vocab) {
+    if(term_index_ == NULL) {
+        map<WordId,int32_t> local_ids;
+        IndexTerms(trie_, local_ids, term_syms_, term_index_buf_, term_keys_buf_, key_terms_buf_);
+        term_index_ = &term_index_buf_[0];
+        term_keys_ = (term_keys_buf_.size() ? &term_keys_buf_[0] : NULL);
+        key_terms_ = (key_terms_buf_.size() ? &key_terms_buf_[0] : NULL);
+    }
+    // Find the index slot of each symbol by binary search
+    vector<pair<WordId,uint32_t> > slots(term_syms_.size());
+    for(size_t i = 0; i < term_syms_.size(); i++)
+        slots[i] = make_pair(term_syms_[i], (uint32_t)i);
+    sort(slots.begin(), slots.end());
+    // Count the terminals of each key that are in the vocabulary, following
+    // only the index entries of the words in the vocabulary
+    size_t num_keys = trie_.num_keys();
+    vector<uint32_t> found(num_keys, 0);
+    BOOST_FOREACH(WordId wid, vocab) {
+        vector<pair<WordId,uint32_t> >::const_iterator it =
+            lower_bound(slots.begin(), slots.end(), make_pair(wid, (uint32_t)0));
+        if(it == slots.end() || it->first != wid) continue;
+        for(uint64_t j = term_index_[it->second]; j < term_index_[it->second+1]; j++)
+            found[term_keys_[j]]++;
+    }
+    // Build a trie of the keys where all terminals were found, and copy their rules
+    marisa::Keyset keyset;
+    vector<size_t> kept;
+    marisa::Agent agent;
+    for(size_t i = 0; i < num_keys; i++) {
+        if(found[i] != key_terms_[i]) continue;
+        agent.set_query(i);
+        trie_.reverse_lookup(agent);
+        keyset.push_back(agent.key().ptr(), agent.key().length());
+        kept.push_back(i);
+    }
+    LookupTableMarisa * ret = new LookupTableMarisa;
+    ret->trie_.build(keyset);
+    ret->rules_.resize(keyset.size());
+    for(size_t i = 0; i < keyset.size(); i++)
+        BOOST_FOREACH(const TranslationRule * rule, GetRulesForKey(kept[i]))
+            ret->rules_[keyset[i].id()].push_back(new TranslationRule(*rule));
+    cerr << "Filtered TM to " << keyset.size() << " of " << num_keys << " sources" << endl;
+    return ret;
+}
+
+const vector<TranslationRule*> & LookupTableMarisa::GetRulesForKey(size_t id) const {
+    if(rule_blob_ == NULL) return rules_[id];
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mutex_);
+        if(decoded_[id]) return rules_[id];
+    }
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+    if(decoded_[id]) return rules_[id];
+    const char * ptr = rule_blob_ + rule_index_[id];
+    vector<TranslationRule*> & rules = rules_[id];
+    rules.resize(ReadInt(ptr));
+    BOOST_FOREACH(TranslationRule * & rule, rules) {
+        CfgDataVector trg(ReadInt(ptr));
+        BOOST_FOREACH(CfgData & data, trg) {
+            int32_t label = ReadInt(ptr);
+            data.label = (label < 0 ? label : sym_ids_[label]);
+            data.words.resize(ReadInt(ptr));
+            BOOST_FOREACH(WordId & wid, data.words) {
+                wid = ReadInt(ptr);
+                if(wid >= 0) wid = sym_ids_[wid];
+            }
+            data.syms.resize(ReadInt(ptr));
+            BOOST_FOREACH(WordId & wid, data.syms) {
+                wid = ReadInt(ptr);
+                if(wid >= 0) wid = sym_ids_[wid];
+            }
+        }
+        vector<SparsePair> feats(ReadInt(ptr));
+        BOOST_FOREACH(SparsePair & feat, feats) {
+            feat.first = sym_ids_[ReadInt(ptr)];
+            feat.second = ReadDouble(ptr);
+        }
+        rule = new TranslationRule(trg, SparseVector(feats));
+    }
+    decoded_[id] = 1;
+    return rules;
+}
+
 // Match a single node
-LookupState * LookupTableMarisa::MatchNode(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableMarisa::MatchNode(const HyperNode & node, const LookupState & state, LookupStatePool & pool) const {
     LookupState * ret = NULL;
     if(node.IsTerminal()) {
         string next = state.GetString() + " \"" + Dict::WSym(node.GetSym()) + "\""; 
-        ret = MatchState(next, state);
+        ret = MatchState(next, state, pool);
     } else {
         ostringstream next;
-        next << state.GetString() << " x" << state.GetNonterms().size() << ":" << Dict::WSym(node.GetSym());
-        ret = MatchState(next.str(), state);
+        next << state.GetString() << " x" << state.GetNumNonterms() << ":" << Dict::WSym(node.GetSym());
+        ret = MatchState(next.str(), state, pool);
         if(ret != NULL)
-            ret->GetNonterms().push_back(&node);
+            ret->AddNonterm(&node, pool);
     }
     return ret;
 }
 
-LookupState * LookupTableMarisa::MatchState(const string & next, const LookupState & state) const {
+LookupState * LookupTableMarisa::MatchState(const string & next, const LookupState & state, LookupStatePool & pool) const {
     marisa::Agent agent;
     agent.set_query(next.c_str());
     if(trie_.predictive_search(agent)) {
         // cerr << "Matching " << next << " --> success!" << endl;
-        LookupState * ret = new LookupState;
+        LookupState * ret = pool.NewState<LookupState>();
         ret->SetString(next);
-        ret->SetNonterms(state.GetNonterms());
+        ret->SetNonterms(state.GetNontermList());
         ret->SetFeatures(state.GetFeatures());
         return ret;
     } else {
@@ -110,12 +402,14 @@ const vector<TranslationRule*> * LookupTableMarisa::FindRules(const LookupState
     marisa::Agent agent;
     const char* query = state.GetString().c_str();
     agent.set_query(query);
-    const vector<TranslationRule*> * ret = trie_.lookup(agent) ? &rules_[agent.key().id()] : NULL;
+    const vector<TranslationRule*> * ret = trie_.lookup(agent) ? &GetRulesForKey(agent.key().id()) : NULL;
     return ret;
 }
 
 
 LookupTableMarisa::~LookupTableMarisa() {
+    // Release the trie before the file that it may be mapped from
+    trie_.clear();
     BOOST_FOREACH(std::vector<TranslationRule*> & vec, rules_)
         BOOST_FOREACH(TranslationRule * rule, vec)
             delete rule;
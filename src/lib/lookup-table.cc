@@ -4,7 +4,9 @@
 #include <travatar/dict.h>
 #include <travatar/hyper-graph.h>
 #include <travatar/global-debug.h>
+#include <travatar/decoder-stats.h>
 #include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <queue>
 
 using namespace travatar;
@@ -17,27 +19,68 @@ LookupTable::LookupTable() :
 
 LookupTable::~LookupTable() { }
 
+vector<const HyperNode*> LookupState::GetNonterms() const {
+    vector<const HyperNode*> ret(GetNumNonterms());
+    for(const NontermList * link = nonterms_; link != NULL; link = link->prev)
+        ret[link->size-1] = link->node;
+    return ret;
+}
+
+void LookupState::AddNonterm(const HyperNode * node, LookupStatePool & pool) {
+    nonterms_ = pool.NewNonterm(node, nonterms_);
+}
+
+LookupStatePool::~LookupStatePool() {
+    BOOST_FOREACH(LookupState * state, states_)
+        state->~LookupState();
+    BOOST_FOREACH(char * block, blocks_)
+        delete [] block;
+}
+
+void * LookupStatePool::Allocate(size_t size) {
+    // Keep everything aligned for doubles and pointers
+    size = (size + 15) & ~(size_t)15;
+    if(size > BLOCK_SIZE)
+        THROW_ERROR("Allocation of " << size << " bytes is too large for LookupStatePool");
+    if(pos_ + size > BLOCK_SIZE) {
+        blocks_.push_back(new char[BLOCK_SIZE]);
+        pos_ = 0;
+    }
+    void * ret = blocks_.back() + pos_;
+    pos_ += size;
+    return ret;
+}
+
+const NontermList * LookupStatePool::NewNonterm(const HyperNode * node, const NontermList * prev) {
+    NontermList * ret = static_cast<NontermList*>(Allocate(sizeof(NontermList)));
+    ret->node = node;
+    ret->prev = prev;
+    ret->size = (prev ? prev->size : 0) + 1;
+    return ret;
+}
+
 // Find all the translation rules rooted at a particular node in a parse graph
-vector<boost::shared_ptr<LookupState> > LookupTable::LookupSrc(
+vector<LookupState*> LookupTable::LookupSrc(
             const HyperNode & node, 
-            const vector<boost::shared_ptr<LookupState> > & old_states) const {
-    vector<boost::shared_ptr<LookupState> > ret_states;
-    BOOST_FOREACH(const boost::shared_ptr<LookupState> & state, old_states) {
+            const vector<LookupState*> & old_states,
+            LookupStatePool & pool) const {
+    vector<LookupState*> ret_states;
+    BOOST_FOREACH(const LookupState * state, old_states) {
         // Match the current node
-        boost::shared_ptr<LookupState> my_state(MatchNode(node, *state));
+        LookupState * my_state = MatchNode(node, *state, pool);
         if(my_state != NULL) ret_states.push_back(my_state);
         // Match all rules the require descent into the next node
-        boost::shared_ptr<LookupState> start_state(MatchStart(node, *state));
+        LookupState * start_state = MatchStart(node, *state, pool);
         if(start_state == NULL) continue;
         // Cycle through all the edges from this node
         BOOST_FOREACH(const HyperEdge * edge, node.GetEdges()) {
-            vector<boost::shared_ptr<LookupState> > my_states(1, start_state);
+            vector<LookupState*> my_states(1, start_state);
             // Cycle through all the tails in this edge
             BOOST_FOREACH(const HyperNode * child, edge->GetTails())
-                my_states = LookupSrc(*child, my_states);
+                my_states = LookupSrc(*child, my_states, pool);
             // Finish all the states found
-            BOOST_FOREACH(const boost::shared_ptr<LookupState> & my_state, my_states) {
-                boost::shared_ptr<LookupState> fin_state(MatchEnd(node, *my_state));
+            BOOST_FOREACH(const LookupState * my_state, my_states) {
+                LookupState * fin_state = MatchEnd(node, *my_state, pool);
                 if(fin_state != NULL) {
                     fin_state->AddFeatures(edge->GetFeatures());
                     ret_states.push_back(fin_state);
@@ -50,31 +93,36 @@ vector<boost::shared_ptr<LookupState> > LookupTable::LookupSrc(
 }
 
 HyperGraph * LookupTable::TransformGraph(const HyperGraph & parse) const {
+    return TransformGraph(parse, save_src_str_);
+}
+
+HyperGraph * LookupTable::TransformGraph(const HyperGraph & parse, bool save_src_str) const {
     if (consider_trg_) {
-        return TransformGraphSrcTrg(parse);
+        return TransformGraphSrcTrg(parse, save_src_str);
     } else {
-        return TransformGraphSrc(parse);
+        return TransformGraphSrc(parse, save_src_str);
     }
 }
 
-HyperGraph * LookupTable::TransformGraphSrc(const HyperGraph & parse) const {
+HyperGraph * LookupTable::TransformGraphSrc(const HyperGraph & parse, bool save_src_str) const {
     // First, for each non-terminal in the input graph, make a node in the output graph
     // and lookup the rules matching each node
     HyperGraph * ret = new HyperGraph;
     ret->SetWords(parse.GetWords());
     std::map<int,int> node_map, rev_node_map;
-    vector<vector<boost::shared_ptr<LookupState> > > lookups;
-    vector<boost::shared_ptr<LookupState> > init_state;
-    init_state.push_back(boost::shared_ptr<LookupState>(GetInitialState()));
+    LookupStatePool pool;
+    vector<vector<LookupState*> > lookups;
+    boost::scoped_ptr<LookupState> init(GetInitialState());
+    vector<LookupState*> init_state(1, init.get());
     BOOST_FOREACH(const HyperNode * node, parse.GetNodes()) {
         if(!node->IsTerminal()) {
             rev_node_map.insert(make_pair(node_map.size(), node->GetId()));
             node_map.insert(make_pair(node->GetId(), node_map.size()));
-            HyperNode * next_node = new HyperNode();
+            HyperNode * next_node = ret->NewNode();
             ret->AddNode(next_node);
             next_node->SetSym(node->GetSym());
             next_node->SetSpan(node->GetSpan());
-            lookups.push_back(LookupSrc(*node, init_state));
+            lookups.push_back(LookupSrc(*node, init_state, pool));
         }
     }
     // For each node
@@ -83,29 +131,33 @@ HyperGraph * LookupTable::TransformGraphSrc(const HyperGraph & parse) const {
         int my_size = lookups[next_node->GetId()].size();
         if(my_size > 0) {
             // For each matched portion of the source tree
-            BOOST_FOREACH(const boost::shared_ptr<LookupState> & state, lookups[next_node->GetId()]) {
+            BOOST_FOREACH(const LookupState * state, lookups[next_node->GetId()]) {
                 // For each tail in the 
-                vector<HyperNode*> next_tails;
-                BOOST_FOREACH(const HyperNode * tail, state->GetNonterms())
-                    next_tails.push_back(ret->GetNode(node_map[tail->GetId()]));
+                vector<HyperNode*> next_tails(state->GetNumNonterms());
+                for(const NontermList * link = state->GetNontermList(); link != NULL; link = link->prev)
+                    next_tails[link->size-1] = ret->GetNode(node_map[link->node->GetId()]);
                 // For each rule
-                BOOST_FOREACH(const TranslationRule * rule, *FindRules(*state)) {
-                    HyperEdge * next_edge = new HyperEdge(next_node);
+                const vector<TranslationRule*> * rules = FindRules(*state);
+                CountStat(COUNT_LOOKUP_HITS, rules->size());
+                BOOST_FOREACH(const TranslationRule * rule, *rules) {
+                    HyperEdge * next_edge = ret->NewEdge(next_node);
                     next_edge->SetTails(next_tails);
                     next_edge->SetRule(rule, state->GetFeatures());
-                    if(save_src_str_) next_edge->SetSrcStr(state->GetString());
+                    if(save_src_str) next_edge->SetSrcStr(GetSrcString(*state));
                     next_node->AddEdge(next_edge);
                     ret->AddEdge(next_edge);
                 }
             }
         }
         // For unmatched nodes, add an unknown rule for every edge in the parse
+        if(my_size == 0)
+            CountStat(COUNT_LOOKUP_MISSES);
         if(my_size == 0 || match_all_unk_) {
             const HyperNode * parse_node = parse.GetNode(rev_node_map[next_node->GetId()]);
             BOOST_FOREACH(const HyperEdge * parse_edge, parse_node->GetEdges()) {
                 ostringstream oss;
-                if(save_src_str_) oss << Dict::WSym(parse_node->GetSym()) << " (";
-                HyperEdge * next_edge = new HyperEdge(next_node);
+                if(save_src_str) oss << Dict::WSym(parse_node->GetSym()) << " (";
+                HyperEdge * next_edge = ret->NewEdge(next_node);
                 BOOST_FOREACH(const HyperNode * parse_node, parse_edge->GetTails())
                     if(!parse_node->IsTerminal())
                         next_edge->AddTail(ret->GetNode(node_map[parse_node->GetId()]));
@@ -114,7 +166,7 @@ HyperGraph * LookupTable::TransformGraphSrc(const HyperGraph & parse) const {
                     vector<int> trg(next_edge->GetTails().size());
                     for(int i = 0; i < (int)trg.size(); i++) {
                         trg[i] = -1 - i;
-                        if(save_src_str_) oss << " x" << i << ':' << Dict::WSym(next_edge->GetTail(i)->GetSym());
+                        if(save_src_str) oss << " x" << i << ':' << Dict::WSym(next_edge->GetTail(i)->GetSym());
                     }
                     next_edge->SetTrgData(CfgDataVector(GlobalVars::trg_factors, trg));
                 } else {
@@ -122,11 +174,11 @@ HyperGraph * LookupTable::TransformGraphSrc(const HyperGraph & parse) const {
                     if(span.second - span.first != 1)
                         THROW_ERROR("Multi-terminal edges are not supported.");
                     vector<WordId> trg_words(1, parse.GetWord(span.first));
-                    if(save_src_str_) oss << " \"" << Dict::WSym(parse.GetWord(span.first)) << '"';
+                    if(save_src_str) oss << " \"" << Dict::WSym(parse.GetWord(span.first)) << '"';
                     next_edge->SetTrgData(CfgDataVector(GlobalVars::trg_factors, trg_words));
                 }
                 next_node->AddEdge(next_edge);
-                if(save_src_str_) {
+                if(save_src_str) {
                     oss << " )";
                     next_edge->SetSrcStr(oss.str());
                 }
@@ -137,7 +189,7 @@ HyperGraph * LookupTable::TransformGraphSrc(const HyperGraph & parse) const {
     return ret;
 }
 
-HyperGraph * LookupTable::TransformGraphSrcTrg(const HyperGraph & parse) const {
+HyperGraph * LookupTable::TransformGraphSrcTrg(const HyperGraph & parse, bool save_src_str) const {
     typedef map<vector<WordId>, HyperNode*> TargetMap;
     typedef map<int, TargetMap> NodeMap;
     typedef map<int, HyperNode*> GeneralMap;
@@ -146,12 +198,13 @@ HyperGraph * LookupTable::TransformGraphSrcTrg(const HyperGraph & parse) const {
     HyperGraph * ret = new HyperGraph;
     ret->SetWords(parse.GetWords());
     
+    LookupStatePool pool;
     priority_queue<SpannedState,vector<SpannedState>,SpannedStateComparator> lookups;
-    vector<boost::shared_ptr<LookupState> > init_state;
-    init_state.push_back(boost::shared_ptr<LookupState>(GetInitialState()));
+    boost::scoped_ptr<LookupState> init(GetInitialState());
+    vector<LookupState*> init_state(1, init.get());
     BOOST_REVERSE_FOREACH(const HyperNode * node, parse.GetNodes()) {
         if(!node->IsTerminal()) {
-            lookups.push(make_pair(LookupSrc(*node, init_state),node));
+            lookups.push(make_pair(LookupSrc(*node, init_state, pool),node));
         } 
     }
 
@@ -165,9 +218,11 @@ HyperGraph * LookupTable::TransformGraphSrcTrg(const HyperGraph & parse) const {
         const HyperNode* input_node = spanned_state.second;
         // Expand This state
         TargetMap indexed_head;
-        BOOST_FOREACH (const boost::shared_ptr<LookupState> & state, spanned_state.first) {
+        BOOST_FOREACH (const LookupState * state, spanned_state.first) {
             std::vector<const HyperNode*> non_terms = state->GetNonterms();
-            BOOST_FOREACH (const TranslationRule * rule, *FindRules(*state)) {
+            const vector<TranslationRule*> * rules = FindRules(*state);
+            CountStat(COUNT_LOOKUP_HITS, rules->size());
+            BOOST_FOREACH (const TranslationRule * rule, *rules) {
                 CfgDataVector trg_data = rule->GetTrgData();
                 // head of this rule
                 vector<WordId> heads(trg_data.size(),0);
@@ -217,7 +272,7 @@ HyperGraph * LookupTable::TransformGraphSrcTrg(const HyperGraph & parse) const {
                     SparseVector feat = state->GetFeatures();
                     if (penalty > 0) feat.Add(Dict::WID("unmatch_trg"), penalty);
                     next_edge->SetRule(rule, feat);
-                    if (save_src_str_) next_edge->SetSrcStr(state->GetString());
+                    if (save_src_str) next_edge->SetSrcStr(GetSrcString(*state));
                     head_node->AddEdge(next_edge);
                     ret->AddEdge(next_edge);
                     indexed_head.insert(make_pair(heads, head_node));
@@ -238,17 +293,19 @@ HyperGraph * LookupTable::TransformGraphSrcTrg(const HyperGraph & parse) const {
             HyperEdge* connecting_edge = new HyperEdge(parse_node);
             ostringstream oss;
             vector<WordId> trg_words(1, -1);
-            if (save_src_str_) oss << Dict::WSym(input_node->GetSym()) << " ( x0:" << Dict::WSym(parse_node->GetSym()) << " )";
+            if (save_src_str) oss << Dict::WSym(input_node->GetSym()) << " ( x0:" << Dict::WSym(parse_node->GetSym()) << " )";
             CfgDataVector trg_data(GlobalVars::trg_factors, trg_words);
             connecting_edge->AddTail(val.second);
             connecting_edge->SetTrgData(trg_data);
-            if (save_src_str_) connecting_edge->SetSrcStr(oss.str());
+            if (save_src_str) connecting_edge->SetSrcStr(oss.str());
             parse_node->AddEdge(connecting_edge);
             ret->AddEdge(connecting_edge);
         }
         // Whether or not, connecting the parse node to its child 
         // according to input tree
         // it we match all unk, connect the parse state regardlessly
+        if (indexed_head.size() == (size_t) 0)
+            CountStat(COUNT_LOOKUP_MISSES);
         if (indexed_head.size() == (size_t) 0 || match_all_unk_) {
             // Adding the tail to other parse state
             if (input_node->IsPreTerminal()) {
@@ -256,22 +313,22 @@ HyperGraph * LookupTable::TransformGraphSrcTrg(const HyperGraph & parse) const {
                 HyperEdge* idem = new HyperEdge(parse_node);
                 WordId word = parse.GetWord(input_node->GetSpan().first);
                 ostringstream oss;
-                if (save_src_str_) oss << Dict::WSym(input_node->GetSym()) << " ( \"" << Dict::WSym(word) << "\" )";
+                if (save_src_str) oss << Dict::WSym(input_node->GetSym()) << " ( \"" << Dict::WSym(word) << "\" )";
                 vector<WordId> trg_words(1, word);
                 CfgDataVector trg_data(GlobalVars::trg_factors, trg_words);
                 idem->SetRule(GetUnknownRule(), input_node->GetEdge(0)->GetFeatures());
                 idem->SetTrgData(trg_data);
-                if (save_src_str_) idem->SetSrcStr(oss.str());
+                if (save_src_str) idem->SetSrcStr(oss.str());
                 parse_node->AddEdge(idem);
                 ret->AddEdge(idem);
             } else {
                 BOOST_FOREACH(HyperEdge* edge, input_node->GetEdges()) {
                     HyperEdge * parse_edge = new HyperEdge(parse_node);
                     ostringstream oss;
-                    if (save_src_str_) oss << Dict::WSym(input_node->GetSym()) << " ("; 
+                    if (save_src_str) oss << Dict::WSym(input_node->GetSym()) << " ("; 
                     vector<WordId> trg(edge->GetTails().size());
                     for (size_t i=0; i < trg.size(); ++i) {
-                        if(save_src_str_) oss << " x" << i << ':' << Dict::WSym(edge->GetTail(i)->GetSym()); 
+                        if(save_src_str) oss << " x" << i << ':' << Dict::WSym(edge->GetTail(i)->GetSym()); 
                         trg[i] = -1 - i;
                     }
                     parse_edge->SetRule(GetUnknownRule(), edge->GetFeatures());
@@ -280,7 +337,7 @@ HyperGraph * LookupTable::TransformGraphSrcTrg(const HyperGraph & parse) const {
                         HyperNode* child = general_map.find(tail->GetId())->second;
                         parse_edge->AddTail(child);
                     }
-                    if (save_src_str_) {
+                    if (save_src_str) {
                         oss << " )";
                         parse_edge->SetSrcStr(oss.str());
                     }
@@ -1,33 +1,114 @@
 #include<travatar/output-collector.h>
+#include<travatar/global-debug.h>
+#include<boost/bind.hpp>
 
 using namespace travatar;
 using namespace std;
 using namespace boost;
 
-void OutputCollector::Write(int id, const string & out, const string & err) { 
-    typedef map<int,pair<string,string> > TraceMap;
-    boost::mutex::scoped_lock lock(mutex_);
-    if(id == next_) {
-        *out_stream_ << out;
-        *err_stream_ << err;
-        TraceMap::iterator it;
-        for(++next_; (it = saved_.find(next_)) != saved_.end(); ++next_) {
-            *out_stream_ << it->second.first;
-            *err_stream_ << it->second.second;
-            saved_.erase(it);
+OutputCollector::OutputCollector(ostream* out_stream, ostream* err_stream, bool buffer, int capacity) :
+            slots_(capacity), next_(0), out_stream_(out_stream), err_stream_(err_stream),
+            buffer_(buffer), writer_waiting_(false), writes_waiting_(0),
+            flush_requested_(false), stopped_(false) {
+    if(capacity <= 0)
+        THROW_ERROR("OutputCollector capacity must be positive, but got " << capacity);
+    for(int i = 0; i < capacity; i++)
+        slots_[i].id = -1;
+    writer_ = boost::thread(boost::bind(&OutputCollector::Run, this));
+}
+
+OutputCollector::~OutputCollector() {
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopped_ = true;
+        writer_needed_.notify_all();
+    }
+    writer_.join();
+    out_stream_->flush();
+    err_stream_->flush();
+}
+
+void OutputCollector::Run() {
+    int size = slots_.size();
+    while(true) {
+        // Write out the run of consecutive finished sentences
+        int next = next_, written = 0;
+        while(written < size && IsReady(next)) {
+            Slot & slot = slots_[next % size];
+            string out, err;
+            out.swap(slot.out);
+            err.swap(slot.err);
+            // Free the slot before advancing, so it can be reused
+            slot.id = -1;
+            next_ = ++next;
+            if(!out.empty()) out_stream_->write(out.data(), out.size());
+            if(!err.empty()) err_stream_->write(err.data(), err.size());
+            written++;
         }
-        if(!buffer_) {
+        if(written > 0) {
+            if(!buffer_) {
+                out_stream_->flush();
+                err_stream_->flush();
+            }
+            if(writes_waiting_ > 0) {
+                boost::mutex::scoped_lock lock(mutex_);
+                space_available_.notify_all();
+            }
+            continue;
+        }
+        // Nothing is ready, so wait for the next sentence
+        boost::mutex::scoped_lock lock(mutex_);
+        writer_waiting_ = true;
+        while(!IsReady(next_) && !flush_requested_ && !stopped_)
+            writer_needed_.wait(lock);
+        writer_waiting_ = false;
+        if(IsReady(next_))
+            continue;
+        if(flush_requested_) {
             out_stream_->flush();
             err_stream_->flush();
+            flush_requested_ = false;
+            space_available_.notify_all();
         }
-    } else {
-        saved_[id] = pair<string,string>(out,err);
+        if(stopped_)
+            break;
+    }
+}
+
+void OutputCollector::Write(int id, string out, string err) {
+    int size = slots_.size();
+    // Wait until the slot is free
+    if(id - next_ >= size) {
+        boost::mutex::scoped_lock lock(mutex_);
+        writes_waiting_++;
+        while(id - next_ >= size)
+            space_available_.wait(lock);
+        writes_waiting_--;
+    }
+    Slot & slot = slots_[id % size];
+    slot.out.swap(out);
+    slot.err.swap(err);
+    slot.id = id;
+    if(writer_waiting_) {
+        boost::mutex::scoped_lock lock(mutex_);
+        writer_needed_.notify_one();
     }
 }
 
 void OutputCollector::Flush() {
-    out_stream_->flush();
-    err_stream_->flush();
+    boost::mutex::scoped_lock lock(mutex_);
+    flush_requested_ = true;
+    writer_needed_.notify_all();
+    while(flush_requested_)
+        space_available_.wait(lock);
+}
+
+void OutputCollector::WaitUntilWritten(int num) {
+    boost::mutex::scoped_lock lock(mutex_);
+    writes_waiting_++;
+    while(next_ < num)
+        space_available_.wait(lock);
+    writes_waiting_--;
 }
 
 void OutputCollector::Skip(int id) {
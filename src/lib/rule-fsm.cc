@@ -6,12 +6,25 @@
 #include <travatar/lookup-table-cfglm.h>
 #include <travatar/hyper-graph.h>
 #include <boost/foreach.hpp>
+#include <algorithm>
 
 using namespace travatar;
 using namespace std;
 using namespace boost;
 
-RuleFSM * RuleFSM::ReadFromRuleTable(istream & in) {
+namespace {
+
+// Whether all of the terminals in a rule source are in the vocabulary
+bool InVocabulary(const vector<WordId> & words, const std::set<WordId> & vocab) {
+    BOOST_FOREACH(WordId wid, words)
+        if(wid >= 0 && vocab.find(wid) == vocab.end())
+            return false;
+    return true;
+}
+
+}
+
+RuleFSM * RuleFSM::ReadFromRuleTable(istream & in, const std::set<WordId> * vocab) {
     string line;
     RuleFSM * ret = new RuleFSM;
     UnaryMap & unaries = ret->unaries_;
@@ -24,6 +37,8 @@ RuleFSM * RuleFSM::ReadFromRuleTable(istream & in) {
         if(columns.size() < 3)
             THROW_ERROR("Wrong number of columns in rule table, expected at least 3 but got "<<columns.size()<<": " << endl << line);
         CfgData src_data = Dict::ParseAnnotatedWords(columns[0]);
+        if(vocab != NULL && !InVocabulary(src_data.words, *vocab))
+            continue;
         if(!src_data.NontermsAreOrdered())
             THROW_ERROR("Nonterminal IDs on the source side must be in ascending order, but are not at line: " << endl << line);
         vector<CfgData> trg_data = Dict::ParseAnnotatedVector(columns[1]);
@@ -64,7 +79,7 @@ RuleFSM * RuleFSM::ReadFromRuleTable(istream & in) {
                 UnaryMap::iterator it = unaries.find(target);
                 if(it != unaries.end()) {
                     BOOST_FOREACH(const HieroHeadLabels & second_trg, it->second) {
-                        set<HieroHeadLabels>::iterator it2 = val.second.find(target);
+                        set<HieroHeadLabels>::iterator it2 = val.second.find(second_trg);
                         if(it2 == val.second.end()) {
                             added = true;
                             val.second.insert(second_trg);
@@ -98,7 +113,8 @@ void RuleFSM::BuildHyperGraphComponent(
         const Sentence & input,
         const string & state,
         int position, 
-        HieroRuleSpans & spans) const {
+        HieroRuleSpans & spans,
+        bool save_src_str) const {
     if (position >= (int)input.size())
         return;
 
@@ -120,11 +136,11 @@ void RuleFSM::BuildHyperGraphComponent(
         if(trie_.lookup(agent_exact)) {
             BOOST_FOREACH(TranslationRuleHiero* rule, rules_[agent_exact.key().id()]) {
                 // cerr << "Matched word for "<<PrintState(next_state)<<" == "<<PrintState(string(agent_exact.key().ptr(), agent_exact.key().length()))<<": " << *rule << endl;
-                edge_list.push_back(RuleFSM::TransformRuleIntoEdge(rule, rule_span_next, node_map, save_src_str_));
+                edge_list.push_back(RuleFSM::TransformRuleIntoEdge(rule, rule_span_next, node_map, save_src_str));
             }
         }
         // Recurse to match the following rules
-        BuildHyperGraphComponent(node_map, edge_list, input, next_state, position+1, rule_span_next);
+        BuildHyperGraphComponent(node_map, edge_list, input, next_state, position+1, rule_span_next, save_src_str);
     }
 
     // Continue until the end of the sentence or the max span length
@@ -138,26 +154,22 @@ void RuleFSM::BuildHyperGraphComponent(
             do {
                 last_size = next_set.size();
                 BOOST_FOREACH(const UnaryMap::value_type & val, unaries_) {
-                    HieroNodeMap::iterator it = node_map.find(span);
-                    if(it != node_map.end()) {
-                        if(it->second.find(val.first) != it->second.end()) {
-                            BOOST_FOREACH(HieroHeadLabels child_lab, val.second) {
-                                next_set.insert(child_lab);
-                                RuleFSM::FindNode(node_map, position, next_pos, child_lab);
-                            }
+                    if(node_map.GetNode(position, next_pos, node_map.GetLabelId(val.first)) != NULL) {
+                        BOOST_FOREACH(HieroHeadLabels child_lab, val.second) {
+                            next_set.insert(child_lab);
+                            RuleFSM::FindNode(node_map, position, next_pos, child_lab);
                         }
                     }
                 }
             } while(last_size != (int)next_set.size());
         }
         // Find nodes that match the current span
-        HieroNodeMap::iterator node_it = node_map.find(span);
-        if(node_it == node_map.end()) continue;
+        const HieroNodeMap::SpanNodes & span_nodes = node_map.GetNodes(position, next_pos);
         // Build every node
         HieroRuleSpans rule_span_next = HieroRuleSpans(spans);
         rule_span_next.push_back(span);
-        BOOST_FOREACH(const HeadNodePairs::value_type & heads_node, node_it->second) {
-            vector<WordId> sym(heads_node.first);
+        for(size_t k = 0; k < span_nodes.size(); k++) {
+            vector<WordId> sym(node_map.GetLabels(span_nodes[k].first));
             BOOST_FOREACH(WordId & wid, sym)
                 wid = -1-wid;
             string next_state = state;
@@ -178,17 +190,139 @@ void RuleFSM::BuildHyperGraphComponent(
                 if(trie_.lookup(agent_exact)) {
                     BOOST_FOREACH(TranslationRuleHiero* rule, rules_[agent_exact.key().id()]) {
                         // cerr << "Matched nonterm: " << *rule << endl;
-                        edge_list.push_back(RuleFSM::TransformRuleIntoEdge(rule, rule_span_next, node_map, save_src_str_));
+                        edge_list.push_back(RuleFSM::TransformRuleIntoEdge(rule, rule_span_next, node_map, save_src_str));
                     }
                 }
                 // Recurse to match the next node
-                BuildHyperGraphComponent(node_map, edge_list, input, next_state, next_pos, rule_span_next);
+                BuildHyperGraphComponent(node_map, edge_list, input, next_state, next_pos, rule_span_next, save_src_str);
             }
         }
     }
 
 }
 
+int RuleFSMCursors::Next(int cursor, WordId sym) {
+    pair<int,WordId> key(cursor, sym);
+    boost::unordered_map<pair<int,WordId>, int>::const_iterator it = next_.find(key);
+    if(it != next_.end())
+        return it->second;
+    string next_key = keys_[cursor];
+    next_key.append((const char*)&sym, sizeof(WordId));
+    marisa::Agent agent;
+    agent.set_query(next_key.c_str(), next_key.length());
+    int ret = -1;
+    if(trie_->predictive_search(agent)) {
+        // If a key exactly matches the prefix, it is the first one found
+        ret = keys_.size();
+        key_ids_.push_back(agent.key().length() == next_key.length() ? (int)agent.key().id() : -1);
+        keys_.push_back(next_key);
+    }
+    next_.insert(make_pair(key, ret));
+    return ret;
+}
+
+namespace {
+
+// A partially matched rule, which is a cursor in the trie, and the span of
+// the last symbol that was matched
+struct HieroChartItem {
+    HieroChartItem(int c, int p, const pair<int,int> & s) : cursor(c), prev(p), span(s) { }
+    int cursor;
+    // The item that this one extends, or -1 for the empty rule
+    int prev;
+    pair<int,int> span;
+};
+
+}
+
+void RuleFSM::BuildChartComponent(
+        HieroNodeMap & node_map,
+        EdgeList & edge_list,
+        const Sentence & input,
+        int start,
+        RuleFSMCursors & cursors,
+        bool save_src_str) const {
+    int n = input.size();
+    if (start >= n)
+        return;
+    // The items, and the IDs of the items ending at each position
+    vector<HieroChartItem> items;
+    vector<vector<int> > active(n - start + 1);
+    items.push_back(HieroChartItem(RuleFSMCursors::GetRoot(), -1, make_pair(start, start)));
+    active[0].push_back(0);
+    HieroRuleSpans rule_span;
+    typedef pair<int,pair<int,int> > CursorSpan;
+    vector<CursorSpan> nexts;
+    int until = min(n, start+span_length_);
+    for(int end = start; end <= n; end++) {
+        // Once all the nodes over [start,end) are built, add the parents of
+        // their unary rules and start rules with each of them
+        pair<int,int> first_span(start, end);
+        bool first = (end > start && end <= until);
+        if(first) {
+            const HieroNodeMap::SpanNodes & span_nodes = node_map.GetNodes(start, end);
+            for(size_t k = 0, size = span_nodes.size(); k < size; k++) {
+                UnaryMap::const_iterator uit = unaries_.find(node_map.GetLabels(span_nodes[k].first));
+                if(uit != unaries_.end()) {
+                    BOOST_FOREACH(const HieroHeadLabels & parent, uit->second)
+                        RuleFSM::FindNode(node_map, start, end, parent);
+                }
+            }
+        }
+        // First start rules with the nodes over [start,end), then extend each
+        // item ending here with a word or a node
+        for(int pos = -1; pos < (int)active[end-start].size(); pos++) {
+            nexts.clear();
+            int prev;
+            if(pos == -1) {
+                if(!first) continue;
+                prev = 0;
+                BOOST_FOREACH(const HieroNodeMap::SpanNodes::value_type & label_node, node_map.GetNodes(start, end)) {
+                    const HieroHeadLabels & labels = node_map.GetLabels(label_node.first);
+                    int cursor = RuleFSMCursors::GetRoot();
+                    for(size_t j = 0; cursor >= 0 && j < labels.size(); j++)
+                        cursor = cursors.Next(cursor, -1-labels[j]);
+                    if(cursor >= 0) nexts.push_back(make_pair(cursor, first_span));
+                }
+            } else {
+                prev = active[end-start][pos];
+                int item_cursor = items[prev].cursor;
+                if(end < n) {
+                    int cursor = cursors.Next(item_cursor, input[end]);
+                    if(cursor >= 0) nexts.push_back(make_pair(cursor, make_pair(end, end+1)));
+                }
+                // Nodes that start the rule are added above once they are built
+                if(prev != 0) {
+                    int next_until = min(n, end+span_length_);
+                    for(int next_end = end+1; next_end <= next_until; next_end++) {
+                        BOOST_FOREACH(const HieroNodeMap::SpanNodes::value_type & label_node, node_map.GetNodes(end, next_end)) {
+                            const HieroHeadLabels & labels = node_map.GetLabels(label_node.first);
+                            int cursor = item_cursor;
+                            for(size_t j = 0; cursor >= 0 && j < labels.size(); j++)
+                                cursor = cursors.Next(cursor, -1-labels[j]);
+                            if(cursor >= 0) nexts.push_back(make_pair(cursor, make_pair(end, next_end)));
+                        }
+                    }
+                }
+            }
+            BOOST_FOREACH(const CursorSpan & next, nexts) {
+                int id = items.size();
+                items.push_back(HieroChartItem(next.first, prev, next.second));
+                active[next.second.second-start].push_back(id);
+                // If this exactly matched a rule, add the rules
+                int key_id = cursors.GetKeyId(next.first);
+                if(key_id < 0) continue;
+                rule_span.clear();
+                for(int i = id; i > 0; i = items[i].prev)
+                    rule_span.push_back(items[i].span);
+                reverse(rule_span.begin(), rule_span.end());
+                BOOST_FOREACH(TranslationRuleHiero* rule, rules_[key_id])
+                    edge_list.push_back(RuleFSM::TransformRuleIntoEdge(rule, rule_span, node_map, save_src_str));
+            }
+        }
+    }
+}
+
 HyperEdge* RuleFSM::TransformRuleIntoEdge(TranslationRuleHiero* rule, const HieroRuleSpans & rule_span,
     HieroNodeMap & node_map, const bool save_src_str)
 {
@@ -241,31 +375,40 @@ HyperEdge* RuleFSM::TransformRuleIntoEdge(HieroNodeMap& node_map,
 HyperNode* RuleFSM::FindNode(HieroNodeMap& map_ptr, 
         const int span_begin, const int span_end, const HieroHeadLabels& head_label)
 {
-    if (span_begin < 0 || span_end < 0) 
-        THROW_ERROR("Invalid span range in constructing HyperGraph.");
-    pair<int,int> span = make_pair(span_begin,span_end);
+    return map_ptr.FindNode(span_begin, span_end, head_label);
+}
 
-    HieroNodeMap::iterator it = map_ptr.find(span);
-    if (it == map_ptr.end()) {
-        // Fresh New Node!
-        HyperNode* ret = new HyperNode;
-        ret->SetSpan(make_pair(span_begin,span_end));
-        ret->SetSym(head_label[0]);
-        map_ptr[span][head_label] = ret;
-        // cerr << "Adding node! " << span.first << ":" << span.second << ", " << head_label << endl;
-        return ret;
-    } else {
-        HeadNodePairs::iterator it2 = it->second.find(head_label);
-        if (it2 == it->second.end()) {
-            // Fresh New Node!
-            HyperNode* ret = new HyperNode;
-            ret->SetSpan(make_pair(span_begin,span_end));
-            ret->SetSym(head_label[0]);
-            map_ptr[span][head_label] = ret;
-            // cerr << "Adding node! " << span.first << ":" << span.second << ", " << head_label << endl;
-            return ret;
-        } else {
-            return it2->second;
-        }
-    }
+int HieroNodeMap::GetLabelId(const HieroHeadLabels & labels) {
+    boost::unordered_map<HieroHeadLabels, int>::const_iterator it = label_ids_.find(labels);
+    if(it != label_ids_.end())
+        return it->second;
+    int id = labels_.size();
+    label_ids_.insert(make_pair(labels, id));
+    labels_.push_back(labels);
+    return id;
+}
+
+HyperNode * HieroNodeMap::GetNode(int begin, int end, int label_id) const {
+    BOOST_FOREACH(const SpanNodes::value_type & label_node, spans_[GetSpanId(begin, end)])
+        if(label_node.first == label_id)
+            return label_node.second;
+    return NULL;
+}
+
+HyperNode * HieroNodeMap::FindNode(int begin, int end, const HieroHeadLabels & labels) {
+    if (begin < 0 || end <= begin || end > length_)
+        THROW_ERROR("Invalid span range in constructing HyperGraph.");
+    int label_id = GetLabelId(labels);
+    SpanNodes & span_nodes = spans_[GetSpanId(begin, end)];
+    BOOST_FOREACH(const SpanNodes::value_type & label_node, span_nodes)
+        if(label_node.first == label_id)
+            return label_node.second;
+    // Fresh New Node!
+    HyperNode* ret = new HyperNode;
+    ret->SetSpan(make_pair(begin,end));
+    ret->SetSym(labels[0]);
+    ret->SetId(nodes_.size());
+    span_nodes.push_back(make_pair(label_id, ret));
+    nodes_.push_back(ret);
+    return ret;
 }
@@ -124,7 +124,7 @@ SparseVector::SparseVector(const std::vector<SparsePair> & vec) : impl_(vec) {
     SparseVectorImpl::iterator itl = impl_.begin(), itr = impl_.begin()+1;
     while(itr != impl_.end()) {
         if(itl->first == itr->first) {
-            itl->second += itr->first;
+            itl->second += itr->second;
         } else {
             itl++;
             *itl = *itr;
@@ -366,6 +366,39 @@ SparseMap operator-(const SparseMap & lhs, const SparseVector & rhs) {
     return ret;
 }
 
+DenseWeights::DenseWeights(const SparseMap & weights) {
+    int max_id = -1;
+    BOOST_FOREACH(const SparsePair & val, weights)
+        if(val.second != 0)
+            max_id = max(max_id, val.first);
+    weights_.resize(max_id+1, 0.0);
+    BOOST_FOREACH(const SparsePair & val, weights)
+        if(val.second != 0)
+            weights_[val.first] = val.second;
+}
+
+Real DenseWeights::Dot(const SparseVector & feats) const {
+    const SparseVector::SparseVectorImpl & impl = feats.GetImpl();
+    size_t n = impl.size(), i = 0;
+    // Use several independent sums so the gathers can be overlapped
+    Real sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+    for( ; i + 4 <= n; i += 4) {
+        sum0 += Get(impl[i].first) * impl[i].second;
+        sum1 += Get(impl[i+1].first) * impl[i+1].second;
+        sum2 += Get(impl[i+2].first) * impl[i+2].second;
+        sum3 += Get(impl[i+3].first) * impl[i+3].second;
+    }
+    for( ; i < n; i++)
+        sum0 += Get(impl[i].first) * impl[i].second;
+    return (sum0 + sum1) + (sum2 + sum3);
+}
+
+void DenseWeights::Dot(const std::vector<const SparseVector*> & feats, std::vector<Real> & scores) const {
+    scores.resize(feats.size());
+    for(size_t i = 0; i < feats.size(); i++)
+        scores[i] = Dot(*feats[i]);
+}
+
 SparseMap SparseVector::ToMap() {
     SparseMap ret;
     BOOST_FOREACH(SparsePair val, impl_)
@@ -1,72 +1,171 @@
 #include <travatar/thread-pool.h>
 #include <travatar/global-debug.h>
 #include <travatar/task.h>
+#include <boost/foreach.hpp>
+#include <algorithm>
 
 using namespace travatar;
 using namespace std;
 using namespace boost;
 
+namespace {
+// Order tasks so the most expensive ones come first
+struct TaskCostMore {
+    bool operator()(const Task* a, const Task* b) const {
+        return a->GetCost() > b->GetCost();
+    }
+};
+}
+
 ThreadPool::ThreadPool(int num_threads, int queue_limit) :
-        stopped_(false), stopping_(false), delete_tasks_(true),
-        queue_limit_(queue_limit) {
+        pending_(0), running_(0), idle_(0), submitters_waiting_(0),
+        stopped_(false), stopping_(false), process_remaining_(true),
+        delete_tasks_(true), queue_limit_(queue_limit),
+        window_(queue_limit > 0 ? queue_limit : max(num_threads, 1)*4),
+        next_queue_(0) {
     for(int i = 0; i < num_threads; i++)
-        threads_.create_thread(bind(&ThreadPool::Run, this));
+        queues_.push_back(boost::shared_ptr<WorkerQueue>(new WorkerQueue));
+    for(int i = 0; i < num_threads; i++)
+        threads_.create_thread(bind(&ThreadPool::Run, this, i));
 }
 
-void ThreadPool::Run() {
-    while(!stopped_) {
-        Task* task = NULL;
-        {
-            boost::mutex::scoped_lock lock(mutex_);
-            if(tasks_.empty() && !stopped_)
-                thread_needed_.wait(lock);
-            if(!stopped_ && !tasks_.empty()) {
-                task = tasks_.front();
-                tasks_.pop();
-            }
+ThreadPool::~ThreadPool() {
+    Stop(true);
+}
+
+Task* ThreadPool::NextTask(int id) {
+    int size = queues_.size();
+    // Look in our own queue first, then try to steal from the others,
+    // starting with our neighbor so the thieves spread out
+    for(int i = 0; i < size; i++) {
+        WorkerQueue & queue = *queues_[(id+i) % size];
+        boost::mutex::scoped_lock lock(queue.mutex);
+        if(!queue.tasks.empty()) {
+            Task* task = queue.tasks.front();
+            queue.tasks.pop_front();
+            return task;
         }
+    }
+    return NULL;
+}
+
+void ThreadPool::NotifySubmitter() {
+    if(submitters_waiting_ > 0) {
+        boost::mutex::scoped_lock lock(submit_mutex_);
+        thread_available_.notify_all();
+    }
+}
+
+void ThreadPool::Run(int id) {
+    while(true) {
+        if(stopped_ && !process_remaining_)
+            break;
+        Task* task = NextTask(id);
         if(task) {
+            // Count the task as running before it leaves the queue count
+            running_++;
+            pending_--;
+            NotifySubmitter();
             task->Run();
             if(delete_tasks_)
                 delete task;
+            running_--;
+            NotifySubmitter();
+            continue;
         }
-        thread_available_.notify_all();
+        // There is no work, so hand out anything waiting in the window, or
+        // sleep until more is dispatched. We count ourselves as idle before
+        // checking the window so the submitter will never leave tasks there
+        // that nobody is going to pick up
+        idle_++;
+        {
+            boost::mutex::scoped_lock lock(window_mutex_);
+            Dispatch();
+        }
+        boost::mutex::scoped_lock lock(idle_mutex_);
+        while(pending_ == 0 && !stopped_)
+            thread_needed_.wait(lock);
+        idle_--;
+        if(pending_ == 0 && stopped_)
+            break;
+    }
+}
+
+void ThreadPool::Dispatch() {
+    if(window_tasks_.empty()) return;
+    stable_sort(window_tasks_.begin(), window_tasks_.end(), TaskCostMore());
+    // Deal the tasks out round-robin, so every worker starts on one of the
+    // most expensive tasks
+    int size = queues_.size();
+    BOOST_FOREACH(Task* task, window_tasks_) {
+        WorkerQueue & queue = *queues_[next_queue_];
+        next_queue_ = (next_queue_+1) % size;
+        boost::mutex::scoped_lock lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+    pending_ += window_tasks_.size();
+    window_tasks_.clear();
+    if(idle_ > 0) {
+        boost::mutex::scoped_lock lock(idle_mutex_);
+        thread_needed_.notify_all();
     }
 }
 
 void ThreadPool::Submit(Task* task) {
-    boost::mutex::scoped_lock lock(mutex_);
     if(stopping_)
         THROW_ERROR("Cannot accept new jobs while ThreadPool is stopping");
-    while(queue_limit_ && (int)tasks_.size() >= queue_limit_)
-        thread_available_.wait(lock);
-    tasks_.push(task);
-    thread_needed_.notify_all();
+    if(queues_.empty())
+        THROW_ERROR("Cannot submit jobs to a ThreadPool with no threads");
+    {
+        boost::mutex::scoped_lock lock(window_mutex_);
+        window_tasks_.push_back(task);
+        // Keep collecting tasks while every thread is busy, but hand them out
+        // immediately if some thread is waiting for work
+        if((int)window_tasks_.size() >= window_ || idle_ > 0)
+            Dispatch();
+    }
+    if(queue_limit_ && pending_ >= queue_limit_) {
+        boost::mutex::scoped_lock lock(submit_mutex_);
+        submitters_waiting_++;
+        while(pending_ >= queue_limit_)
+            thread_available_.wait(lock);
+        submitters_waiting_--;
+    }
 }
 
 void ThreadPool::Wait() {
-    while(!tasks_.empty()) {
-        boost::mutex::scoped_lock lock(mutex_);
-        thread_available_.wait(lock);
+    {
+        boost::mutex::scoped_lock lock(window_mutex_);
+        Dispatch();
     }
-    sleep(1);
+    boost::mutex::scoped_lock lock(submit_mutex_);
+    submitters_waiting_++;
+    while(pending_ > 0 || running_ > 0)
+        thread_available_.wait(lock);
+    submitters_waiting_--;
 }
 
 void ThreadPool::Stop(bool process_remaining) {
-    {
-        boost::mutex::scoped_lock lock(mutex_);
-        if(stopped_) return;
-        stopping_ = true;
-    }
+    if(stopped_) return;
+    stopping_ = true;
     if(process_remaining) {
-        boost::mutex::scoped_lock lock(mutex_);
-        while(!tasks_.empty() && !stopped_)
-            thread_available_.wait(lock);
+        boost::mutex::scoped_lock lock(window_mutex_);
+        Dispatch();
     }
+    process_remaining_ = process_remaining;
     {
-        boost::mutex::scoped_lock lock(mutex_);
+        boost::mutex::scoped_lock lock(idle_mutex_);
         stopped_ = true;
+        thread_needed_.notify_all();
     }
-    thread_needed_.notify_all();
     threads_.join_all();
+    // Anything left over was never run
+    if(delete_tasks_) {
+        BOOST_FOREACH(Task* task, window_tasks_)
+            delete task;
+        BOOST_FOREACH(const boost::shared_ptr<WorkerQueue> & queue, queues_)
+            BOOST_FOREACH(Task* task, queue->tasks)
+                delete task;
+    }
+    window_tasks_.clear();
 }
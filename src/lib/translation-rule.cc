@@ -2,6 +2,8 @@
 #include <travatar/translation-rule.h>
 #include <travatar/sparse-map.h>
 #include <travatar/dict.h>
+#include <travatar/lm-func.h>
+#include <travatar/weights.h>
 
 using namespace std;
 using namespace travatar;
@@ -27,3 +29,59 @@ void TranslationRule::Print(std::ostream & out) const {
     out << "}";
 }
 
+
+namespace {
+void DeleteList(LMRuleData * next) {
+    while(next != NULL) {
+        LMRuleData * curr = next;
+        next = curr->next;
+        delete curr;
+    }
+}
+}
+
+TranslationRule::~TranslationRule() {
+    DeleteList(lm_data_);
+}
+
+TranslationRule & TranslationRule::operator=(const TranslationRule & rhs) {
+    trg_data_ = rhs.trg_data_;
+    features_ = rhs.features_;
+    // The cached data is for the old target side
+    DeleteList(lm_data_.exchange(NULL));
+    score_version_ = -1;
+    return *this;
+}
+
+const LMRuleData * TranslationRule::GetLMRuleData(int lm_id) const {
+    for(const LMRuleData * curr = lm_data_; curr != NULL; curr = curr->next)
+        if(curr->lm_id == lm_id)
+            return curr;
+    return NULL;
+}
+
+const LMRuleData * TranslationRule::CacheLMRuleData(LMRuleData * lm_data) const {
+    lm_data->next = lm_data_;
+    // Push onto the front of the list, unless another thread gets there
+    // first with the same LM
+    while(!lm_data_.compare_exchange_weak(lm_data->next, lm_data)) {
+        for(const LMRuleData * curr = lm_data->next; curr != NULL; curr = curr->next) {
+            if(curr->lm_id == lm_data->lm_id) {
+                delete lm_data;
+                return curr;
+            }
+        }
+    }
+    return lm_data;
+}
+
+Real TranslationRule::GetScore(const Weights & weights) const {
+    // Online tuning is single-threaded, so threads that get here at the same
+    // time are calculating the same value
+    int version = weights.GetVersion();
+    if(score_version_.load(std::memory_order_acquire) != version) {
+        score_.store(weights.GetCurrent() * features_, std::memory_order_relaxed);
+        score_version_.store(version, std::memory_order_release);
+    }
+    return score_.load(std::memory_order_relaxed);
+}
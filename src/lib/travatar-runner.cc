@@ -9,7 +9,9 @@
 #include <travatar/travatar-runner.h>
 #include <travatar/trimmer-nbest.h>
 #include <travatar/lookup-table-hash.h>
+#include <travatar/lookup-table-hash-int.h>
 #include <travatar/lookup-table-marisa.h>
+#include <travatar/load-method.h>
 #include <travatar/lookup-table-fsm.h>
 #include <travatar/lookup-table-cfglm.h>
 #include <travatar/weights.h>
@@ -23,10 +25,21 @@
 #include <travatar/timer.h>
 #include <travatar/input-file-stream.h>
 #include <travatar/config-travatar-runner.h>
+#include <travatar/latency-stats.h>
+#include <travatar/decoder-stats.h>
 #include <lm/model.hh>
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include <boost/iostreams/stream.hpp>
 // #include <boost/algorithm/string.hpp>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <csignal>
+#include <set>
 #include <fstream>
 
 using namespace travatar;
@@ -34,8 +47,7 @@ using namespace std;
 using namespace boost;
 using namespace lm::ngram;
 
-void TravatarRunnerTask::PrintNbestList(const NbestList & nbest_list) {
-    ostringstream nbest_out;
+void TravatarRunnerTask::PrintNbestList(const NbestList & nbest_list, ostream & nbest_out) {
     BOOST_FOREACH(const boost::shared_ptr<HyperPath> & path, nbest_list) {
         nbest_out
             << sent_
@@ -47,13 +59,11 @@ void TravatarRunnerTask::PrintNbestList(const NbestList & nbest_list) {
         }
         nbest_out << endl;
     }
-    nbest_collector_->Write(sent_, nbest_out.str(), "");
 }
 
-void TravatarRunnerTask::PrintBestTrace(const NbestList & nbest_list, const int best_answer) {
+void TravatarRunnerTask::PrintBestTrace(const NbestList & nbest_list, const int best_answer, ostream & trace_out) {
     // if there is some output print the trace
     if (nbest_list.size() != 0) {
-        ostringstream trace_out;
         BOOST_FOREACH(const HyperEdge * edge, nbest_list[best_answer]->GetEdges()) {
             trace_out
                 << sent_
@@ -63,17 +73,12 @@ void TravatarRunnerTask::PrintBestTrace(const NbestList & nbest_list, const int
                 << " ||| " << Dict::PrintSparseVector(edge->GetFeatures())
                 << endl;
         }
-        trace_collector_->Write(sent_, trace_out.str(), "");
-    } else {
-        // Skip this sentence
-        trace_collector_->Skip(sent_);
     }
 }
 
-void TravatarRunnerTask::PrintNbestTrace(const NbestList & nbest_list) {
+void TravatarRunnerTask::PrintNbestTrace(const NbestList & nbest_list, ostream & trace_out) {
     // if there is some output print the trace
     if (nbest_list.size() != 0) {
-        ostringstream trace_out;
         int answer = 0;
         BOOST_FOREACH(const boost::shared_ptr<HyperPath> & path, nbest_list) {
           BOOST_FOREACH(const HyperEdge * edge, path->GetEdges()) {
@@ -88,10 +93,6 @@ void TravatarRunnerTask::PrintNbestTrace(const NbestList & nbest_list) {
           }
           ++answer;
         }
-        trace_collector_->Write(sent_, trace_out.str(), "");
-    } else {
-        // Skip this sentence
-        trace_collector_->Skip(sent_);
     }
 }
 
@@ -108,38 +109,78 @@ void TravatarRunnerTask::PrintForest(boost::shared_ptr<HyperGraph> & rule_graph)
     forest_collector_->Write(sent_, forest_out.str(), "");
 }
 
+void TravatarRunnerTask::SetServerRequest(int nbest, bool trace, LatencyStats * latency, const Timer & received) {
+    server_request_ = true;
+    request_nbest_ = nbest;
+    request_trace_ = trace;
+    latency_ = latency;
+    received_ = received;
+}
+
+int TravatarRunnerTask::GetCost() const {
+    return tree_graph_->GetWords().size();
+}
+
+void TravatarRunnerTask::FinishStats(SentenceStats & stats) {
+    stats.EndStage();
+    stats.Detach();
+    if(runner_->HasDecoderStats())
+        runner_->GetDecoderStats().Add(stats);
+}
+
 void TravatarRunnerTask::Run() {
     typedef boost::shared_ptr<GraphTransformer> GTPtr;
     PRINT_DEBUG("Translating sentence " << sent_ << endl << Dict::PrintWords(tree_graph_->GetWords()) << endl, 1);
+    // The components only count things if statistics are being collected
+    SentenceStats stats(sent_);
+    if(runner_->HasDecoderStats())
+        stats.Attach();
+    stats.Count(COUNT_WORDS, tree_graph_->GetWords().size());
     // { /* DEBUG */ JSONTreeIO io; io.WriteTree(*tree_graph_, cerr); cerr << endl; }
     // Binarizer if necessary
+    stats.StartStage(STAGE_BINARIZE);
     if(runner_->HasBinarizer()) {
         boost::shared_ptr<HyperGraph> bin_graph(runner_->GetBinarizer().TransformGraph(*tree_graph_));
         tree_graph_.swap(bin_graph);
     }
     // { /* DEBUG */ JSONTreeIO io; io.WriteTree(*tree_graph_, cerr); cerr << endl; }
-    boost::shared_ptr<HyperGraph> rule_graph(runner_->GetTM().TransformGraph(*tree_graph_));
-    rule_graph->ScoreEdges(runner_->GetWeights());
+    stats.StartStage(STAGE_RULE_LOOKUP);
+    // The trace of a server request needs the source strings of the rules
+    boost::shared_ptr<HyperGraph> rule_graph(server_request_ && request_trace_ ?
+        runner_->LookupRulesWithSrc(*tree_graph_) :
+        runner_->GetTM().TransformGraph(*tree_graph_));
+    stats.Count(COUNT_RULE_NODES, rule_graph->NumNodes());
+    stats.Count(COUNT_RULE_EDGES, rule_graph->NumEdges());
+    stats.StartStage(STAGE_RULE_SCORE);
+    if(runner_->HasDenseWeights())
+        rule_graph->ScoreEdges(runner_->GetDenseWeights());
+    else
+        rule_graph->ScoreEdges(runner_->GetWeights());
     rule_graph->ResetViterbiScores();
 
     // If we have an lm, score with the LM
     // { /* DEBUG */ JSONTreeIO io; io.WriteTree(*rule_graph, cerr); cerr << endl; }
+    stats.StartStage(STAGE_LM);
     if(runner_->HasLM() && rule_graph->NumNodes() > 0) {
         BOOST_FOREACH(GTPtr lm, runner_->GetLMs()) {
             boost::shared_ptr<HyperGraph> lm_graph(lm->TransformGraph(*rule_graph));
             lm_graph.swap(rule_graph);
         }
+        stats.Count(COUNT_LM_NODES, rule_graph->NumNodes());
+        stats.Count(COUNT_LM_EDGES, rule_graph->NumEdges());
     }
 
     // Calculate the n-best list
+    stats.StartStage(STAGE_NBEST);
     NbestList nbest_list;
     if(rule_graph->NumNodes() > 0) {
         PRINT_DEBUG("SENT " << sent_ << " score: " << rule_graph->GetNode(0)->CalcViterbiScore() << endl, 1);
-        nbest_list = rule_graph->GetNbest(runner_->GetNbestCount(), runner_->GetNbestUniq());
+        nbest_list = rule_graph->GetNbest(max(runner_->GetNbestCount(), request_nbest_), runner_->GetNbestUniq());
     }
 
     // Print the best answer. This will generally be the answer with the highest score
     // but we could also change it with something like MBR
+    stats.StartStage(STAGE_OUTPUT);
     int best_answer = 0;
     ostringstream out;
     if((int)nbest_list.size() > best_answer) {
@@ -147,18 +188,41 @@ void TravatarRunnerTask::Run() {
     }
     out << endl;
 
+    if(server_request_) {
+        // The response to a server request holds everything that was asked
+        // for, and is terminated by an empty line if it is more than one line
+        if(request_nbest_ > 0) {
+            NbestList request_list(nbest_list.begin(), nbest_list.begin() + min((int)nbest_list.size(), request_nbest_));
+            PrintNbestList(request_list, out);
+            if(request_trace_)
+                PrintNbestTrace(request_list, out);
+        } else if(request_trace_) {
+            PrintBestTrace(nbest_list, best_answer, out);
+        }
+        if(request_nbest_ > 0 || request_trace_)
+            out << endl;
+        collector_->Write(sent_, out.str(), "");
+        latency_->Add(received_.get_elapsed_time());
+        FinishStats(stats);
+        return;
+    }
+
     // If we are printing the n-best list, print it
     if(nbest_collector_ != NULL) {
-        PrintNbestList(nbest_list);
+        ostringstream nbest_out;
+        PrintNbestList(nbest_list, nbest_out);
+        nbest_collector_->Write(sent_, nbest_out.str(), "");
     }
 
     // If we are printing a trace, create it
     if(trace_collector_ != NULL) {
+        ostringstream trace_out;
         if(nbest_collector_ != NULL) {
-            PrintNbestTrace(nbest_list);
+            PrintNbestTrace(nbest_list, trace_out);
         } else {
-            PrintBestTrace(nbest_list, best_answer);
+            PrintBestTrace(nbest_list, best_answer, trace_out);
         }
+        trace_collector_->Write(sent_, trace_out.str(), "");
     }
 
     collector_->Write(sent_, out.str(), "");
@@ -169,8 +233,10 @@ void TravatarRunnerTask::Run() {
     }
 
     // If we are tuning load the next references and check the weights
+    stats.StartStage(STAGE_TUNE);
     if(runner_->GetDoTuning())
         runner_->GetWeights().Adjust(tree_graph_->GetWords(), refs_, runner_->GetEvalMeasure(), nbest_list);
+    FinishStats(stats);
 }
 
 
@@ -180,7 +246,10 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
     // Load all the variables
     GlobalVars::debug = config.GetInt("debug");
     GlobalVars::trg_factors = config.GetInt("trg_factors");
+    LMData::SetDefaultLoadMethod(ParseLoadMethod(config.GetString("lm_load")));
     nbest_tree_ = config.GetBool("nbest_tree");
+    string server = config.GetString("server");
+    // Server requests that ask for the trace save the source strings themselves
     bool save_src_str = (config.GetString("trace_out") != "" || nbest_tree_);
     bool consider_trg = config.GetBool("consider_trg");
     nbest_count_ = config.GetInt("nbest");
@@ -213,6 +282,8 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
     } else {
         THROW_ERROR("Invalid value for tune_update: "<<config.GetString("tune_update"));
     }
+    if(server != "" && do_tuning_)
+        THROW_ERROR("Tuning cannot be performed in server mode");
     vector<boost::shared_ptr<istream> > tune_ins;
     // If we need to do tuning
     if(do_tuning_) {
@@ -263,6 +334,8 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
         tree_io = boost::shared_ptr<TreeIO>(new WordTreeIO);
     else
         THROW_ERROR("Bad in_format option " << config.GetString("in_format"));
+    if(server != "" && config.GetString("in_format") == "egret")
+        THROW_ERROR("Server mode requires one input per line, so it cannot be used with in_format=egret");
 
     // Load the language model(s)
     PRINT_DEBUG("Loading language model [" << timer << " sec]" << endl, 1);
@@ -294,20 +367,54 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
     // Load the rule table
     PRINT_DEBUG(endl << "Loading translation model [" << timer << " sec]" << endl, 1);
     vector<string> tm_files = config.GetStringArray("tm_file");
+    scoped_ptr<set<WordId> > tm_vocab;
+    if(config.GetString("tm_filter") != "") {
+        if(config.GetString("tm_storage") == "hash" || config.GetString("tm_storage") == "hash-int")
+            THROW_ERROR("tm_filter cannot be used with tm_storage=" << config.GetString("tm_storage"));
+        // InputFileStream throws if the file cannot be opened
+        scoped_ptr<InputFileStream> filter_in;
+        try {
+            filter_in.reset(new InputFileStream(config.GetString("tm_filter").c_str()));
+        } catch(std::runtime_error &) {
+            THROW_ERROR("Could not find TM filter file: " << config.GetString("tm_filter"));
+        }
+        tm_vocab.reset(new set<WordId>);
+        tree_io->ReadVocabulary(*filter_in, *tm_vocab);
+    }
     if(config.GetString("tm_storage") == "hash") {
         LookupTableHash * hash_tm_ = LookupTableHash::ReadFromFile(tm_files[0]);
         hash_tm_->SetMatchAllUnk(config.GetBool("all_unk"));
         hash_tm_->SetSaveSrcStr(save_src_str);
         hash_tm_->SetConsiderTrg(consider_trg);
         tm_.reset(hash_tm_);
+    } else if(config.GetString("tm_storage") == "hash-int") {
+        LookupTableHashInt * hash_tm_ = LookupTableHashInt::ReadFromFile(tm_files[0]);
+        hash_tm_->SetMatchAllUnk(config.GetBool("all_unk"));
+        hash_tm_->SetSaveSrcStr(save_src_str);
+        hash_tm_->SetConsiderTrg(consider_trg);
+        tm_.reset(hash_tm_);
     } else if(config.GetString("tm_storage") == "marisa") {
         LookupTableMarisa * marisa_tm_ = LookupTableMarisa::ReadFromFile(tm_files[0]);
+        if(tm_vocab.get()) {
+            scoped_ptr<LookupTableMarisa> full_tm(marisa_tm_);
+            marisa_tm_ = full_tm->Filter(*tm_vocab);
+        }
+        marisa_tm_->SetMatchAllUnk(config.GetBool("all_unk"));
+        marisa_tm_->SetSaveSrcStr(save_src_str);
+        marisa_tm_->SetConsiderTrg(consider_trg);
+        tm_.reset(marisa_tm_);
+    } else if(config.GetString("tm_storage") == "marisa-bin") {
+        LookupTableMarisa * marisa_tm_ = LookupTableMarisa::ReadFromBinaryFile(tm_files[0], ParseLoadMethod(config.GetString("tm_load")));
+        if(tm_vocab.get()) {
+            scoped_ptr<LookupTableMarisa> full_tm(marisa_tm_);
+            marisa_tm_ = full_tm->Filter(*tm_vocab);
+        }
         marisa_tm_->SetMatchAllUnk(config.GetBool("all_unk"));
         marisa_tm_->SetSaveSrcStr(save_src_str);
         marisa_tm_->SetConsiderTrg(consider_trg);
         tm_.reset(marisa_tm_);
     }  else if (config.GetString("tm_storage") == "fsm") {
-        LookupTableFSM * fsm_tm_ = LookupTableFSM::ReadFromFiles(tm_files);
+        LookupTableFSM * fsm_tm_ = LookupTableFSM::ReadFromFiles(tm_files, tm_vocab.get());
         fsm_tm_->SetTrgFactors(GlobalVars::trg_factors);
         fsm_tm_->SetDeleteUnknown(config.GetBool("delete_unknown"));
         fsm_tm_->SetRootSymbol(Dict::WID(config.GetString("root_symbol")));
@@ -317,10 +424,11 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
         tm_.reset(fsm_tm_);
     }  else if (config.GetString("tm_storage") == "cfg") {
         if(lm_files.size() > 1 || pop_limits.size() != 1) THROW_ERROR("Cannot use multiple LMs or pop limits with -tm_storage=cfg");
-        LookupTableCFGLM * fsm_tm_ = LookupTableCFGLM::ReadFromFiles(tm_files);
+        LookupTableCFGLM * fsm_tm_ = LookupTableCFGLM::ReadFromFiles(tm_files, tm_vocab.get());
         if(lm_files[0] != "") fsm_tm_->LoadLM(lm_files[0]);
         fsm_tm_->SetPopLimit(pop_limits[0]);
         fsm_tm_->SetChartLimit(config.GetInt("chart_limit"));
+        fsm_tm_->SetRestCost(config.GetBool("rest_cost"));
         fsm_tm_->SetTrgFactors(GlobalVars::trg_factors);
         fsm_tm_->SetRootSymbol(Dict::WID(config.GetString("root_symbol")));
         fsm_tm_->SetUnkSymbol(Dict::WID(config.GetString("unk_symbol")));
@@ -381,8 +489,51 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
         trace_collector.reset(new OutputCollector(trace_out.get(), &cerr, config.GetBool("buffer")));
     }
 
+    // All of the model vocabulary is loaded, so make it lock-free for the
+    // decoding threads
+    Dict::FreezeVocab();
+    if(!do_tuning_)
+        dense_weights_.reset(new DenseWeights(weights_->GetCurrent()));
+
+    // Open the statistics output streams if they exist
+    scoped_ptr<ofstream> stats_out, stats_sent_out;
+    scoped_ptr<OutputCollector> stats_sent_collector;
+    if(config.GetString("stats_out") != "" || config.GetString("stats_sent_out") != "") {
+        decoder_stats_.reset(new DecoderStats);
+        if(config.GetString("stats_out") != "") {
+            stats_out.reset(new ofstream(config.GetString("stats_out").c_str()));
+            if(!*stats_out)
+                THROW_ERROR("Could not open stats_out file: " << config.GetString("stats_out"));
+        }
+        if(config.GetString("stats_sent_out") != "") {
+            if(server != "")
+                THROW_ERROR("Per-sentence statistics cannot be written in server mode");
+            stats_sent_out.reset(new ofstream(config.GetString("stats_sent_out").c_str()));
+            if(!*stats_sent_out)
+                THROW_ERROR("Could not open stats_sent_out file: " << config.GetString("stats_sent_out"));
+            stats_sent_collector.reset(new OutputCollector(stats_sent_out.get(), &cerr, config.GetBool("buffer")));
+            decoder_stats_->SetSentenceCollector(stats_sent_collector.get());
+        }
+    }
+
     // Create the thread pool
     ThreadPool pool(threads_, threads_*5);
+
+    // In server mode, answer requests until they are finished
+    if(server != "") {
+        latency_.reset(new LatencyStats);
+        PRINT_DEBUG("Started server [" << timer << " sec]" << endl, 1);
+        if(server == "stdio")
+            ServeStream(std::cin, std::cout, *tree_io, pool);
+        else if(server.substr(0, 5) == "unix:")
+            ServeSocket(server.substr(5), *tree_io, pool);
+        else
+            THROW_ERROR("Bad server option " << server << " (must be stdio or unix:PATH)");
+        pool.Stop(true);
+        PRINT_DEBUG("Stopped server: " << latency_->GetSummary() << endl, 1);
+        WriteDecoderStats(stats_out.get());
+        return;
+    }
     OutputCollector collector;
     // Process one at a time
     int sent = 0;
@@ -420,6 +571,9 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
         nbest_collector->Flush();
     if (forest_collector.get() != NULL)
         forest_collector->Flush();
+    if (stats_sent_collector.get() != NULL)
+        stats_sent_collector->Flush();
+    WriteDecoderStats(stats_out.get());
 
     // Finished translating
     PRINT_DEBUG(endl << "Done translating [" << timer << " sec]" << endl, 1);
@@ -438,16 +592,182 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
 }
 
 
+void TravatarRunner::WriteDecoderStats(ostream * stats_out) {
+    if(stats_out == NULL)
+        return;
+    decoder_stats_->WriteJSON(*stats_out);
+    stats_out->flush();
+}
+
+bool TravatarRunner::ServeStream(istream & in, ostream & out, TreeIO & tree_io, ThreadPool & pool) {
+    // Responses are sent as soon as they are ready
+    OutputCollector collector(&out, &cerr, false);
+    int id = 0;
+    bool shutdown = false;
+    string line;
+    while(getline(in, line)) {
+        // Latency includes the time that the request waits for a thread
+        Timer received;
+        received.start();
+        if(line.size() && line[line.size()-1] == '\r')
+            line.resize(line.size()-1);
+        // Admin commands
+        if(line == "@quit") {
+            break;
+        } else if(line == "@shutdown") {
+            shutdown = true;
+            break;
+        } else if(line == "@stats") {
+            collector.Write(id++, latency_->GetSummary() + "\n", "");
+            continue;
+        }
+        // Parse the per-request options, of the form "nbest=10 trace=true ||| INPUT"
+        int nbest = 0;
+        bool trace = false;
+        ostringstream error;
+        size_t pos = line.find(" ||| ");
+        if(pos != string::npos) {
+            BOOST_FOREACH(const string & opt, Tokenize(line.substr(0, pos), " ")) {
+                vector<string> kv = Tokenize(opt, "=");
+                if(kv.size() == 2 && kv[0] == "nbest")
+                    nbest = atoi(kv[1].c_str());
+                else if(kv.size() == 2 && kv[0] == "trace")
+                    trace = (kv[1] == "true" || kv[1] == "1");
+                else
+                    error << (error.str() == "" ? "" : "; ") << "Bad request option " << opt;
+            }
+            line = line.substr(pos + 5);
+        }
+        boost::shared_ptr<HyperGraph> tree_graph;
+        if(error.str() == "") {
+            try {
+                tree_graph.reset(tree_io.ReadFromString(line));
+            } catch(std::exception & e) {
+                error << e.what();
+            }
+        }
+        if(error.str() != "") {
+            collector.Write(id++, "@error " + error.str() + "\n", "");
+            continue;
+        }
+        if(tree_graph.get() == NULL)
+            tree_graph.reset(new HyperGraph);
+        TravatarRunnerTask *task = new TravatarRunnerTask(id++, tree_graph, this, vector<Sentence>(), &collector, NULL, NULL, NULL);
+        task->SetServerRequest(nbest, trace, latency_.get(), received);
+        // Requests that arrive while all threads are busy are batched up by
+        // the pool, which starts the longest of them first
+        pool.Submit(task);
+    }
+    collector.WaitUntilWritten(id);
+    return shutdown;
+}
+
+namespace {
+typedef boost::asio::local::stream_protocol::socket Socket;
+typedef boost::asio::local::stream_protocol::acceptor Acceptor;
+typedef boost::iostreams::stream<boost::iostreams::file_descriptor_source> SocketIn;
+typedef boost::iostreams::stream<boost::iostreams::file_descriptor_sink> SocketOut;
+
+// The state shared by the threads of a server
+struct ServerState {
+    ServerState(TravatarRunner * runner, TreeIO * tree_io, ThreadPool * pool)
+        : runner(runner), tree_io(tree_io), pool(pool), acceptor(io_service) { }
+    TravatarRunner * runner;
+    TreeIO * tree_io;
+    ThreadPool * pool;
+    boost::asio::io_service io_service;
+    Acceptor acceptor;
+    // The descriptors of the open connections, so they can be closed on shutdown
+    boost::mutex mutex;
+    boost::condition_variable closed;
+    std::set<int> fds;
+};
+
+// Serve a single connection to the server, and close it when done. Requests
+// are read and responses are written by different threads, so each has its
+// own stream on a copy of the socket's descriptor
+void ServeConnection(ServerState * server, boost::shared_ptr<Socket> socket) {
+    int fd = socket->native_handle();
+    try {
+        SocketIn in(boost::iostreams::file_descriptor_source(::dup(fd), boost::iostreams::close_handle));
+        SocketOut out(boost::iostreams::file_descriptor_sink(::dup(fd), boost::iostreams::close_handle));
+        if(server->runner->ServeStream(in, out, *server->tree_io, *server->pool))
+            server->io_service.stop();
+    } catch(std::exception & e) {
+        cerr << "Error while serving connection: " << e.what() << endl;
+    }
+    boost::mutex::scoped_lock lock(server->mutex);
+    server->fds.erase(fd);
+    socket->close();
+    server->closed.notify_all();
+}
+
+void AcceptConnection(ServerState * server);
+
+// Start serving a new connection, and wait for the next one
+void HandleAccept(ServerState * server, boost::shared_ptr<Socket> socket, const boost::system::error_code & err) {
+    if(err) {
+        cerr << "Error while accepting connection: " << err.message() << endl;
+    } else {
+        boost::mutex::scoped_lock lock(server->mutex);
+        server->fds.insert(socket->native_handle());
+        boost::thread(boost::bind(ServeConnection, server, socket)).detach();
+    }
+    AcceptConnection(server);
+}
+
+void AcceptConnection(ServerState * server) {
+    boost::shared_ptr<Socket> socket(new Socket(server->io_service));
+    server->acceptor.async_accept(*socket, boost::bind(HandleAccept, server, socket, boost::asio::placeholders::error));
+}
+}
+
+void TravatarRunner::ServeSocket(const string & path, TreeIO & tree_io, ThreadPool & pool) {
+    ServerState server(this, &tree_io, &pool);
+    // Remove the socket left over from an earlier run
+    ::unlink(path.c_str());
+    boost::asio::local::stream_protocol::endpoint endpoint(path);
+    server.acceptor.open(endpoint.protocol());
+    server.acceptor.bind(endpoint);
+    server.acceptor.listen();
+    // Stop accepting connections on "@shutdown" or a signal
+    boost::asio::signal_set signals(server.io_service, SIGINT, SIGTERM);
+    signals.async_wait(boost::bind(&boost::asio::io_service::stop, &server.io_service));
+    AcceptConnection(&server);
+    cerr << "Listening on " << path << endl;
+    server.io_service.run();
+    server.acceptor.close();
+    ::unlink(path.c_str());
+    // Stop reading from the open connections, and wait until they have
+    // answered the requests that were already read
+    boost::mutex::scoped_lock lock(server.mutex);
+    BOOST_FOREACH(int fd, server.fds)
+        ::shutdown(fd, SHUT_RD);
+    while(server.fds.size() > 0)
+        server.closed.wait(lock);
+}
+
+HyperGraph * TravatarRunner::LookupRulesWithSrc(const HyperGraph & graph) const {
+    if(const LookupTable * tm = dynamic_cast<const LookupTable*>(tm_.get()))
+        return tm->TransformGraph(graph, true);
+    if(const LookupTableFSM * tm = dynamic_cast<const LookupTableFSM*>(tm_.get()))
+        return tm->TransformGraph(graph, true);
+    return tm_->TransformGraph(graph);
+}
+
 boost::shared_ptr<GraphTransformer> TravatarRunner::CreateLMComposer(
         const ConfigTravatarRunner & config, const vector<string> & lm_files,
         int pop_limit, const SparseMap & weights) {
     // Set the LM Composer
     boost::shared_ptr<GraphTransformer> ret;
     string search = config.GetString("search");
-    if(search == "cp") {
+    if(search == "cp" || search == "cg") {
         LMComposerBU * bu = new LMComposerBU(lm_files);
         bu->SetStackPopLimit(pop_limit);
         bu->SetChartLimit(config.GetInt("chart_limit"));
+        bu->SetCubeGrowing(search == "cg");
+        bu->SetChartThreads(config.GetInt("chart_threads"));
+        bu->SetRestCost(config.GetBool("rest_cost"));
         bu->UpdateWeights(weights);
         ret.reset(bu);
     } else if(search == "inc") {
@@ -10,6 +10,8 @@
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/algorithm/string.hpp>
+#include <cstring>
+#include <cctype>
 
 
 using namespace travatar;
@@ -22,6 +24,14 @@ HyperGraph * TreeIO::ReadFromString(const std::string & str) {
     return ReadTree(iss);
 }
 
+void TreeIO::ReadVocabulary(std::istream & in, std::set<WordId> & vocab) {
+    HyperGraph * tree;
+    while((tree = ReadTree(in)) != NULL) {
+        vocab.insert(tree->GetWords().begin(), tree->GetWords().end());
+        delete tree;
+    }
+}
+
 HyperGraph * WordTreeIO::ReadTree(istream & in) {
     string line;
     if(!getline(in,line)) return NULL;
@@ -43,61 +53,106 @@ void WordTreeIO::WriteTree(const HyperGraph & tree, ostream & out) {
     out << Dict::PrintWords(tree.GetWords());
 }
 
+namespace {
+
+inline bool IsWhiteSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// The rest of the line in a buffer, for error messages
+string RestOfLine(const char * ptr, const char * end) {
+    const char * eol = (const char*)memchr(ptr, '\n', end-ptr);
+    return string(ptr, eol ? eol : end);
+}
+
+}
+
 HyperGraph * PennTreeIO::ReadTree(istream & in) {
+    // Skip white space, then take the characters up to the parenthesis that
+    // closes the tree out of the stream buffer, without reading any further
+    istream::sentry sentry(in);
+    if(!sentry) return NULL;
+    streambuf * buf = in.rdbuf();
+    string text;
+    int depth = 0;
+    for(int c = buf->sbumpc(); ; c = buf->sbumpc()) {
+        if(c == char_traits<char>::eof()) {
+            in.setstate(ios::eofbit);
+            break;
+        }
+        text += (char)c;
+        if(c == '(')
+            depth++;
+        else if(c == ')' ? --depth <= 0 : depth == 0)
+            break;
+    }
+    const char * ptr = text.data();
+    return ReadTree(ptr, ptr + text.size());
+}
+
+HyperGraph * PennTreeIO::ReadFromString(const std::string & str) {
+    const char * ptr = str.data();
+    return ReadTree(ptr, ptr + str.size());
+}
+
+HyperGraph * PennTreeIO::ReadTree(const char *& ptr, const char * end) {
     // The new hypergraph and stack to read the nodes
     HyperGraph * hg = new HyperGraph;
     vector<HyperNode*> stack;
-    char next_char;
-    string line;
     int pos = 0;
-    string WHITE_SPACE_OR_OPENPAREN = string(WHITE_SPACE)+"(";
-    // Continue until the end of the corpus
-    while(in) {
-        IoUtil::Trim(in, WHITE_SPACE);
-        in >> next_char;
-        if(!in) break;
+    const char * p = ptr;
+    // Continue until the end of the buffer
+    while(true) {
+        while(p != end && isspace((unsigned char)*p)) p++;
+        if(p == end) break;
+        char next_char = *p++;
         // If the next character is a close parenthesis, close the node on the top of the stack
         if(next_char == ')') {
-            if(!stack.size()) { getline(in, line); THROW_ERROR("Unmatched close parenthesis at )" << line); }
+            if(!stack.size()) { delete hg; THROW_ERROR("Unmatched close parenthesis at )" << RestOfLine(p, end)); }
             HyperNode * child = *stack.rbegin(); stack.pop_back();
             child->GetSpan().second = pos;
             // If no parent exists, we are at the root. Return.
-            if(!stack.size()) return hg;
+            if(!stack.size()) { ptr = p; return hg; }
             // If a parent exists, add the child to its tails
             HyperNode * parent = *stack.rbegin();
             parent->GetEdge(0)->AddTail(child);
         // Otherwise, open a new node
         } else if(next_char == '(') {
             // If we are at the beginning of the sentence, check for empty sentences
-            if(stack.size() == 0) {
-                if(in.peek() == ')') {
-                    in >> next_char;
-                    return hg;
-                }
+            if(stack.size() == 0 && p != end && *p == ')') {
+                ptr = p+1;
+                return hg;
             }
-            // Read the symbol
-            string sym = IoUtil::ReadUntil(in, WHITE_SPACE, "()");
-            // TODO: Make this die properly
-            if(!sym.length()) { getline(in, line); THROW_ERROR("Empty symbol at '("<<line<<"'"); }
+            // Read the symbol, and look it up without copying it
+            const char * sym = p;
+            for(; p != end && !IsWhiteSpace(*p); p++)
+                if(*p == '(' || *p == ')') { delete hg; THROW_ERROR("Forbidden character " << *p); }
+            if(p == sym) { delete hg; THROW_ERROR("Empty symbol at '("<<RestOfLine(p, end)<<"'"); }
             // Create a new node
-            HyperNode* node = new HyperNode(Dict::WID(sym), -1, make_pair(pos,-1));
+            HyperNode* node = new HyperNode(Dict::WID(sym, p-sym), -1, make_pair(pos,-1));
             stack.push_back(node); hg->AddNode(node);
             HyperEdge* edge = new HyperEdge(node);
             node->AddEdge(edge); hg->AddEdge(edge);
-            // If this is a terminal, add the string
-            IoUtil::Trim(in, WHITE_SPACE);
-            if(in.peek() != '(') {
-                string val = IoUtil::ReadUntil(in, ")", WHITE_SPACE_OR_OPENPAREN);
-                WordId wid = Dict::WID(val);
+            // If this is a terminal, add the string, which runs up to the close parenthesis
+            while(p != end && IsWhiteSpace(*p)) p++;
+            if(p == end || *p != '(') {
+                const char * val = p;
+                const char * close = (const char*)memchr(p, ')', end-p);
+                if(close == NULL) close = end;
+                for(; p != close; p++)
+                    if(IsWhiteSpace(*p) || *p == '(') { delete hg; THROW_ERROR("Forbidden character " << *p); }
+                WordId wid = Dict::WID(val, close-val);
                 hg->GetWords().push_back(wid);
                 HyperNode* child = new HyperNode(wid, -1, make_pair(pos,pos+1));
                 hg->AddNode(child); edge->AddTail(child);
                 ++pos;
             }
         } else {
+            delete hg;
             THROW_ERROR("Expecting parenthesis but got '("<<(int)next_char<<")"<<next_char<<"'");
         }
     }
+    ptr = end;
     delete hg;
     return NULL;
 }
@@ -16,22 +16,21 @@ void Trimmer::AddId(std::map<int,int> & id_map, int id) {
 HyperGraph * Trimmer::TransformGraph(const HyperGraph & hg) const {
     std::map<int,int> active_nodes, active_edges;
     FindActive(hg, active_nodes, active_edges);
-    HyperGraph * ret = new HyperGraph(hg);
-    // Make the new edge/node arrays
-    ret->DeleteEdges();
+    // Make the new edge/node arrays, copying only the active edges/nodes
+    HyperGraph * ret = new HyperGraph;
+    ret->SetWords(hg.GetWords());
+    ret->SetEdgeType(hg.GetEdgeType());
     ret->GetEdges().resize(active_edges.size());
-    ret->DeleteNodes();
     ret->GetNodes().resize(active_nodes.size());
-    // Add the active edges/nodes
     BOOST_FOREACH(const HyperEdge * edge, hg.GetEdges()) {
         std::map<int,int>::const_iterator it = active_edges.find(edge->GetId());
         if(it != active_edges.end())
-            ret->GetEdges()[it->second] = new HyperEdge(*edge);
+            ret->GetEdges()[it->second] = ret->NewEdge(*edge);
     }
     BOOST_FOREACH(const HyperNode * node, hg.GetNodes()) {
         std::map<int,int>::const_iterator it = active_nodes.find(node->GetId());
         if(it != active_nodes.end())
-            ret->GetNodes()[it->second] = new HyperNode(*node);
+            ret->GetNodes()[it->second] = ret->NewNode(*node);
     }
     // Replace the links
     BOOST_FOREACH(HyperEdge * edge, ret->GetEdges()) {
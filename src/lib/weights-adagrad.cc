@@ -19,6 +19,7 @@ void WeightsAdagrad::Update(
             new_val += rate_ * sqrt(1/varinv_[change_val.first]) * change_val.second;
             current_[change_val.first] = new_val;
         }
+        Touch();
     }
     PRINT_DEBUG(current_ << std::endl, 2);
 }
@@ -48,6 +48,7 @@ void WeightsAveragePerceptron::Update(
             final_[change_val.first] = (avg_val*prev_iter + old_val*(curr_iter_-prev_iter-1)+new_val)/curr_iter_;
             last_update_[change_val.first] = curr_iter_;
         }
+        Touch();
     }
     PRINT_DEBUG(current_ << std::endl, 2);
 }
@@ -66,7 +67,7 @@ Real WeightsAveragePerceptron::GetCurrent(const SparseMap::key_type & key) {
     // Find the difference between the last update
     int diff = curr_iter_ - last_update_[key];
     if(diff != 0) {
-        Real reg = diff*l1_coeff_;
+        Real reg = diff*l1_coeff_, old_val = it->second;
         // Find the value
         if(it->second > 0)
             it->second = max(it->second-reg,(Real)0.0);
@@ -74,6 +75,8 @@ Real WeightsAveragePerceptron::GetCurrent(const SparseMap::key_type & key) {
             it->second = min(it->second+reg,(Real)0.0);
         it->second = InRange(it->second, GetRange(key));
         last_update_[key] = curr_iter_;
+        if(it->second != old_val)
+            Touch();
         if(it->second == 0) {
             current_.erase(it);
             return 0.0;
@@ -28,6 +28,7 @@ void WeightsPerceptron::Update(
             // And ensure we are in the correct range
             current_[change_val.first] = InRange(new_val, GetRange(change_val.first));
         }
+        Touch();
     }
     curr_iter_++;
     PRINT_DEBUG(current_ << std::endl, 2);
@@ -47,7 +48,7 @@ Real WeightsPerceptron::GetCurrent(const SparseMap::key_type & key) {
     // Find the difference between the last update
     int diff = curr_iter_ - last_update_[key];
     if(diff != 0) {
-        Real reg = diff*l1_coeff_;
+        Real reg = diff*l1_coeff_, old_val = it->second;
         // Find the value
         if(it->second > 0)
             it->second = max(it->second-reg,(Real)0.0);
@@ -55,6 +56,8 @@ Real WeightsPerceptron::GetCurrent(const SparseMap::key_type & key) {
             it->second = min(it->second+reg,(Real)0.0);
         it->second = InRange(it->second, GetRange(key));
         last_update_[key] = curr_iter_;
+        if(it->second != old_val)
+            Touch();
         if(it->second == 0) {
             current_.erase(it);
             return 0.0;
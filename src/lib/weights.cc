@@ -8,6 +8,8 @@
 using namespace std;
 using namespace travatar;
 
+std::atomic<int> Weights::next_version_(0);
+
 void Weights::AdjustNbest(
         const std::vector<std::pair<Real,Real> > & scores,
         const std::vector<SparseVector*> & features) {
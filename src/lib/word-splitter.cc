@@ -60,9 +60,9 @@ HyperGraph * WordSplitter::TransformGraph(const HyperGraph & hg) const {
                 new_nodes.insert(make_pair(node_idx, split_nodes));
             }
             vector<HyperEdge*> & edges = node->GetEdges();
-            HyperEdge* edge = new HyperEdge(node);
+            HyperEdge* edge = ret->NewEdge(node);
             edge->SetId(edges[0]->GetId());
-            delete ret->GetEdges()[edge->GetId()];
+            ret->FreeEdge(ret->GetEdges()[edge->GetId()]);
             ret->GetEdges()[edge->GetId()] = edge;
             BOOST_FOREACH(HyperNode* new_node, new_nodes[node_idx]) {
                 edge->AddTail(new_node);
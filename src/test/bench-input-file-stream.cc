@@ -0,0 +1,145 @@
+// A benchmark measuring how fast InputFileStream reads a plain file, a gzip
+// file, and a BGZF file, compared to reading the gzip file with boost's
+// gzip_decompressor on the reading thread.
+//  Usage: bench-input-file-stream [LINES] [THREADS]
+//
+// Each line is split into words, as the decoder does with rule tables, so
+// the time includes the parsing that decompression on a background thread
+// may overlap with. BGZF files are read with one thread and with THREADS
+// threads.
+
+#include <travatar/dict.h>
+#include <travatar/input-file-stream.h>
+#include <travatar/timer.h>
+#include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <zlib.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+using namespace travatar;
+
+namespace {
+
+const int kVocab = 50000;
+
+// A deterministic pseudo-random number in [0,1)
+unsigned int seed = 12345;
+double Random() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 16) & 0x7fff) / 32768.0;
+}
+
+// Lines in the format of a rule table
+string MakeText(int lines) {
+    ostringstream oss;
+    for(int i = 0; i < lines; i++) {
+        oss << "X ( \"w" << (int)(Random()*kVocab) << "\" x0:NP ) ||| \"v" << (int)(Random()*kVocab)
+            << "\" x0:NP \"v" << (int)(Random()*kVocab) << "\" @ X ||| egfp=" << Random()
+            << " egfl=" << Random() << " fgep=" << Random() << " fgel=" << Random() << " p=1" << endl;
+    }
+    return oss.str();
+}
+
+void WriteLE(ostream & out, unsigned int val, int bytes) {
+    for(int i = 0; i < bytes; i++)
+        out.put((char)((val >> (8*i)) & 0xff));
+}
+
+// Write one BGZF block
+void WriteBgzfBlock(ostream & out, const char * data, size_t size) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    vector<char> comp(deflateBound(&strm, size));
+    strm.next_in = (Bytef*)data;
+    strm.avail_in = size;
+    strm.next_out = (Bytef*)&comp[0];
+    strm.avail_out = comp.size();
+    deflate(&strm, Z_FINISH);
+    size_t comp_size = comp.size() - strm.avail_out;
+    deflateEnd(&strm);
+    const unsigned char header[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0};
+    out.write((const char*)header, sizeof(header));
+    WriteLE(out, comp_size + 25, 2);
+    out.write(&comp[0], comp_size);
+    WriteLE(out, crc32(crc32(0, NULL, 0), (const Bytef*)data, size), 4);
+    WriteLE(out, size, 4);
+}
+
+void WriteFiles(const string & text, const string & plain_file, const string & gzip_file, const string & bgzf_file) {
+    ofstream plain(plain_file.c_str());
+    plain << text;
+    gzFile gz = gzopen(gzip_file.c_str(), "wb");
+    gzwrite(gz, text.c_str(), text.size());
+    gzclose(gz);
+    ofstream bgzf(bgzf_file.c_str(), ios::out | ios::binary);
+    for(size_t pos = 0; pos < text.size(); pos += 65280)
+        WriteBgzfBlock(bgzf, text.c_str() + pos, min((size_t)65280, text.size() - pos));
+    WriteBgzfBlock(bgzf, "", 0);
+}
+
+// Read and split every line, and return the number of words so the work
+// cannot be optimized away
+long long ReadLines(istream & in) {
+    long long words = 0;
+    string line;
+    while(getline(in, line))
+        words += Dict::ParseWords(line).size();
+    return words;
+}
+
+long long Report(const string & name, double elapsed, size_t bytes, long long words) {
+    cout << name << "\t" << elapsed << " sec\t" << bytes/elapsed/1e6 << " MB/sec" << endl;
+    return words;
+}
+
+long long RunStream(const string & name, const string & file_name, size_t bytes) {
+    Timer timer;
+    timer.start();
+    InputFileStream in(file_name);
+    long long words = ReadLines(in);
+    return Report(name, timer.get_elapsed_time(), bytes, words);
+}
+
+long long RunBoost(const string & name, const string & file_name, size_t bytes) {
+    Timer timer;
+    timer.start();
+    ifstream ifs(file_name.c_str(), ios::in | ios::binary);
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> buf;
+    buf.push(boost::iostreams::gzip_decompressor());
+    buf.push(ifs);
+    istream in(&buf);
+    long long words = ReadLines(in);
+    return Report(name, timer.get_elapsed_time(), bytes, words);
+}
+
+}
+
+int main(int argc, char** argv) {
+    int lines = (argc > 1 ? atoi(argv[1]) : 500000);
+    int threads = (argc > 2 ? atoi(argv[2]) : 4);
+    string plain_file = "/tmp/bench-input-file-stream.txt";
+    string gzip_file = "/tmp/bench-input-file-stream.gz", bgzf_file = "/tmp/bench-input-file-stream-bgzf.gz";
+    string text = MakeText(lines);
+    WriteFiles(text, plain_file, gzip_file, bgzf_file);
+    cerr << "Reading " << text.size() << " bytes" << endl;
+    // Run the benchmarks
+    long long words = 0;
+    words += RunStream("plain", plain_file, text.size());
+    words += RunBoost("gzip-boost", gzip_file, text.size());
+    words += RunStream("gzip", gzip_file, text.size());
+    InputFileStream::SetInflateThreads(1);
+    words += RunStream("bgzf-1", bgzf_file, text.size());
+    InputFileStream::SetInflateThreads(threads);
+    ostringstream name;
+    name << "bgzf-" << threads;
+    words += RunStream(name.str(), bgzf_file, text.size());
+    cerr << "Read " << words << " words" << endl;
+    return 0;
+}
@@ -0,0 +1,163 @@
+// A micro-benchmark measuring cube pops per second when intersecting a fixed
+// forest with a bigram LM using LMComposerBU, with cube pruning (on one and on
+// several threads, and with rest costs) and with cube growing.
+//  Usage: bench-lm-composer [ITERATIONS] [POP_LIMIT] [CHART_THREADS]
+//
+// The forest has a node for every span of a sentence of 12 words, each of
+// which can be built from any split point in straight or inverted order, or
+// with a word inserted between the two halves, and each word has several
+// translations.
+
+#include <travatar/decoder-stats.h>
+#include <travatar/dict.h>
+#include <travatar/hyper-graph.h>
+#include <travatar/lm-composer-bu.h>
+#include <travatar/timer.h>
+#include <travatar/translation-rule.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace travatar;
+
+namespace {
+
+const int kLength = 12;
+const int kVocab = 30;
+const int kTranslations = 4;
+const int kInserted = 4;
+
+// A deterministic pseudo-random number in [0,1)
+unsigned int seed = 12345;
+double Random() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 16) & 0x7fff) / 32768.0;
+}
+
+string WordName(int i) {
+    ostringstream oss;
+    oss << "w" << i;
+    return oss.str();
+}
+
+void WriteLM(const string & file_name) {
+    ofstream out(file_name.c_str());
+    out << "\\data\\" << endl
+        << "ngram 1=" << kVocab+3 << endl
+        << "ngram 2=" << kVocab*kVocab << endl << endl
+        << "\\1-grams:" << endl
+        << "-2.0\t<unk>\t0" << endl
+        << "-99\t<s>\t-0.5" << endl
+        << "-1.5\t</s>\t0" << endl;
+    for(int i = 0; i < kVocab; i++)
+        out << -1.0-Random() << "\t" << WordName(i) << "\t" << -0.5*Random() << endl;
+    out << endl << "\\2-grams:" << endl;
+    for(int i = 0; i < kVocab; i++)
+        for(int j = 0; j < kVocab; j++)
+            out << -2.0*Random() << "\t" << WordName(i) << " " << WordName(j) << endl;
+    out << endl << "\\end\\" << endl;
+}
+
+// Intersect the forest repeatedly, and return the number of edges created so
+// the work cannot be optimized away
+int RunComposer(const string & name, const LMComposerBU & composer, const HyperGraph & forest, int iters) {
+    SentenceStats stats;
+    stats.Attach();
+    Timer timer;
+    timer.start();
+    int edges = 0;
+    Real best = 0;
+    for(int i = 0; i < iters; i++) {
+        boost::scoped_ptr<HyperGraph> lm_graph(composer.TransformGraph(forest));
+        edges += lm_graph->NumEdges();
+        best = lm_graph->GetNode(0)->GetViterbiScore();
+    }
+    double elapsed = timer.get_elapsed_time();
+    stats.Detach();
+    long long pops = stats.GetCount(COUNT_CUBE_POPS);
+    cout << name << "\t" << elapsed << " sec\t" << iters/elapsed << " forests/sec\t"
+         << pops/elapsed << " pops/sec\t" << stats.GetCount(COUNT_LM_QUERIES)/iters << " LM queries/forest\tbest score " << best << endl;
+    return edges;
+}
+
+}
+
+int main(int argc, char** argv) {
+    int iters = (argc > 1 ? atoi(argv[1]) : 20);
+    int pop_limit = (argc > 2 ? atoi(argv[2]) : 100);
+    int chart_threads = (argc > 3 ? atoi(argv[3]) : 4);
+    // Create the LM
+    string lm_file = "/tmp/bench-lm-composer.arpa";
+    WriteLM(lm_file);
+    LMComposerBU pruning(vector<string>(1, lm_file)), rest(vector<string>(1, lm_file)),
+                 parallel(vector<string>(1, lm_file)), growing(vector<string>(1, lm_file));
+    pruning.SetStackPopLimit(pop_limit);
+    rest.SetStackPopLimit(pop_limit);
+    rest.SetRestCost(true);
+    parallel.SetStackPopLimit(pop_limit);
+    parallel.SetChartThreads(chart_threads);
+    growing.SetStackPopLimit(pop_limit);
+    growing.SetCubeGrowing(true);
+    // Create the forest, with the root node first
+    HyperGraph forest;
+    vector<boost::shared_ptr<TranslationRule> > rules;
+    vector<HyperNode*> span_nodes(kLength*(kLength+1));
+    for(int len = kLength; len > 0; len--) {
+        for(int i = 0; i + len <= kLength; i++) {
+            HyperNode * node = new HyperNode;
+            node->SetSpan(make_pair(i, i+len));
+            node->SetSym(Dict::WID("X"));
+            forest.AddNode(node);
+            span_nodes[i*(kLength+1)+i+len] = node;
+        }
+    }
+    boost::shared_ptr<TranslationRule> straight(new TranslationRule), inverted(new TranslationRule);
+    straight->AddTrgWord(-1); straight->AddTrgWord(-2);
+    inverted->AddTrgWord(-2); inverted->AddTrgWord(-1);
+    rules.push_back(straight); rules.push_back(inverted);
+    for(int k = 0; k < kInserted; k++) {
+        boost::shared_ptr<TranslationRule> rule(new TranslationRule);
+        rule->AddTrgWord(-1); rule->AddTrgWord(Dict::WID(WordName((int)(Random()*kVocab)))); rule->AddTrgWord(-2);
+        rules.push_back(rule);
+    }
+    int num_binary = rules.size();
+    for(int i = 0; i < kLength; i++) {
+        for(int j = i+1; j <= kLength; j++) {
+            HyperNode * head = span_nodes[i*(kLength+1)+j];
+            if(j == i+1) {
+                for(int k = 0; k < kTranslations; k++) {
+                    boost::shared_ptr<TranslationRule> rule(new TranslationRule);
+                    rule->AddTrgWord(Dict::WID(WordName((int)(Random()*kVocab))));
+                    rules.push_back(rule);
+                    HyperEdge * edge = new HyperEdge(head);
+                    edge->SetRule(rule.get());
+                    edge->SetScore(-Random());
+                    forest.AddEdge(edge); head->AddEdge(edge);
+                }
+            }
+            for(int k = i+1; k < j; k++) {
+                for(int r = 0; r < num_binary; r++) {
+                    HyperEdge * edge = new HyperEdge(head);
+                    edge->AddTail(span_nodes[i*(kLength+1)+k]);
+                    edge->AddTail(span_nodes[k*(kLength+1)+j]);
+                    edge->SetRule(rules[r].get());
+                    edge->SetScore(-0.1*Random());
+                    forest.AddEdge(edge); head->AddEdge(edge);
+                }
+            }
+        }
+    }
+    cerr << "Forest has " << forest.NumNodes() << " nodes and " << forest.NumEdges() << " edges" << endl;
+    // Run the benchmarks
+    int edges = 0;
+    edges += RunComposer("cp", pruning, forest, iters);
+    edges += RunComposer("cp-rest", rest, forest, iters);
+    edges += RunComposer("cp-par", parallel, forest, iters);
+    edges += RunComposer("cg", growing, forest, iters);
+    cerr << "Created " << edges << " edges" << endl;
+    return 0;
+}
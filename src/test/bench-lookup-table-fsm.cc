@@ -0,0 +1,80 @@
+// A micro-benchmark comparing the recursive trie search and the chart used
+// by LookupTableFSM to match Hiero rules, on the grammar of
+// test-lookup-table-fsm together with a glue rule.
+//  Usage: bench-lookup-table-fsm [ITERATIONS]
+//
+// The input is "I eat two hamburgers" repeated to several lengths, and the
+// glue rule may cover the whole sentence.
+
+#include <travatar/dict.h>
+#include <travatar/hyper-graph.h>
+#include <travatar/lookup-table-fsm.h>
+#include <travatar/timer.h>
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+using namespace travatar;
+
+// Transform the same sentence repeatedly, and return the number of edges
+// created so the work cannot be optimized away
+int RunLookup(const string & name, LookupTableFSM & lookup, bool chart, const HyperGraph & sent, int iters) {
+    lookup.SetChartMatch(chart);
+    Timer timer;
+    timer.start();
+    int edges = 0;
+    for(int i = 0; i < iters; i++) {
+        boost::scoped_ptr<HyperGraph> rule_graph(lookup.TransformGraph(sent));
+        edges += rule_graph->NumEdges();
+    }
+    double elapsed = timer.get_elapsed_time();
+    cout << name << "\t" << sent.GetWords().size() << " words\t" << elapsed << " sec\t"
+         << iters/elapsed << " sentences/sec\t" << edges/iters << " edges" << endl;
+    return edges;
+}
+
+int main(int argc, char** argv) {
+    int iters = (argc > 1 ? atoi(argv[1]) : 10);
+    // The rules from test-lookup-table-fsm
+    ostringstream rule_oss, glue_oss;
+    rule_oss << "\"I\" x0:X @ X ||| \"watashi\" \"wa\" x0:X @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"eat\" \"two\" x0:X @ X ||| \"futatsu\" \"no\" x0:X \"wo\" \"taberu\" @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"two\" x0:X @ X ||| \"futatsu\" \"no\" x0:X @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "x0:X \"eat\" x1:X @ X ||| x0:X \"wa\" x1:X \"wo\" \"taberu\" @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"eat\" x0:X @ X ||| x0:X \"wo\" \"taberu\" @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"I\" x0:X \"two\" \"hamburgers\" @ X ||| \"watashi\" \"wa\" \"futatsu\" \"no\" \"hanbaga\" \"wo\" x0:X @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"I\" x0:X \"two\" x1:X @ X ||| \"watashi\" \"wa\" \"futatsu\" \"no\" x1:X \"wo\" x0:X @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"I\" @ X ||| \"watashi\" @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"eat\" @ X ||| \"taberu\" @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"two\" @ X ||| \"futatsu\" @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"hamburgers\" @ X ||| \"hanbaga\" @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    glue_oss << "x0:X x1:X @ X ||| x0:X x1:X @ X ||| glue=1" << endl;
+    istringstream rule_iss(rule_oss.str()), glue_iss(glue_oss.str());
+    LookupTableFSM lookup;
+    lookup.SetTrgFactors(1);
+    lookup.SetRootSymbol(Dict::WID("X"));
+    lookup.AddRuleFSM(RuleFSM::ReadFromRuleTable(rule_iss));
+    lookup.AddRuleFSM(RuleFSM::ReadFromRuleTable(glue_iss));
+    // Let the glue rule cover the whole sentence
+    vector<int> span_limits(1, 20);
+    span_limits.push_back(60);
+    lookup.SetSpanLimits(span_limits);
+    // Run the benchmarks
+    int edges = 0;
+    int lengths[] = {4, 20, 60};
+    for(int i = 0; i < 3; i++) {
+        HyperGraph sent;
+        for(int j = 0; j < lengths[i] / 4; j++)
+            BOOST_FOREACH(WordId word, Dict::ParseWords("I eat two hamburgers"))
+                sent.AddWord(word);
+        int len_iters = iters * 60 / lengths[i];
+        edges += RunLookup("recursive", lookup, false, sent, len_iters);
+        edges += RunLookup("chart", lookup, true, sent, len_iters);
+    }
+    cerr << "Created " << edges << " edges" << endl;
+    return 0;
+}
@@ -0,0 +1,61 @@
+// A micro-benchmark comparing the string-based rule lookup of the hash and
+// marisa tables with the integer-keyed trie of LookupTableHashInt.
+//  Usage: bench-lookup-table [ITERATIONS]
+
+#include <travatar/hyper-graph.h>
+#include <travatar/lookup-table-hash.h>
+#include <travatar/lookup-table-hash-int.h>
+#include <travatar/lookup-table-marisa.h>
+#include <travatar/timer.h>
+#include <travatar/tree-io.h>
+#include <boost/scoped_ptr.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace travatar;
+
+// Transform the same tree repeatedly, and return the number of edges created
+// so the work cannot be optimized away
+int RunLookup(const string & name, const LookupTable & lookup, const HyperGraph & tree, int iters) {
+    Timer timer;
+    timer.start();
+    int edges = 0;
+    for(int i = 0; i < iters; i++) {
+        boost::scoped_ptr<HyperGraph> rule_graph(lookup.TransformGraph(tree));
+        edges += rule_graph->NumEdges();
+    }
+    double elapsed = timer.get_elapsed_time();
+    cout << name << "\t" << elapsed << " sec\t" << iters/elapsed << " trees/sec" << endl;
+    return edges;
+}
+
+int main(int argc, char** argv) {
+    int iters = (argc > 1 ? atoi(argv[1]) : 100000);
+    // The rules from test-lookup-table
+    ostringstream rule_oss;
+    rule_oss << "ROOT ( x0:S ) ||| x0:S @ ROOT ||| Pegf=0.05 ppen=2.718" << endl;
+    rule_oss << "S ( x0:NP x1:VP ) ||| x0:NP x1:VP @ S ||| Pegf=0.1 ppen=2.718" << endl;
+    rule_oss << "S ( x0:NP x1:VP ) ||| x1:VP x0:NP @ S ||| Pegf=0.2 ppen=2.718" << endl;
+    rule_oss << "S ( NP ( PRP ( \"he\" ) ) x0:VP ) ||| \"il\" x0:VP @ S ||| Pegf=0.3 ppen=2.718" << endl;
+    rule_oss << "NP ( x0:PRP ) ||| x0:PRP @ NP ||| Pegf=0.4 ppen=2.718" << endl;
+    rule_oss << "PRP ( \"he\" ) ||| \"il\" @ PRP ||| Pegf=0.5 ppen=2.718" << endl;
+    rule_oss << "VP ( AUX ( \"does\" ) RB ( \"not\" ) x0:VB ) ||| \"ne\" x0:VB \"pas\" @ VP ||| Pegf=0.6 ppen=2.718" << endl;
+    rule_oss << "VB ( \"go\" ) ||| \"va\" @ VB ||| Pegf=0.7 ppen=2.718" << endl;
+    istringstream hash_in(rule_oss.str()), hash_int_in(rule_oss.str()), marisa_in(rule_oss.str());
+    boost::scoped_ptr<LookupTableHash> hash(LookupTableHash::ReadFromRuleTable(hash_in));
+    boost::scoped_ptr<LookupTableHashInt> hash_int(LookupTableHashInt::ReadFromRuleTable(hash_int_in));
+    boost::scoped_ptr<LookupTableMarisa> marisa(LookupTableMarisa::ReadFromRuleTable(marisa_in));
+    // The tree from test-lookup-table
+    istringstream tree_in("(S (NP (PRP he)) (VP (AUX does) (RB not) (VB go)))");
+    PennTreeIO tree_io;
+    boost::scoped_ptr<HyperGraph> tree(tree_io.ReadTree(tree_in));
+    // Run the benchmarks
+    int edges = 0;
+    edges += RunLookup("hash", *hash, *tree, iters);
+    edges += RunLookup("marisa", *marisa, *tree, iters);
+    edges += RunLookup("hash-int", *hash_int, *tree, iters);
+    cerr << "Created " << edges << " edges" << endl;
+    return 0;
+}
@@ -0,0 +1,171 @@
+// A benchmark measuring the start-up cost of loading a binary LM and a
+// compiled rule table with each of the load methods (mmap/populate/read).
+//  Usage: bench-model-load [ITERATIONS] [cold]
+//
+// Each iteration loads both models and then uses them, querying random
+// bigrams in the LM and translating a tree of random words with the rule
+// table. If "cold" is given, the files are dropped from the page cache before
+// each load, so the time includes reading them from disk. The memory added
+// to the process is split into private memory (RssAnon) and memory backed by
+// the page cache (RssFile), which other processes that load the same files
+// share.
+
+#include <travatar/dict.h>
+#include <travatar/hyper-graph.h>
+#include <travatar/lm-func.h>
+#include <travatar/load-method.h>
+#include <travatar/lookup-table-marisa.h>
+#include <travatar/timer.h>
+#include <travatar/tree-io.h>
+#include <lm/model.hh>
+#include <util/file.hh>
+#include <boost/scoped_ptr.hpp>
+#include <fcntl.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace travatar;
+
+namespace {
+
+const int kVocab = 5000;
+const int kSuccessors = 40;
+const int kQueries = 100000;
+const int kTreeWords = 200;
+
+// A deterministic pseudo-random number in [0,1)
+unsigned int seed = 12345;
+double Random() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 16) & 0x7fff) / 32768.0;
+}
+
+string WordName(int i) {
+    ostringstream oss;
+    oss << "w" << i;
+    return oss.str();
+}
+
+void WriteLM(const string & file_name) {
+    ofstream out(file_name.c_str());
+    out << "\\data\\" << endl
+        << "ngram 1=" << kVocab+3 << endl
+        << "ngram 2=" << kVocab*kSuccessors << endl << endl
+        << "\\1-grams:" << endl
+        << "-2.0\t<unk>\t0" << endl
+        << "-99\t<s>\t-0.5" << endl
+        << "-1.5\t</s>\t0" << endl;
+    for(int i = 0; i < kVocab; i++)
+        out << -3.0-Random() << "\t" << WordName(i) << "\t" << -0.5*Random() << endl;
+    out << endl << "\\2-grams:" << endl;
+    for(int i = 0; i < kVocab; i++)
+        for(int j = 0; j < kSuccessors; j++)
+            out << -2.0*Random() << "\t" << WordName(i) << " " << WordName((i*kSuccessors+j) % kVocab) << endl;
+    out << endl << "\\end\\" << endl;
+}
+
+void WriteRuleTable(const string & file_name) {
+    ostringstream rule_oss;
+    for(int i = 0; i < kVocab; i++)
+        for(int j = 0; j < 4; j++)
+            rule_oss << "X ( \"" << WordName(i) << "\" ) ||| \"" << WordName((i+j) % kVocab) << "\" @ X ||| p=" << Random() << endl;
+    istringstream rule_iss(rule_oss.str());
+    boost::scoped_ptr<LookupTableMarisa> tm(LookupTableMarisa::ReadFromRuleTable(rule_iss));
+    ofstream out(file_name.c_str(), ios::out | ios::binary);
+    tm->WriteBinary(out);
+}
+
+// Drop a file from the page cache
+void DropFromCache(const string & file_name) {
+    util::scoped_fd fd(util::OpenReadOrThrow(file_name.c_str()));
+    fdatasync(fd.get());
+    posix_fadvise(fd.get(), 0, 0, POSIX_FADV_DONTNEED);
+}
+
+// Read the size of private and file-backed resident memory in kB
+void GetRss(long & anon, long & file) {
+    anon = file = 0;
+    ifstream in("/proc/self/status");
+    string line;
+    while(getline(in, line)) {
+        if(line.compare(0, 8, "RssAnon:") == 0) anon = atol(line.c_str()+8);
+        else if(line.compare(0, 8, "RssFile:") == 0) file = atol(line.c_str()+8);
+    }
+}
+
+// Load and use the models repeatedly, and return a sum of the scores and
+// the number of edges so the work cannot be optimized away
+double RunLoad(const string & name, const string & lm_file, const string & tm_file, const string & tree_str, int iters, bool cold) {
+    double load_time = 0, use_time = 0, sum = 0;
+    long anon = 0, file = 0;
+    for(int i = 0; i < iters; i++) {
+        if(cold) {
+            DropFromCache(lm_file);
+            DropFromCache(tm_file);
+        }
+        long start_anon, start_file, end_anon, end_file;
+        GetRss(start_anon, start_file);
+        Timer timer;
+        timer.start();
+        {
+            LMData lm(lm_file + "|load=" + name);
+            boost::scoped_ptr<LookupTableMarisa> tm(LookupTableMarisa::ReadFromBinaryFile(tm_file, ParseLoadMethod(name)));
+            load_time += timer.get_elapsed_time();
+            // Query random bigrams, and translate the tree
+            const lm::ngram::ProbingModel * model = static_cast<const lm::ngram::ProbingModel*>(lm.GetLM());
+            lm::ngram::State out;
+            for(int j = 0; j < kQueries; j++) {
+                lm::ngram::State in;
+                in.length = 1;
+                in.words[0] = lm.GetMapping(Dict::WID(WordName((int)(Random()*kVocab))));
+                sum += model->Score(in, lm.GetMapping(Dict::WID(WordName((int)(Random()*kVocab)))), out);
+            }
+            istringstream tree_in(tree_str);
+            PennTreeIO tree_io;
+            boost::scoped_ptr<HyperGraph> tree(tree_io.ReadTree(tree_in));
+            boost::scoped_ptr<HyperGraph> rule_graph(tm->TransformGraph(*tree));
+            sum += rule_graph->NumEdges();
+            use_time += timer.get_elapsed_time();
+            GetRss(end_anon, end_file);
+            anon += end_anon - start_anon;
+            file += end_file - start_file;
+        }
+    }
+    cout << name << "\tload " << load_time/iters << " sec\tload+use " << use_time/iters << " sec\t"
+         << "private " << anon/iters << " kB\tshared " << file/iters << " kB" << endl;
+    return sum;
+}
+
+}
+
+int main(int argc, char** argv) {
+    int iters = (argc > 1 ? atoi(argv[1]) : 5);
+    bool cold = (argc > 2 && !strcmp(argv[2], "cold"));
+    // Create the binary LM and rule table
+    string arpa_file = "/tmp/bench-model-load.arpa", lm_file = "/tmp/bench-model-load.blm";
+    string tm_file = "/tmp/bench-model-load.tm";
+    WriteLM(arpa_file);
+    {
+        lm::ngram::Config config;
+        config.write_mmap = lm_file.c_str();
+        lm::ngram::ProbingModel model(arpa_file.c_str(), config);
+    }
+    WriteRuleTable(tm_file);
+    // A flat tree of random words
+    ostringstream tree_oss;
+    tree_oss << "(S";
+    for(int i = 0; i < kTreeWords; i++)
+        tree_oss << " (X " << WordName((int)(Random()*kVocab)) << ")";
+    tree_oss << ")";
+    // Run the benchmarks
+    double sum = 0;
+    sum += RunLoad("mmap", lm_file, tm_file, tree_oss.str(), iters, cold);
+    sum += RunLoad("populate", lm_file, tm_file, tree_oss.str(), iters, cold);
+    sum += RunLoad("read", lm_file, tm_file, tree_oss.str(), iters, cold);
+    cerr << "Sum of scores " << sum << endl;
+    return 0;
+}
@@ -0,0 +1,106 @@
+// A benchmark measuring how long it takes to filter a compiled rule table to
+// the words of a small document, using the index of source terminals stored
+// in the binary file, or building the index from the trie when it is missing.
+//  Usage: bench-rule-table-filter [ITERATIONS]
+//
+// The table has tree-to-string rules with one or two terminals over a large
+// vocabulary, and the document has a few hundred distinct words.
+
+#include <travatar/dict.h>
+#include <travatar/lookup-table-marisa.h>
+#include <travatar/timer.h>
+#include <boost/scoped_ptr.hpp>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <set>
+
+using namespace std;
+using namespace travatar;
+
+namespace {
+
+const int kVocab = 50000;
+const int kRules = 400000;
+const int kDocWords = 500;
+
+// A deterministic pseudo-random number in [0,1)
+unsigned int seed = 12345;
+double Random() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 16) & 0x7fff) / 32768.0;
+}
+
+string WordName(int i) {
+    ostringstream oss;
+    oss << "w" << i;
+    return oss.str();
+}
+
+// Filter the table repeatedly, and return the size of the filtered table in
+// binary format so the work cannot be optimized away
+int RunFilter(const string & name, const string & tm_file, bool binary, const set<WordId> & vocab, int iters) {
+    double load_time = 0, filter_time = 0;
+    int kept = 0;
+    for(int i = 0; i < iters; i++) {
+        Timer timer;
+        timer.start();
+        boost::scoped_ptr<LookupTableMarisa> tm;
+        if(binary) {
+            tm.reset(LookupTableMarisa::ReadFromBinaryFile(tm_file));
+        } else {
+            string file_name = tm_file;
+            tm.reset(LookupTableMarisa::ReadFromFile(file_name));
+        }
+        double loaded = timer.get_elapsed_time();
+        load_time += loaded;
+        boost::scoped_ptr<LookupTableMarisa> filtered(tm->Filter(vocab));
+        filter_time += timer.get_elapsed_time() - loaded;
+        ostringstream out;
+        filtered->WriteBinary(out);
+        kept += out.str().size();
+    }
+    cout << name << "\tload " << load_time/iters << " sec\tfilter " << filter_time/iters << " sec\t"
+         << kept/iters << " bytes kept" << endl;
+    return kept;
+}
+
+}
+
+int main(int argc, char** argv) {
+    int iters = (argc > 1 ? atoi(argv[1]) : 3);
+    // Write the rule table in text and binary format, with the sources sorted
+    string text_file = "/tmp/bench-rule-table-filter.txt", bin_file = "/tmp/bench-rule-table-filter.bin";
+    set<string> rules;
+    for(int i = 0; i < kRules; i++) {
+        ostringstream oss;
+        int w1 = (int)(Random()*kVocab), w2 = (int)(Random()*kVocab);
+        if(Random() < 0.5)
+            oss << "X ( \"" << WordName(w1) << "\" ) ||| \"" << WordName(w2) << "\" @ X ||| p=" << Random();
+        else
+            oss << "X ( \"" << WordName(w1) << "\" x0:Y \"" << WordName(w2) << "\" ) ||| x0:Y \"" << WordName(w1) << "\" @ X ||| p=" << Random();
+        rules.insert(oss.str());
+    }
+    {
+        ofstream text_out(text_file.c_str());
+        for(set<string>::const_iterator it = rules.begin(); it != rules.end(); it++)
+            text_out << *it << endl;
+    }
+    {
+        string file_name = text_file;
+        boost::scoped_ptr<LookupTableMarisa> tm(LookupTableMarisa::ReadFromFile(file_name));
+        ofstream bin_out(bin_file.c_str(), ios::out | ios::binary);
+        tm->WriteBinary(bin_out);
+    }
+    // The words of the document
+    set<WordId> vocab;
+    for(int i = 0; i < kDocWords; i++)
+        vocab.insert(Dict::WID(WordName((int)(Random()*kVocab))));
+    // Run the benchmarks
+    int kept = 0;
+    kept += RunFilter("text", text_file, false, vocab, iters);
+    kept += RunFilter("binary", bin_file, true, vocab, iters);
+    cerr << "Kept " << kept << " bytes" << endl;
+    return 0;
+}
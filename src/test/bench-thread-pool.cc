@@ -0,0 +1,62 @@
+// A throughput benchmark for ThreadPool. Runs a batch of CPU-bound tasks
+// with a skewed distribution of costs (like the sentence lengths of a real
+// test set) with an increasing number of threads, and reports the speedup
+// over a single thread.
+//  Usage: bench-thread-pool [TASKS] [MAX_THREADS]
+
+#include <travatar/task.h>
+#include <travatar/thread-pool.h>
+#include <travatar/timer.h>
+#include <boost/thread.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+using namespace travatar;
+
+// A task that spins for an amount of time proportional to its cost
+class BenchTask : public Task {
+public:
+    BenchTask(int cost, std::atomic<long> * sum) : cost_(cost), sum_(sum) { }
+    void Run() {
+        unsigned long val = cost_;
+        for(int i = 0; i < cost_ * 20000; i++)
+            val = val * 6364136223846793005UL + 1442695040888963407UL;
+        *sum_ += (long)(val & 1);
+    }
+    virtual int GetCost() const { return cost_; }
+private:
+    int cost_;
+    std::atomic<long> * sum_;
+};
+
+double RunPool(int threads, const vector<int> & costs, std::atomic<long> * sum) {
+    Timer timer;
+    timer.start();
+    ThreadPool pool(threads, threads*5);
+    for(int i = 0; i < (int)costs.size(); i++)
+        pool.Submit(new BenchTask(costs[i], sum));
+    pool.Stop(true);
+    return timer.get_elapsed_time();
+}
+
+int main(int argc, char** argv) {
+    int num_tasks = (argc > 1 ? atoi(argv[1]) : 2000);
+    int max_threads = (argc > 2 ? atoi(argv[2]) : boost::thread::hardware_concurrency());
+    if(max_threads < 1) max_threads = 1;
+    // Mostly short tasks with an occasional very long one
+    srand(0);
+    vector<int> costs(num_tasks);
+    for(int i = 0; i < num_tasks; i++)
+        costs[i] = (rand() % 10 == 0 ? 20 + rand() % 80 : 1 + rand() % 20);
+    std::atomic<long> sum(0);
+    double base = RunPool(1, costs, &sum);
+    cout << "threads=1\t" << base << " sec\t" << num_tasks/base << " tasks/sec\tspeedup=1" << endl;
+    for(int threads = 2; threads <= max_threads; threads *= 2) {
+        double elapsed = RunPool(threads, costs, &sum);
+        cout << "threads=" << threads << "\t" << elapsed << " sec\t" << num_tasks/elapsed << " tasks/sec\tspeedup=" << base/elapsed << endl;
+    }
+    cerr << "Checksum " << sum << endl;
+    return 0;
+}
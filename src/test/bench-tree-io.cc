@@ -0,0 +1,111 @@
+// A benchmark measuring how fast trees are parsed in the Penn, Egret, and
+// JSON formats, in trees/sec and MB/sec.
+//  Usage: bench-tree-io [TREES]
+//
+// The corpus has random trees with a few hundred labels and a large
+// vocabulary, similar to a parsed training corpus. Penn trees are read both
+// from a stream holding the whole corpus, as the decoder reads its input,
+// and one line at a time with ReadFromString, as forest-extractor does.
+
+#include <travatar/dict.h>
+#include <travatar/hyper-graph.h>
+#include <travatar/timer.h>
+#include <travatar/tree-io.h>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+using namespace travatar;
+
+namespace {
+
+const int kLabels = 300;
+const int kVocab = 50000;
+const int kMaxWords = 40;
+
+// A deterministic pseudo-random number in [0,1)
+unsigned int seed = 12345;
+double Random() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 16) & 0x7fff) / 32768.0;
+}
+
+// Write a random tree over a number of words in Penn format
+void WriteRandomTree(int words, ostream & out) {
+    ostringstream label;
+    label << "L" << (int)(Random()*kLabels);
+    out << "(" << label.str();
+    if(words == 1) {
+        // Preterminals
+        out << " w" << (int)(Random()*kVocab);
+    } else {
+        int split = 1 + (int)(Random()*(words-1));
+        out << " ";
+        WriteRandomTree(split, out);
+        out << " ";
+        WriteRandomTree(words-split, out);
+    }
+    out << ")";
+}
+
+// Parse all trees in a corpus, and return the number of words so the work
+// cannot be optimized away
+int RunParse(const string & name, TreeIO & io, const string & corpus, bool by_line) {
+    Timer timer;
+    timer.start();
+    int trees = 0, words = 0;
+    istringstream in(corpus);
+    if(by_line) {
+        string line;
+        while(getline(in, line)) {
+            HyperGraph * tree = io.ReadFromString(line);
+            words += tree->GetWords().size(); trees++;
+            delete tree;
+        }
+    } else {
+        HyperGraph * tree;
+        while((tree = io.ReadTree(in)) != NULL) {
+            words += tree->GetWords().size(); trees++;
+            delete tree;
+        }
+    }
+    double elapsed = timer.get_elapsed_time();
+    cout << name << "\t" << trees << " trees\t" << elapsed << " sec\t" << trees/elapsed << " trees/sec\t"
+         << corpus.size()/elapsed/1e6 << " MB/sec" << endl;
+    return words;
+}
+
+}
+
+int main(int argc, char** argv) {
+    int num_trees = (argc > 1 ? atoi(argv[1]) : 10000);
+    // Create the corpus in each of the formats
+    ostringstream penn_out, egret_out, json_out;
+    for(int i = 0; i < num_trees; i++) {
+        WriteRandomTree(1 + (int)(Random()*kMaxWords), penn_out);
+        penn_out << endl;
+    }
+    string penn = penn_out.str();
+    PennTreeIO penn_io;
+    EgretTreeIO egret_io;
+    JSONTreeIO json_io;
+    {
+        istringstream in(penn);
+        HyperGraph * tree;
+        while((tree = penn_io.ReadTree(in)) != NULL) {
+            egret_io.WriteTree(*tree, egret_out); egret_out << endl;
+            json_io.WriteTree(*tree, json_out); json_out << endl;
+            delete tree;
+        }
+    }
+    // Run the benchmarks
+    int words = 0;
+    words += RunParse("penn", penn_io, penn, false);
+    words += RunParse("penn-line", penn_io, penn, true);
+    words += RunParse("egret", egret_io, egret_out.str(), false);
+    words += RunParse("json", json_io, json_out.str(), false);
+    cerr << "Read " << words << " words" << endl;
+    return 0;
+}
@@ -3,6 +3,7 @@
 
 #include <travatar/sentence.h>
 #include <travatar/dict.h>
+#include <travatar/symbol-set.h>
 #include <travatar/check-equal.h>
 #include <vector>
 #include <boost/foreach.hpp>
@@ -45,4 +46,27 @@ BOOST_AUTO_TEST_CASE(TestParseSparseMapError) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(TestSymbolSetFreeze) {
+    SymbolSet<int> syms(true);
+    int a = syms.GetId("a", true), b = syms.GetId("b", true), empty = syms.GetId("", true);
+    syms.Freeze();
+    BOOST_CHECK(syms.IsFrozen());
+    // Existing symbols keep their IDs
+    BOOST_CHECK_EQUAL(syms.GetId("a"), a);
+    BOOST_CHECK_EQUAL(syms.GetId("b"), b);
+    BOOST_CHECK_EQUAL(syms.GetId(""), empty);
+    BOOST_CHECK_EQUAL(syms.GetSymbol(b), "b");
+    // New symbols go into the overflow table
+    BOOST_CHECK_EQUAL(syms.GetId("c"), -1);
+    int c = syms.GetId("c", true);
+    BOOST_CHECK_EQUAL(c, 3);
+    BOOST_CHECK_EQUAL(syms.GetId("c", true), c);
+    BOOST_CHECK_EQUAL(syms.GetSymbol(c), "c");
+    BOOST_CHECK_EQUAL(syms.size(), 4);
+    // Freezing again moves the overflow into the table
+    syms.Freeze();
+    BOOST_CHECK_EQUAL(syms.GetId("c"), c);
+    BOOST_CHECK_EQUAL(syms.GetSymbol(a), "a");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,7 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <sstream>
+#include <set>
 #include <cmath>
 
 using namespace std;
@@ -345,6 +346,30 @@ BOOST_AUTO_TEST_CASE(TestNbestUniq) {
     BOOST_CHECK(CheckPtrVector(exp_nonu, act_nonu) && CheckPtrVector(exp_uniq, act_uniq));
 }
 
+// Test that the iterator returns every path exactly once, best first
+BOOST_AUTO_TEST_CASE(TestNbestIterator) {
+    rule_graph_->ResetViterbiScores();
+    NbestList exp_nbest = rule_graph_->GetNbest(3);
+    NbestIterator iter(*rule_graph_);
+    NbestList act_nbest;
+    set<vector<int> > act_edges;
+    for(boost::shared_ptr<HyperPath> path = iter.Next(); path.get() != NULL; path = iter.Next()) {
+        if(act_nbest.size() > 0)
+            BOOST_CHECK(path->GetScore() <= act_nbest.back()->GetScore());
+        vector<int> edges;
+        BOOST_FOREACH(HyperEdge * edge, path->GetEdges())
+            edges.push_back(edge->GetId());
+        act_edges.insert(edges);
+        act_nbest.push_back(path);
+    }
+    // There are 2*2*3 paths
+    BOOST_CHECK_EQUAL(act_nbest.size(), 12);
+    BOOST_CHECK_EQUAL(act_edges.size(), 12);
+    act_nbest.resize(3);
+    BOOST_CHECK(CheckPtrVector(exp_nbest, act_nbest));
+    BOOST_CHECK(iter.Next().get() == NULL);
+}
+
 BOOST_AUTO_TEST_CASE(TestPathTranslation) {
     // Get the three-best edge values
     vector<boost::shared_ptr<HyperPath> > paths;
@@ -399,4 +424,36 @@ BOOST_AUTO_TEST_CASE(TestGetLabeledSpans) {
     BOOST_CHECK(CheckMap(exp_spans, act_spans));
 }
 
+// Check that pool-allocated nodes and edges can be mixed with heap ones
+BOOST_AUTO_TEST_CASE(TestPoolAllocation) {
+    HyperGraph hg_exp, hg_act;
+    {
+        HyperNode* node1 = new HyperNode(Dict::WID("A1"), -1, make_pair(0,2)); hg_exp.AddNode(node1);
+        HyperNode* node2 = new HyperNode(Dict::WID("A2"), -1, make_pair(0,1)); hg_exp.AddNode(node2);
+        HyperEdge* edge = new HyperEdge(node1); edge->AddTail(node2); node1->AddEdge(edge); hg_exp.AddEdge(edge);
+    }
+    {
+        HyperNode* node1 = hg_act.NewNode(Dict::WID("A1"), -1, make_pair(0,2)); hg_act.AddNode(node1);
+        HyperNode* node2 = new HyperNode(Dict::WID("A2"), -1, make_pair(0,1)); hg_act.AddNode(node2);
+        HyperEdge* edge = hg_act.NewEdge(node1); edge->AddTail(node2); node1->AddEdge(edge); hg_act.AddEdge(edge);
+    }
+    BOOST_CHECK(hg_exp.CheckEqual(hg_act));
+    HyperGraph hg_copy(hg_act);
+    BOOST_CHECK(hg_exp.CheckEqual(hg_copy));
+    hg_copy.DeleteNodes(); hg_copy.DeleteEdges();
+    BOOST_CHECK_EQUAL(hg_copy.NumNodes(), 0);
+}
+
+// Check that freed pooled nodes are reused by the next allocations
+BOOST_AUTO_TEST_CASE(TestPoolFree) {
+    HyperGraph hg;
+    vector<HyperNode*> nodes;
+    for(int i = 0; i < 10; i++)
+        nodes.push_back(hg.NewNode());
+    hg.FreeNodes(nodes);
+    set<HyperNode*> freed(nodes.begin(), nodes.end());
+    for(int i = 0; i < 10; i++)
+        BOOST_CHECK(freed.count(hg.NewNode()) == 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,10 +2,105 @@
 #include <boost/test/unit_test.hpp>
 
 #include <travatar/io-util.h>
+#include <travatar/input-file-stream.h>
+#include <zlib.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
 
 using namespace std;
 using namespace travatar;
 
+namespace {
+
+// Creates an empty file with a unique name in /tmp, and removes it on
+// destruction so concurrent runs do not share files. The name ends in
+// ".gz" so that InputFileStream decompresses it
+class TempFile {
+public:
+    TempFile(const string & prefix) {
+        string pattern = "/tmp/" + prefix + "-XXXXXX.gz";
+        vector<char> buf(pattern.begin(), pattern.end());
+        buf.push_back(0);
+        int fd = mkstemps(&buf[0], 3);
+        BOOST_REQUIRE(fd != -1);
+        close(fd);
+        name_ = &buf[0];
+    }
+    ~TempFile() { unlink(name_.c_str()); }
+    const string & GetName() const { return name_; }
+private:
+    string name_;
+};
+
+// Lines of text that are long enough to fill several of the buffers used by
+// InputFileStream
+string MakeText(int lines) {
+    ostringstream oss;
+    for(int i = 0; i < lines; i++)
+        oss << "line " << i << " of the test file ( x" << i*7 << " y" << i%13 << " )" << endl;
+    return oss.str();
+}
+
+// Write text as a gzip file with several members
+void WriteMultiGzip(const string & file_name, const string & text, int members) {
+    size_t step = text.size() / members + 1;
+    for(size_t pos = 0; pos < text.size(); pos += step) {
+        gzFile gz = gzopen(file_name.c_str(), (pos == 0 ? "wb" : "ab"));
+        string part = text.substr(pos, step);
+        gzwrite(gz, part.c_str(), part.size());
+        gzclose(gz);
+    }
+}
+
+void WriteLE(ostream & out, unsigned int val, int bytes) {
+    for(int i = 0; i < bytes; i++)
+        out.put((char)((val >> (8*i)) & 0xff));
+}
+
+// Write one BGZF block
+void WriteBgzfBlock(ostream & out, const char * data, size_t size) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    vector<char> comp(deflateBound(&strm, size));
+    strm.next_in = (Bytef*)data;
+    strm.avail_in = size;
+    strm.next_out = (Bytef*)&comp[0];
+    strm.avail_out = comp.size();
+    deflate(&strm, Z_FINISH);
+    size_t comp_size = comp.size() - strm.avail_out;
+    deflateEnd(&strm);
+    const unsigned char header[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0};
+    out.write((const char*)header, sizeof(header));
+    WriteLE(out, comp_size + 25, 2);
+    out.write(&comp[0], comp_size);
+    WriteLE(out, crc32(crc32(0, NULL, 0), (const Bytef*)data, size), 4);
+    WriteLE(out, size, 4);
+}
+
+// Write text as a BGZF file, with the empty block that marks the end
+void WriteBgzf(const string & file_name, const string & text) {
+    ofstream out(file_name.c_str(), ios::out | ios::binary);
+    const size_t block = 60000;
+    for(size_t pos = 0; pos < text.size(); pos += block)
+        WriteBgzfBlock(out, text.c_str() + pos, min(block, text.size() - pos));
+    WriteBgzfBlock(out, "", 0);
+}
+
+string ReadAll(const string & file_name) {
+    InputFileStream in(file_name);
+    ostringstream oss;
+    string line;
+    while(getline(in, line))
+        oss << line << endl;
+    return oss.str();
+}
+
+}
+
 // ****** The tests *******
 BOOST_AUTO_TEST_SUITE(io_util)
 
@@ -34,4 +129,37 @@ BOOST_AUTO_TEST_CASE(TestReadUntil) {
     BOOST_CHECK(ret);
 }
 
+BOOST_AUTO_TEST_CASE(TestReadGzip) {
+    TempFile temp_file("test-io-util");
+    string text = MakeText(100000), file_name = temp_file.GetName();
+    WriteMultiGzip(file_name, text, 5);
+    BOOST_CHECK(ReadAll(file_name) == text);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadBgzf) {
+    TempFile temp_file("test-io-util-bgzf");
+    string text = MakeText(100000), file_name = temp_file.GetName();
+    WriteBgzf(file_name, text);
+    int threads = InputFileStream::GetInflateThreads();
+    InputFileStream::SetInflateThreads(2);
+    BOOST_CHECK(ReadAll(file_name) == text);
+    // BGZF files are also gzip files, so can be read on one thread
+    InputFileStream::SetInflateThreads(1);
+    BOOST_CHECK(ReadAll(file_name) == text);
+    InputFileStream::SetInflateThreads(threads);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadGzipCorrupt) {
+    TempFile temp_file("test-io-util-bad");
+    string text = MakeText(10000), file_name = temp_file.GetName();
+    WriteMultiGzip(file_name, text, 1);
+    // Cut off the end of the file
+    ifstream in(file_name.c_str(), ios::in | ios::binary);
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    ofstream out(file_name.c_str(), ios::out | ios::binary);
+    out << data.substr(0, data.size()/2);
+    out.close();
+    BOOST_CHECK_THROW(ReadAll(file_name), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
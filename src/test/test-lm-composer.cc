@@ -6,7 +6,10 @@
 #include <travatar/dict.h>
 #include <travatar/hyper-graph.h>
 #include <travatar/translation-rule.h>
+#include <travatar/nbest-list.h>
+#include <travatar/state-map.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <string>
 #include <fstream>
@@ -189,6 +192,63 @@ BOOST_AUTO_TEST_CASE(TestLMComposerBU) {
     BOOST_CHECK(exp_graph->CheckEqual(*act_graph));
 }
 
+BOOST_AUTO_TEST_CASE(TestLMComposerBUCubeGrowing) {
+    // Without pruning, cube growing should find the same best hypothesis as
+    // cube pruning
+    SparseMap weights;
+    weights[Dict::WID("lmunk")] = -20;
+    weights[Dict::WID("lm")] = 1;
+    LMComposerBU pruning(vector<string>(1, file_name_)), growing(vector<string>(1, file_name_));
+    pruning.SetStackPopLimit(100);
+    pruning.UpdateWeights(weights);
+    growing.SetStackPopLimit(100);
+    growing.SetCubeGrowing(true);
+    growing.UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> exp_graph(pruning.TransformGraph(*rule_graph_));
+    boost::shared_ptr<HyperGraph> act_graph(growing.TransformGraph(*rule_graph_));
+    BOOST_CHECK_CLOSE(exp_graph->GetNode(0)->GetViterbiScore(), act_graph->GetNode(0)->GetViterbiScore(), 0.001);
+    NbestList exp_nbest = exp_graph->GetNbest(1), act_nbest = act_graph->GetNbest(1);
+    BOOST_CHECK_EQUAL(exp_nbest[0]->GetTrgData(), act_nbest[0]->GetTrgData());
+}
+
+BOOST_AUTO_TEST_CASE(TestLMComposerBURestCost) {
+    // Rest costs only change the order of the queue, so without pruning the
+    // best hypothesis and its score should be unchanged
+    SparseMap weights;
+    weights[Dict::WID("lmunk")] = -20;
+    weights[Dict::WID("lm")] = 1;
+    LMComposerBU pruning(vector<string>(1, file_name_)), rest(vector<string>(1, file_name_));
+    pruning.SetStackPopLimit(100);
+    pruning.UpdateWeights(weights);
+    rest.SetStackPopLimit(100);
+    rest.SetRestCost(true);
+    rest.UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> exp_graph(pruning.TransformGraph(*rule_graph_));
+    boost::shared_ptr<HyperGraph> act_graph(rest.TransformGraph(*rule_graph_));
+    BOOST_CHECK_CLOSE(exp_graph->GetNode(0)->GetViterbiScore(), act_graph->GetNode(0)->GetViterbiScore(), 0.001);
+    NbestList exp_nbest = exp_graph->GetNbest(1), act_nbest = act_graph->GetNbest(1);
+    BOOST_CHECK_EQUAL(exp_nbest[0]->GetTrgData(), act_nbest[0]->GetTrgData());
+}
+
+BOOST_AUTO_TEST_CASE(TestLMComposerBUChartThreads) {
+    // Building the cells on several threads should give exactly the same
+    // graph as building them on one
+    SparseMap weights;
+    weights[Dict::WID("lmunk")] = -20;
+    weights[Dict::WID("lm")] = 1;
+    LMComposerBU serial(vector<string>(1, file_name_)), parallel(vector<string>(1, file_name_));
+    serial.SetStackPopLimit(3);
+    serial.UpdateWeights(weights);
+    parallel.SetStackPopLimit(3);
+    parallel.SetChartThreads(3);
+    parallel.UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> exp_graph(serial.TransformGraph(*rule_graph_));
+    for(int i = 0; i < 10; i++) {
+        boost::shared_ptr<HyperGraph> act_graph(parallel.TransformGraph(*rule_graph_));
+        BOOST_CHECK(exp_graph->CheckEqual(*act_graph));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TestLMComposerIncremental) {
     // Create the expected graph
     vector<int> ab(2); ab[0] = Dict::WID("s"); ab[1] = Dict::WID("t");
@@ -382,6 +442,33 @@ BOOST_AUTO_TEST_CASE(TestLMComposerIncrementalTimesTwo) {
     BOOST_CHECK(act_graph.get() && exp_graph->CheckEqual(*act_graph));
 }
 
+BOOST_AUTO_TEST_CASE(TestLMComposerIncrementalTwoLMs) {
+    // Two copies of the same LM should give the same result as one LM with
+    // twice the weight
+    SparseMap weights;
+    weights[Dict::WID("lm")] = 2;
+    weights[Dict::WID("lmunk")] = -40;
+    LMComposerIncremental one_lm(vector<string>(1, file_name_));
+    one_lm.SetStackPopLimit(100);
+    one_lm.UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> exp_graph(one_lm.TransformGraph(*rule_graph_));
+    vector<string> lm_strs;
+    lm_strs.push_back(file_name_);
+    lm_strs.push_back(file_name_ + "|lm_feat=lm2,lm_unk_feat=lmunk2");
+    LMComposerIncremental two_lms(lm_strs);
+    two_lms.SetStackPopLimit(100);
+    weights[Dict::WID("lm")] = 1; weights[Dict::WID("lm2")] = 1;
+    weights[Dict::WID("lmunk")] = -20; weights[Dict::WID("lmunk2")] = -20;
+    two_lms.UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> act_graph(two_lms.TransformGraph(*rule_graph_));
+    BOOST_CHECK_CLOSE(exp_graph->GetNode(0)->GetViterbiScore(), act_graph->GetNode(0)->GetViterbiScore(), 0.001);
+    NbestList exp_nbest = exp_graph->GetNbest(1), act_nbest = act_graph->GetNbest(1);
+    BOOST_CHECK_EQUAL(exp_nbest[0]->GetTrgData(), act_nbest[0]->GetTrgData());
+    SparseMap exp_feats = exp_nbest[0]->CalcFeatures().ToMap(), act_feats = act_nbest[0]->CalcFeatures().ToMap();
+    BOOST_CHECK_CLOSE(exp_feats[Dict::WID("lm")], act_feats[Dict::WID("lm")], 0.001);
+    BOOST_CHECK_CLOSE(act_feats[Dict::WID("lm")], act_feats[Dict::WID("lm2")], 0.001);
+}
+
 BOOST_AUTO_TEST_CASE(TestReverseBU) {
     // Create the expected graph
     vector<int> ab(2); ab[0] = Dict::WID("s"); ab[1] = Dict::WID("t");
@@ -616,4 +703,89 @@ BOOST_AUTO_TEST_CASE(TestReverseIncremental) {
     BOOST_CHECK(act_graph.get() && exp_graph->CheckMaybeEqual(*act_graph));
 }
 
+BOOST_AUTO_TEST_CASE(TestLMDataMapWords) {
+    LMData data(file_name_);
+    // Words in the LM get their own index, others are unknown
+    BOOST_CHECK(data.GetMapping(Dict::WID("a")) != 0);
+    BOOST_CHECK_EQUAL(data.GetMapping(Dict::WID("never_seen_by_the_lm")), 0);
+    BOOST_CHECK_EQUAL(data.GetMapping(-1), 0);
+    // Mapping a rule keeps non-terminals, and caches the result
+    TranslationRule rule;
+    rule.AddTrgWord(Dict::WID("a")); rule.AddTrgWord(-1); rule.AddTrgWord(Dict::WID("not_in_lm"));
+    Sentence exp_words(3);
+    exp_words[0] = data.GetMapping(Dict::WID("a")); exp_words[1] = -1; exp_words[2] = 0;
+    BOOST_CHECK(rule.GetLMRuleData(data.GetId()) == NULL);
+    const Sentence & act_words = data.MapWords(rule);
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_words.begin(), exp_words.end(), act_words.begin(), act_words.end());
+    BOOST_CHECK_EQUAL(&rule.GetLMRuleData(data.GetId())->words, &act_words);
+    // Edges use the words cached on their rule until their target changes
+    HyperEdge edge;
+    edge.SetRule(&rule);
+    Sentence buffer;
+    BOOST_CHECK_EQUAL(&data.MapWords(edge, buffer), &act_words);
+    edge.SetTrgData(rule.GetTrgData());
+    BOOST_CHECK_EQUAL(&data.MapWords(edge, buffer), &buffer);
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_words.begin(), exp_words.end(), buffer.begin(), buffer.end());
+}
+
+BOOST_AUTO_TEST_CASE(TestLMRuleDataScore) {
+    LMData data(file_name_);
+    boost::scoped_ptr<LMFunc> func(LMFunc::CreateFromType(data.GetType()));
+    // A child that produces "y a"
+    TranslationRule child;
+    child.AddTrgWord(Dict::WID("y")); child.AddTrgWord(Dict::WID("a"));
+    vector<vector<lm::ngram::ChartState> > states(1, vector<lm::ngram::ChartState>(1));
+    func->CalcNontermScore(&data, data.MapWords(child), states, 0, states[0][0]);
+    // Scoring the parent from its precomputed runs must match scoring every word
+    TranslationRule rule;
+    rule.AddTrgWord(Dict::WID("a")); rule.AddTrgWord(Dict::WID("b"));
+    rule.AddTrgWord(-1);
+    rule.AddTrgWord(Dict::WID("c")); rule.AddTrgWord(Dict::WID("unk_word")); rule.AddTrgWord(Dict::WID("x"));
+    const LMRuleData & rule_data = data.GetRuleData(rule);
+    BOOST_CHECK_EQUAL(rule_data.run_states.size(), 2);
+    BOOST_CHECK_EQUAL(rule_data.unk, 1);
+    lm::ngram::ChartState exp_state, act_state;
+    pair<Real,int> exp_score = func->CalcNontermScore(&data, rule_data.words, states, 0, exp_state);
+    pair<Real,int> act_score = func->CalcNontermScore(&data, rule_data, states, 0, act_state);
+    BOOST_CHECK_CLOSE(exp_score.first, act_score.first, 0.001);
+    BOOST_CHECK_EQUAL(exp_score.second, act_score.second);
+    BOOST_CHECK(exp_state == act_state);
+}
+
+BOOST_AUTO_TEST_CASE(TestStateMap) {
+    LMData data(file_name_);
+    boost::scoped_ptr<LMFunc> func(LMFunc::CreateFromType(data.GetType()));
+    // Make a different state for each word, enough to make the table grow
+    StateMap<vector<lm::ngram::ChartState>, int> state_map;
+    vector<vector<lm::ngram::ChartState> > states;
+    const char* words[] = {"a", "b", "c", "x", "y"};
+    for(int i = 0; i < 5; i++) {
+        for(int j = 0; j < 5; j++) {
+            Sentence sent(2);
+            sent[0] = Dict::WID(words[i]); sent[1] = Dict::WID(words[j]);
+            Sentence lm_sent;
+            data.MapWords(sent, lm_sent);
+            vector<lm::ngram::ChartState> state(1);
+            func->CalcNontermScore(&data, lm_sent, vector<vector<lm::ngram::ChartState> >(), 0, state[0]);
+            // Only states that have not been seen before are inserted
+            bool is_new = true;
+            for(int k = 0; k < (int)states.size(); k++)
+                is_new = is_new && (states[k] != state);
+            BOOST_CHECK_EQUAL(state_map.Insert(state, HashStates(state), states.size()).second, is_new);
+            if(is_new)
+                states.push_back(state);
+        }
+    }
+    BOOST_CHECK_EQUAL(state_map.Size(), (int)states.size());
+    BOOST_CHECK(states.size() > 8);
+    // Inserting the same states again finds the existing entries
+    for(int i = 0; i < (int)states.size(); i++) {
+        pair<int, bool> it = state_map.Insert(states[i], HashStates(states[i]), -1);
+        BOOST_CHECK(!it.second);
+        BOOST_CHECK_EQUAL(it.first, i);
+        BOOST_CHECK_EQUAL(state_map.GetEntry(i).value, i);
+    }
+    BOOST_CHECK_EQUAL(state_map.Size(), (int)states.size());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -188,9 +188,11 @@ public:
         // [0,2]:
         node[8]->SetSpan(pair<int,int>(0,2));
         node[8]->AddEdge(edge[8]);
+        node[8]->SetViterbiScore(0);
         // [0,3]:
         node[9]->SetSpan(pair<int,int>(0,3));
         node[9]->AddEdge(edge[9]);
+        node[9]->SetViterbiScore(0);
         // [0,4]:
         node[10]->SetSpan(pair<int,int>(0,4));
         node[10]->AddEdge(edge[10]);
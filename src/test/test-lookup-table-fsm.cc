@@ -8,6 +8,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/foreach.hpp>
+#include <algorithm>
 #include <string>
 
 using namespace std;
@@ -572,6 +573,43 @@ public:
         return ret;
     }
     
+    // Print the nodes and the edges of a graph, with the edges sorted as their
+    // order depends on the search
+    string PrintSorted(HyperGraph & graph) {
+        ostringstream out;
+        BOOST_FOREACH(HyperNode * node, graph.GetNodes()) {
+            node->Print(out);
+            out << endl;
+        }
+        vector<string> edges;
+        BOOST_FOREACH(HyperEdge * edge, graph.GetEdges()) {
+            edge->SetId(-1);
+            ostringstream oss;
+            edge->Print(oss);
+            edges.push_back(oss.str());
+        }
+        sort(edges.begin(), edges.end());
+        BOOST_FOREACH(const string & edge, edges)
+            out << edge << endl;
+        return out.str();
+    }
+
+    bool ChartMatch(LookupTableFSM & lookup, const string & inp) {
+        boost::shared_ptr<HyperGraph> input_graph(new HyperGraph);
+        BOOST_FOREACH(WordId word, Dict::ParseWords(inp))
+            input_graph->AddWord(word);
+        lookup.SetChartMatch(false);
+        boost::scoped_ptr<HyperGraph> exp_graph(lookup.TransformGraph(*input_graph));
+        lookup.SetChartMatch(true);
+        boost::scoped_ptr<HyperGraph> act_graph(lookup.TransformGraph(*input_graph));
+        string exp = PrintSorted(*exp_graph), act = PrintSorted(*act_graph);
+        if(exp != act) {
+            cerr << "Expected:" << endl << exp << endl << "Actual:" << endl << act << endl;
+            return false;
+        }
+        return true;
+    }
+
     boost::scoped_ptr<LookupTableFSM> lookup_fsm;
     boost::scoped_ptr<LookupTableFSM> lookup_fsm_split;
     boost::scoped_ptr<LookupTableFSM> lookup_fsm_extra;
@@ -607,6 +645,50 @@ BOOST_AUTO_TEST_CASE(TestMultiHead) {
     BOOST_CHECK(MultiHead(*lookup_fsm_mhd));
 }
 
+BOOST_AUTO_TEST_CASE(TestChartMatch) {
+    // The chart should find the same edges as the recursive search
+    BOOST_CHECK(ChartMatch(*lookup_fsm, "I eat two hamburgers"));
+    BOOST_CHECK(ChartMatch(*lookup_fsm_split, "I eat two hamburgers"));
+    BOOST_CHECK(ChartMatch(*lookup_fsm_extra, "I eat two hamburgers"));
+    BOOST_CHECK(ChartMatch(*lookup_fsm_c, "I eat three hamburgers I eat two hamburgers"));
+    BOOST_CHECK(ChartMatch(*lookup_fsm_mhd, "the program made by me"));
+    // Chains of unary rules
+    ostringstream rule_oss;
+    rule_oss << "\"a\" @ X ||| \"A\" @ X ||| p=1" << endl;
+    rule_oss << "x0:X @ Y ||| x0:X @ Y ||| p=1" << endl;
+    rule_oss << "x0:Y @ S ||| x0:Y @ S ||| p=1" << endl;
+    rule_oss << "x0:S \"b\" x1:Y @ S ||| x1:Y \"B\" x0:S @ S ||| p=1" << endl;
+    istringstream rule_iss(rule_oss.str());
+    LookupTableFSM lookup_unary;
+    lookup_unary.SetTrgFactors(1);
+    lookup_unary.AddRuleFSM(RuleFSM::ReadFromRuleTable(rule_iss));
+    BOOST_CHECK(ChartMatch(lookup_unary, "a b a b a"));
+}
+
+BOOST_AUTO_TEST_CASE(TestFilterVocab) {
+    // Filtering the rules with the words of the input should not change the graph
+    ostringstream rule_oss;
+    rule_oss << "\"I\" x0:X @ X ||| \"watashi\" \"wa\" x0:X @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"eat\" \"two\" x0:X @ X ||| \"futatsu\" \"no\" x0:X \"wo\" \"taberu\" @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"I\" x0:X \"two\" \"hamburgers\" @ X ||| \"watashi\" \"wa\" \"futatsu\" \"no\" \"hanbaga\" \"wo\" x0:X @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "x0:X x1:X @ X ||| x0:X x1:X @ X ||| glue=1" << endl;
+    rule_oss << "\"two\" @ X ||| \"futatsu\" @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    rule_oss << "\"hamburgers\" @ X ||| \"hanbaga\" @ X ||| Pegf=0.02 ppen=2.718" << endl;
+    HyperGraph input_graph;
+    BOOST_FOREACH(WordId word, Dict::ParseWords("I eat two"))
+        input_graph.AddWord(word);
+    set<WordId> vocab(input_graph.GetWords().begin(), input_graph.GetWords().end());
+    istringstream full_iss(rule_oss.str()), filtered_iss(rule_oss.str());
+    LookupTableFSM full, filtered;
+    full.SetTrgFactors(1); full.SetRootSymbol(Dict::WID("X"));
+    filtered.SetTrgFactors(1); filtered.SetRootSymbol(Dict::WID("X"));
+    full.AddRuleFSM(RuleFSM::ReadFromRuleTable(full_iss));
+    filtered.AddRuleFSM(RuleFSM::ReadFromRuleTable(filtered_iss, &vocab));
+    boost::scoped_ptr<HyperGraph> exp_graph(full.TransformGraph(input_graph));
+    boost::scoped_ptr<HyperGraph> act_graph(filtered.TransformGraph(input_graph));
+    BOOST_CHECK_EQUAL(PrintSorted(*exp_graph), PrintSorted(*act_graph));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 
@@ -6,6 +6,7 @@
 #include <travatar/dict.h>
 #include <travatar/hyper-graph.h>
 #include <travatar/lookup-table-hash.h>
+#include <travatar/lookup-table-hash-int.h>
 #include <travatar/lookup-table-marisa.h>
 #include <travatar/safe-access.h>
 #include <travatar/translation-rule.h>
@@ -13,11 +14,36 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
 
 using namespace std;
 using namespace boost;
 using namespace travatar;
 
+namespace {
+
+// A file with a unique name in /tmp that is deleted when it goes out of scope
+class TempFile {
+public:
+    TempFile(const string & prefix) {
+        string pattern = "/tmp/" + prefix + "-XXXXXX";
+        vector<char> buf(pattern.begin(), pattern.end());
+        buf.push_back(0);
+        int fd = mkstemp(&buf[0]);
+        BOOST_REQUIRE(fd != -1);
+        close(fd);
+        name_ = &buf[0];
+    }
+    ~TempFile() { unlink(name_.c_str()); }
+    const string & GetName() const { return name_; }
+private:
+    string name_;
+};
+
+}
+
 struct TestLookupTable {
 
     TestLookupTable() {
@@ -68,9 +94,22 @@ struct TestLookupTable {
         istringstream rule_iss_hash(rule_oss.str());
         lookup_hash.reset(LookupTableHash::ReadFromRuleTable(rule_iss_hash));
         lookup_hash->SetSaveSrcStr(true);
+        istringstream rule_iss_hash_int(rule_oss.str());
+        lookup_hash_int.reset(LookupTableHashInt::ReadFromRuleTable(rule_iss_hash_int));
+        lookup_hash_int->SetSaveSrcStr(true);
         istringstream rule_iss_marisa(rule_oss.str());
         lookup_marisa.reset(LookupTableMarisa::ReadFromRuleTable(rule_iss_marisa));
         lookup_marisa->SetSaveSrcStr(true);
+        // Compile the marisa table into binary format and read it back
+        string bin_file = "/tmp/test-lookup-table.bin";
+        {
+            ofstream bin_out(bin_file.c_str(), ios::out | ios::binary);
+            lookup_marisa->WriteBinary(bin_out);
+        }
+        lookup_marisa_bin.reset(LookupTableMarisa::ReadFromBinaryFile(bin_file));
+        lookup_marisa_bin->SetSaveSrcStr(true);
+        lookup_marisa_read.reset(LookupTableMarisa::ReadFromBinaryFile(bin_file, util::READ));
+        lookup_marisa_read->SetSaveSrcStr(true);
     
         string src2_tree = 
     "{\"nodes\": ["
@@ -129,19 +168,21 @@ struct TestLookupTable {
         exp_match_cnt[2] = 1;
         exp_match_cnt[4] = 1;
         exp_match_cnt[9] = 1;
-        vector<boost::shared_ptr<LookupState> > old_states;
-        old_states.push_back(boost::shared_ptr<LookupState>(lookup.GetInitialState()));
+        LookupStatePool pool;
+        boost::scoped_ptr<LookupState> init(lookup.GetInitialState());
+        vector<LookupState*> old_states(1, init.get());
         for(int i = 0; i < 11; i++)
-            act_match_cnt[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states).size();
+            act_match_cnt[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states, pool).size();
         return CheckVector(exp_match_cnt, act_match_cnt);
     }
     
     int TestLookupRules(LookupTable & lookup) {
-        vector<vector<boost::shared_ptr<LookupState> > > act_lookups(11);
-        vector<boost::shared_ptr<LookupState> > old_states;
-        old_states.push_back(boost::shared_ptr<LookupState>(lookup.GetInitialState()));
+        vector<vector<LookupState*> > act_lookups(11);
+        LookupStatePool pool;
+        boost::scoped_ptr<LookupState> init(lookup.GetInitialState());
+        vector<LookupState*> old_states(1, init.get());
         for(int i = 0; i < 11; i++)
-            act_lookups[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states);
+            act_lookups[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states, pool);
         vector<TranslationRule*> exp_rules(7), act_rules(7);
         act_rules[0] = SafeReference(lookup.FindRules(*act_lookups[0][0]))[0]; // First S(NP, VP)
         act_rules[1] = SafeReference(lookup.FindRules(*act_lookups[0][0]))[1]; // Second S(NP, VP)
@@ -200,11 +241,12 @@ struct TestLookupTable {
     int TestBuildRuleGraph(LookupTable & lookup) {
         // Make the rule graph
         boost::shared_ptr<HyperGraph> act_rule_graph(lookup.TransformGraph(*src1_graph));
-        vector<vector<boost::shared_ptr<LookupState> > > act_lookups(11);
-        vector<boost::shared_ptr<LookupState> > old_states;
-        old_states.push_back(boost::shared_ptr<LookupState>(lookup.GetInitialState()));
+        vector<vector<LookupState*> > act_lookups(11);
+        LookupStatePool pool;
+        boost::scoped_ptr<LookupState> init(lookup.GetInitialState());
+        vector<LookupState*> old_states(1, init.get());
         for(int i = 0; i < 11; i++)
-            act_lookups[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states);
+            act_lookups[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states, pool);
         // Create the rule graph
         // string src1_tree = "(S0 (NP1 (PRP2 he3)) (VP4 (AUX5 does6) (RB7 not8) (VB9 go10)))";
         HyperGraph exp_rule_graph;
@@ -293,7 +335,10 @@ struct TestLookupTable {
 
     JSONTreeIO tree_io;
     boost::scoped_ptr<LookupTableHash> lookup_hash;
+    boost::scoped_ptr<LookupTableHashInt> lookup_hash_int;
     boost::scoped_ptr<LookupTableMarisa> lookup_marisa;
+    boost::scoped_ptr<LookupTableMarisa> lookup_marisa_bin;
+    boost::scoped_ptr<LookupTableMarisa> lookup_marisa_read;
     boost::scoped_ptr<HyperGraph> src1_graph;
     boost::scoped_ptr<HyperGraph> src2_graph;
     boost::scoped_ptr<LookupTable> lookup_trg;
@@ -309,23 +354,87 @@ BOOST_FIXTURE_TEST_SUITE(lookup_table, TestLookupTable)
 BOOST_AUTO_TEST_CASE(TestLookupHash) {
     BOOST_CHECK(TestLookup(*lookup_hash));
 }
+BOOST_AUTO_TEST_CASE(TestLookupHashInt) {
+    BOOST_CHECK(TestLookup(*lookup_hash_int));
+}
 BOOST_AUTO_TEST_CASE(TestLookupMarisa) {
     BOOST_CHECK(TestLookup(*lookup_marisa));
 }
+BOOST_AUTO_TEST_CASE(TestLookupMarisaBin) {
+    BOOST_CHECK(TestLookup(*lookup_marisa_bin));
+}
+BOOST_AUTO_TEST_CASE(TestLookupMarisaRead) {
+    BOOST_CHECK(TestLookup(*lookup_marisa_read));
+}
 
 BOOST_AUTO_TEST_CASE(TestLookupRulesHash) {
     BOOST_CHECK(TestLookupRules(*lookup_hash));
 }
+BOOST_AUTO_TEST_CASE(TestLookupRulesHashInt) {
+    BOOST_CHECK(TestLookupRules(*lookup_hash_int));
+}
 BOOST_AUTO_TEST_CASE(TestLookupRulesMarisa) {
     BOOST_CHECK(TestLookupRules(*lookup_marisa));
 }
+BOOST_AUTO_TEST_CASE(TestLookupRulesMarisaBin) {
+    BOOST_CHECK(TestLookupRules(*lookup_marisa_bin));
+}
+BOOST_AUTO_TEST_CASE(TestLookupRulesMarisaRead) {
+    BOOST_CHECK(TestLookupRules(*lookup_marisa_read));
+}
 
 BOOST_AUTO_TEST_CASE(TestBuildRuleGraphHash) {
     BOOST_CHECK(TestBuildRuleGraph(*lookup_hash));
 }
+BOOST_AUTO_TEST_CASE(TestBuildRuleGraphHashInt) {
+    BOOST_CHECK(TestBuildRuleGraph(*lookup_hash_int));
+}
 BOOST_AUTO_TEST_CASE(TestBuildRuleGraphMarisa) {
     BOOST_CHECK(TestBuildRuleGraph(*lookup_marisa));
 }
+BOOST_AUTO_TEST_CASE(TestBuildRuleGraphMarisaBin) {
+    BOOST_CHECK(TestBuildRuleGraph(*lookup_marisa_bin));
+}
+BOOST_AUTO_TEST_CASE(TestBuildRuleGraphMarisaRead) {
+    BOOST_CHECK(TestBuildRuleGraph(*lookup_marisa_read));
+}
+
+BOOST_AUTO_TEST_CASE(TestFilterMarisa) {
+    // With all of the words of the input, the rule graph is the same
+    set<WordId> vocab(src1_graph->GetWords().begin(), src1_graph->GetWords().end());
+    boost::scoped_ptr<LookupTableMarisa> filtered(lookup_marisa->Filter(vocab));
+    filtered->SetSaveSrcStr(true);
+    BOOST_CHECK(TestBuildRuleGraph(*filtered));
+    boost::scoped_ptr<LookupTableMarisa> filtered_bin(lookup_marisa_bin->Filter(vocab));
+    filtered_bin->SetSaveSrcStr(true);
+    BOOST_CHECK(TestBuildRuleGraph(*filtered_bin));
+}
+
+BOOST_AUTO_TEST_CASE(TestFilterMarisaBin) {
+    // Without "does", the rule for the VP is removed but the others remain
+    set<WordId> vocab;
+    vocab.insert(Dict::WID("he")); vocab.insert(Dict::WID("not")); vocab.insert(Dict::WID("go"));
+    boost::scoped_ptr<LookupTableMarisa> filtered(lookup_marisa_bin->Filter(vocab));
+    // Write the filtered table and read it back
+    TempFile temp_file("test-lookup-table-filtered");
+    const string & bin_file = temp_file.GetName();
+    {
+        ofstream bin_out(bin_file.c_str(), ios::out | ios::binary);
+        filtered->WriteBinary(bin_out);
+    }
+    boost::scoped_ptr<LookupTableMarisa> filtered_bin(LookupTableMarisa::ReadFromBinaryFile(bin_file));
+    vector<int> exp_match_cnt(11, 0), act_match_cnt(11, 0);
+    exp_match_cnt[0] = 2;
+    exp_match_cnt[1] = 1;
+    exp_match_cnt[2] = 1;
+    exp_match_cnt[9] = 1;
+    LookupStatePool pool;
+    boost::scoped_ptr<LookupState> init(filtered_bin->GetInitialState());
+    vector<LookupState*> old_states(1, init.get());
+    for(int i = 0; i < 11; i++)
+        act_match_cnt[i] = filtered_bin->LookupSrc(*src1_graph->GetNode(i), old_states, pool).size();
+    BOOST_CHECK(CheckVector(exp_match_cnt, act_match_cnt));
+}
 
 BOOST_AUTO_TEST_CASE(TestBuildTrgRules) {
     BOOST_CHECK(TestBuildRuleTrg(*lookup_trg));
@@ -0,0 +1,62 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <travatar/output-collector.h>
+#include <travatar/task.h>
+#include <travatar/thread-pool.h>
+#include <sstream>
+
+using namespace std;
+using namespace travatar;
+
+// A task that writes its id to the collector
+class CollectorTask : public Task {
+public:
+    CollectorTask(int id, OutputCollector * collector) : id_(id), collector_(collector) { }
+    void Run() {
+        ostringstream oss; oss << id_ << endl;
+        collector_->Write(id_, oss.str(), "");
+    }
+private:
+    int id_;
+    OutputCollector * collector_;
+};
+
+// ****** The tests *******
+BOOST_AUTO_TEST_SUITE(output_collector)
+
+// Check that sentences written out of order are output in order
+BOOST_AUTO_TEST_CASE(TestOutOfOrder) {
+    ostringstream out, err;
+    {
+        OutputCollector collector(&out, &err, true, 4);
+        collector.Write(2, "c\n", "");
+        collector.Write(1, "b\n", "y\n");
+        collector.Skip(3);
+        collector.Write(0, "a\n", "x\n");
+        collector.Flush();
+        BOOST_CHECK_EQUAL(out.str(), "a\nb\nc\n");
+        BOOST_CHECK_EQUAL(err.str(), "x\ny\n");
+        collector.Write(4, "d\n", "");
+    }
+    BOOST_CHECK_EQUAL(out.str(), "a\nb\nc\nd\n");
+}
+
+// Check that the output stays in order when the ring is smaller than the
+// number of sentences written by several threads
+BOOST_AUTO_TEST_CASE(TestThreaded) {
+    ostringstream out, exp, err;
+    {
+        OutputCollector collector(&out, &err, true, 64);
+        ThreadPool pool(4, 4);
+        for(int i = 0; i < 1000; i++) {
+            exp << i << endl;
+            pool.Submit(new CollectorTask(i, &collector));
+        }
+        pool.Stop(true);
+        collector.Flush();
+    }
+    BOOST_CHECK_EQUAL(out.str(), exp.str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,81 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <travatar/task.h>
+#include <travatar/thread-pool.h>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+using namespace travatar;
+
+// A task that records the order in which it was run
+class OrderTask : public Task {
+public:
+    OrderTask(int id, int cost, vector<int> * order, boost::mutex * mutex) :
+        id_(id), cost_(cost), order_(order), mutex_(mutex) { }
+    void Run() {
+        boost::mutex::scoped_lock lock(*mutex_);
+        order_->push_back(id_);
+    }
+    virtual int GetCost() const { return cost_; }
+private:
+    int id_, cost_;
+    vector<int> * order_;
+    boost::mutex * mutex_;
+};
+
+// A task that holds its thread until the mutex is released
+class BlockTask : public Task {
+public:
+    BlockTask(boost::mutex * block, std::atomic<bool> * started) : block_(block), started_(started) { }
+    void Run() { *started_ = true; boost::mutex::scoped_lock lock(*block_); }
+private:
+    boost::mutex * block_;
+    std::atomic<bool> * started_;
+};
+
+// ****** The tests *******
+BOOST_AUTO_TEST_SUITE(thread_pool)
+
+// Check that all tasks are run exactly once
+BOOST_AUTO_TEST_CASE(TestAllTasksRun) {
+    vector<int> order;
+    boost::mutex mutex;
+    {
+        ThreadPool pool(4, 8);
+        for(int i = 0; i < 1000; i++)
+            pool.Submit(new OrderTask(i, i % 7, &order, &mutex));
+        pool.Stop(true);
+    }
+    sort(order.begin(), order.end());
+    vector<int> exp(1000);
+    for(int i = 0; i < 1000; i++) exp[i] = i;
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp.begin(), exp.end(), order.begin(), order.end());
+}
+
+// Check that tasks within the window are started most expensive first
+BOOST_AUTO_TEST_CASE(TestLongestFirst) {
+    vector<int> order;
+    boost::mutex mutex;
+    ThreadPool pool(1, 10);
+    pool.SetWindow(5);
+    // Hold the only thread until all the tasks have been submitted
+    boost::mutex block;
+    std::atomic<bool> started(false);
+    block.lock();
+    pool.Submit(new BlockTask(&block, &started));
+    while(!started)
+        boost::this_thread::yield();
+    int costs[5] = {1, 5, 3, 4, 2};
+    for(int i = 0; i < 5; i++)
+        pool.Submit(new OrderTask(i, costs[i], &order, &mutex));
+    block.unlock();
+    pool.Stop(true);
+    int exp[5] = {1, 3, 2, 4, 0};
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp, exp+5, order.begin(), order.end());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -181,6 +181,28 @@ BOOST_AUTO_TEST_CASE(TestReadPenn) {
     BOOST_CHECK(tree_exp.CheckEqual(*hg_act) && left_act == left_exp);
 }
 
+BOOST_AUTO_TEST_CASE(TestReadPennBuffer) {
+    PennTreeIO io;
+    // Read from a buffer, which should be left after the tree
+    const char * ptr = tree_str.data(), * end = ptr + tree_str.size();
+    boost::scoped_ptr<HyperGraph> hg_act(io.ReadTree(ptr, end));
+    BOOST_CHECK(tree_exp.CheckEqual(*hg_act));
+    BOOST_CHECK_EQUAL(string(ptr, end), "AAA");
+    // Read a string, and several trees on one line of a stream
+    boost::scoped_ptr<HyperGraph> hg_str(io.ReadFromString(tree_str));
+    BOOST_CHECK(tree_exp.CheckEqual(*hg_str));
+    istringstream instr("(A (B (C x) (D y)) (E z)) () (A (B (C x) (D y)) (E z))\n\n");
+    boost::scoped_ptr<HyperGraph> hg1(io.ReadTree(instr)), hg2(io.ReadTree(instr)), hg3(io.ReadTree(instr)), hg4(io.ReadTree(instr));
+    BOOST_CHECK(tree_exp.CheckEqual(*hg1));
+    BOOST_CHECK_EQUAL(hg2->NumNodes(), 0);
+    BOOST_CHECK(tree_exp.CheckEqual(*hg3));
+    BOOST_CHECK(hg4.get() == NULL);
+    // Bad trees throw errors
+    BOOST_CHECK_THROW(io.ReadFromString(")(A x)"), std::runtime_error);
+    BOOST_CHECK_THROW(io.ReadFromString("(A (B x y))"), std::runtime_error);
+    BOOST_CHECK_THROW(io.ReadFromString("A (B x))"), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_CASE(TestReadPennEmpty) {
     PennTreeIO io;
     HyperGraph hg_exp;
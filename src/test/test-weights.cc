@@ -5,6 +5,7 @@
 #include <travatar/weights-perceptron.h>
 #include <travatar/weights-average-perceptron.h>
 #include <travatar/dict.h>
+#include <travatar/translation-rule.h>
 #include <travatar/check-equal.h>
 
 using namespace std;
@@ -63,4 +64,60 @@ BOOST_AUTO_TEST_CASE(TestAvgPerceptronUpdate) {
     BOOST_CHECK(CheckMap(weights_exp.GetFinal(), weights_act.GetFinal()));
 }
 
+BOOST_AUTO_TEST_CASE(TestSparseVectorDedup) {
+    vector<SparsePair> pairs;
+    pairs.push_back(make_pair(Dict::WID("b"), 1.0));
+    pairs.push_back(make_pair(Dict::WID("a"), 0.5));
+    pairs.push_back(make_pair(Dict::WID("b"), 2.0));
+    SparseVector act(pairs), exp;
+    exp.Add(Dict::WID("a"), 0.5);
+    exp.Add(Dict::WID("b"), 3.0);
+    BOOST_CHECK_EQUAL(exp, act);
+}
+
+BOOST_AUTO_TEST_CASE(TestDenseWeights) {
+    SparseMap weights;
+    weights[Dict::WID("a")] = 0.5;
+    weights[Dict::WID("b")] = -2.0;
+    weights[Dict::WID("c")] = 0.0;
+    DenseWeights dense(weights);
+    BOOST_CHECK_EQUAL(dense.Get(Dict::WID("b")), -2.0);
+    BOOST_CHECK_EQUAL(dense.Get(Dict::WID("c")), 0.0);
+    BOOST_CHECK_EQUAL(dense.Get(Dict::WID("not-a-weight")), 0.0);
+    // Check both the unrolled loop and the remainder
+    SparseVector feats;
+    feats.Add(Dict::WID("a"), 2.0);
+    feats.Add(Dict::WID("b"), 1.5);
+    feats.Add(Dict::WID("c"), 4.0);
+    feats.Add(Dict::WID("d"), 1.0);
+    feats.Add(Dict::WID("e"), 1.0);
+    BOOST_CHECK_CLOSE(weights * feats, dense * feats, 1e-6);
+    vector<const SparseVector*> batch(2, &feats);
+    vector<Real> scores;
+    dense.Dot(batch, scores);
+    BOOST_CHECK_EQUAL(scores.size(), 2);
+    BOOST_CHECK_CLOSE(scores[1], -2.0, 1e-6);
+}
+
+BOOST_AUTO_TEST_CASE(TestCachedRuleScore) {
+    Weights weights;
+    weights.SetCurrent(Dict::WID("a"), 0.5);
+    SparseVector feats;
+    feats.Add(Dict::WID("a"), 2.0);
+    TranslationRule rule(CfgDataVector(), feats);
+    BOOST_CHECK_CLOSE(rule.GetScore(weights), 1.0, 1e-6);
+    // Changing the weights must change the version and the cached score
+    int version = weights.GetVersion();
+    weights.SetCurrent(Dict::WID("a"), 1.5);
+    BOOST_CHECK(version != weights.GetVersion());
+    BOOST_CHECK_CLOSE(rule.GetScore(weights), 3.0, 1e-6);
+    // Online updates also change the version
+    WeightsPerceptron perceptron;
+    perceptron.SetCurrent(Dict::WID("a"), 0.5);
+    version = perceptron.GetVersion();
+    perceptron.Update(feats, 0.5, 1.0, SparseVector(), 1.0, 0.5);
+    BOOST_CHECK(version != perceptron.GetVersion());
+    BOOST_CHECK_CLOSE(rule.GetScore(perceptron), 5.0, 1e-6);
+}
+
 BOOST_AUTO_TEST_SUITE_END()